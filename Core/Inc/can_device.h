@@ -7,6 +7,10 @@
 
 #define LOCAL_CAN_DEVTAB_SIZE 256
 
+#define CAN_DEV_WORK_QUEUE_SIZE 16 // power of 2
+#define CAN_DEV_PENDING_SIZE 8 // remote ioctls in flight over all devices
+#define CAN_DEV_SYNC_TIMEOUT_MS 100 // slot lifetime of a can_dev_ioctl command without response
+
 typedef uint8_t* (*can_dev_rcv_fn) (uint8_t* cmd);
 
 typedef struct can_device {
@@ -16,8 +20,56 @@ typedef struct can_device {
     uint8_t input_length;
     uint8_t prev_data[8];
     can_dev_rcv_fn callback;
+    uint8_t unsolicited; // sends frames on its own (has a receive callback), so responses cannot be matched
 } can_device_t;
 
+typedef enum can_dev_work_kind {
+    CDW_TX = 0, // send data as is
+    CDW_IOCTL = 1 // run dev's ioctl on data, send the result
+} can_dev_work_kind_t;
+
+// one entry of the ISR -> main loop work queue
+typedef struct can_dev_work {
+    volatile uint8_t ready; // set once the producer has filled the entry
+    uint8_t kind; // can_dev_work_kind_t
+    uint8_t priority;
+    uint8_t address;
+    dev_handle_t dev;
+    data_field_t data;
+} can_dev_work_t;
+
+typedef enum can_dev_async_status {
+    CDA_FREE = 0, // tag unknown or already collected
+    CDA_ALLOC = 1, // being set up by the caller
+    CDA_PENDING = 2, // sent, waiting for the response
+    CDA_DONE = 3, // response received
+    CDA_TIMEOUT = 4 // no response before the deadline
+} can_dev_async_status_t;
+
+// completion of a remote ioctl, called from the main loop (can_dev_process)
+// res is the response on CDA_DONE, empty on CDA_TIMEOUT
+typedef void (*can_dev_async_fn) (uint16_t tag, can_dev_async_status_t status, data_field_t* res);
+
+// remote ioctl in flight
+// responses carry no tag (a classic frame has no byte to spare), so each
+// address has at most one request in flight and a response completes it;
+// every command to a device goes through this pool, including can_dev_ioctl,
+// and devices sending unsolicited frames take no async requests
+// a remote ioctl that returns NULL sends no response, its request times out;
+// a response arriving after its request timed out is taken by the next one
+typedef struct can_dev_pending {
+    volatile uint8_t status; // can_dev_async_status_t
+    uint8_t address;
+    uint16_t tag;
+    uint32_t deadline; // HAL_GetTick() ms
+    can_dev_async_fn done;
+    uint8_t discard; // can_dev_ioctl command, freed on completion or timeout without a callback
+    data_field_t res;
+} can_dev_pending_t;
+
+// replaces the FDCAN for outgoing frames, see can_dev_loopback_tx
+typedef void (*can_dev_tx_fn) (uint8_t priority, uint8_t address, uint8_t length, uint8_t* data);
+
 // initialize can devtab
 // returns pointer to can devtab
 can_device_t* can_dev_init_devtab(FDCAN_HandleTypeDef* fdcan);
@@ -25,6 +77,8 @@ can_device_t* can_dev_init_devtab(FDCAN_HandleTypeDef* fdcan);
 // start can devtab
 void can_dev_start(FDCAN_HandleTypeDef* fdcan);
 
+// a device with a receive callback sends frames on its own (e.g. o2, radio),
+// its frames go to the callback and never complete async requests
 void can_dev_set_callback(uint16_t id, can_dev_rcv_fn callback);
 
 // register device in can devtab
@@ -35,8 +89,42 @@ can_device_t* can_dev_register(uint16_t id, uint8_t priority, uint8_t input_leng
 // returns pointer to device, else NULL
 can_device_t* can_dev_get_device(uint16_t id);
 
+// queue a command to a remote device (sent from the main loop)
+// the response is matched and dropped, the command is dropped (can_dev_sync_dropped)
+// while a request to the device is in flight or every pending slot is
 void can_dev_ioctl(uint16_t id, data_field_t* cmd);
 
+// send a command to a remote device and track its response
+// done is called from the main loop on completion or timeout, pass NULL to poll instead
+// returns tag (never 0), else 0 if the device is unknown, sends unsolicited frames,
+// already has a request in flight, or too many requests are in flight
+uint16_t can_dev_ioctl_async(uint16_t id, data_field_t* cmd, uint32_t timeout_ms, can_dev_async_fn done);
+
+// poll a request started without callback, copies the response into res on CDA_DONE
+// the request is released once a final status (CDA_DONE, CDA_TIMEOUT) is returned
+can_dev_async_status_t can_dev_async_poll(uint16_t tag, data_field_t* res);
+
+// time out requests past their deadline, run pending callbacks
+// called by can_dev_process
+void can_dev_async_expire(uint32_t now);
+
+// complete the pending request for address with a response
+// returns 1 if a request was completed, 0 if none was waiting
+uint8_t can_dev_async_complete(uint8_t address, uint8_t length, uint8_t* data);
+
+// send outgoing frames through tx instead of the FDCAN, NULL restores the FDCAN
+void can_dev_set_loopback(can_dev_tx_fn tx);
+
+// loopback stand-in: answers commands with the local device of the same address
+void can_dev_loopback_tx(uint8_t priority, uint8_t address, uint8_t length, uint8_t* data);
+
+// run deferred ioctls and all pending transmissions
+// main loop only, returns number of work items processed
+size_t can_dev_process();
+
+// 1 if there is queued work for can_dev_process
+uint8_t can_dev_work_pending();
+
 void can_dev_cmd_callback(FDCAN_HandleTypeDef* fdcan, canlib2_rx_return_t ret);
 
 void can_dev_rcv_callback(FDCAN_HandleTypeDef* fdcan, canlib2_rx_return_t ret);
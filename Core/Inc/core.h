@@ -4,20 +4,73 @@
 #include "main.h"
 #include "stm32h5xx_hal.h"
 
-void core_init(TIM_HandleTypeDef* htim_10us_i, TIM_HandleTypeDef* htim_100ns_tick_i, TIM_HandleTypeDef* htim_timing, FDCAN_HandleTypeDef* fdcan);
+void core_init(TIM_HandleTypeDef* htim_100ns_tick_i, TIM_HandleTypeDef* htim_timing, FDCAN_HandleTypeDef* fdcan, ADC_HandleTypeDef* adc);
+
+// CYCLE COUNTER (profiling)
+// DWT cycle counter by default, a host build can supply its own clock with a
+// global C define, e.g. -D'CORE_CYCLES()=host_cycles()'
+#ifndef CORE_CYCLES
+#define CORE_CYCLES() (DWT->CYCCNT)
+#define CORE_CYCLES_DWT
+#endif
+
+// enable the cycle counter
+void core_cycles_init();
 
 // TICK TIMER RELATED
-uint64_t core_get_tick();
+// time stays in native 100ns ticks, absolute times are 64-bit and durations
+// 32-bit (up to 429s); conversions of constants fold at compile time and the
+// rest use multiply-shift, never a 64-bit division
+typedef uint64_t core_tick_t; // absolute time
+typedef uint32_t core_ticks_t; // duration
+
+#define CORE_TICKS_PER_US 10
+#define CORE_US_TO_TICKS(us) ((core_ticks_t) (us) * CORE_TICKS_PER_US)
+#define CORE_MS_TO_TICKS(ms) ((core_ticks_t) (ms) * 1000 * CORE_TICKS_PER_US)
+
+// x / 10, exact for every 32-bit x
+static inline uint32_t core_div10(uint32_t x) {
+    return (uint32_t) (((uint64_t) x * 0xCCCCCCCDu) >> 35);
+}
+
+// duration in us
+static inline uint32_t core_ticks_to_us(core_ticks_t ticks) {
+    return core_div10(ticks);
+}
+
+// TIM2 counter and status reads behind the 64-bit tick, a host build can
+// script them the same way, e.g. -D'CORE_TICK_CNT()=host_tick_cnt()'
+#ifndef CORE_TICK_CNT
+#define CORE_TICK_CNT() (htim_100ns_tick->Instance->CNT)
+#endif
+#ifndef CORE_TICK_SR
+#define CORE_TICK_SR() (htim_100ns_tick->Instance->SR)
+#endif
+
+// 64-bit tick, the 32-bit TIM2 extended by its update interrupt
+// (no wrap for 58,000 years)
+core_tick_t core_get_raw_tick();
+void core_tick_irq_handler();
+
+// ticks since init or core_reset_tick
+core_tick_t core_get_tick();
 void core_reset_tick();
 
+// ticks elapsed since an earlier core_get_tick
+static inline core_ticks_t core_ticks_since(core_tick_t start) {
+    return (core_ticks_t) (core_get_tick() - start);
+}
+
+// TIM2 counter value at a core tick, for compare channels on the tick timer
+uint32_t core_tick_to_counter(core_tick_t tick);
+
+// us since init or core_reset_tick
 uint64_t core_get_us_tick();
 
-void core_10us_callback();
-void core_1ms_callback();
-void core_100ms_callback();
+// main loop body: deferred work, then sleep until the next interrupt
+void core_background_loop();
 
-void core_10us_loop();
-void core_1ms_loop();
+void core_din_changed(uint8_t i, uint8_t level, core_tick_t tick);
 void core_100ms_loop();
 
 #endif // __INCLUDE_CORE_H
\ No newline at end of file
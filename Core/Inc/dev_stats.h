@@ -0,0 +1,66 @@
+#ifndef __INCLUDE_DEV_STATS_H
+#define __INCLUDE_DEV_STATS_H
+
+#include "main.h"
+#include "stm32h5xx_hal.h"
+#include "device.h"
+#include "core.h"
+
+#define DEV_STATS_DEVICE_ID 0x0017
+
+#define DEV_STATS_SIZE 16 // number of ids tracked
+#define DEV_STATS_HIST_BUCKETS 16 // bucket b counts calls taking [2^b, 2^(b+1)) cycles, last bucket is open ended
+
+// pseudo id (8-bit address 0xFF, unused by devices) for the whole CAN command path
+#define DEV_STATS_CAN_CMD_ID 0x00FF
+
+// instrumentation can be compiled out with a global C define
+#ifndef DEV_STATS_ENABLED
+#define DEV_STATS_ENABLED 1
+#endif
+
+#if DEV_STATS_ENABLED
+#define DEV_STATS_BEGIN() uint32_t dev_stats_start = CORE_CYCLES()
+#define DEV_STATS_END(id) dev_stats_record((id), CORE_CYCLES() - dev_stats_start)
+#else
+#define DEV_STATS_BEGIN()
+#define DEV_STATS_END(id)
+#endif
+
+typedef struct dev_stats {
+    uint16_t id;
+    uint16_t hist[DEV_STATS_HIST_BUCKETS]; // saturating
+    uint32_t count;
+    uint32_t min; // cycles
+    uint32_t max; // cycles
+    uint64_t total; // cycles, for the mean
+} dev_stats_t;
+
+// clear all stats
+void dev_stats_init();
+
+// record one call of the device with this id
+// an id sharing its 8-bit address with an id already tracked is not recorded
+void dev_stats_record(uint16_t id, uint32_t cycles);
+
+// get stats for id, else NULL if never called or untracked
+const dev_stats_t* dev_stats_get(uint16_t id);
+
+// ioctl commands
+typedef enum dev_stats_cmd {
+    DSC_GET_COUNT = 0, // returns 4-byte call count
+    DSC_GET_MIN = 1, // returns 4-byte min cycles
+    DSC_GET_MAX = 2, // returns 4-byte max cycles
+    DSC_GET_MEAN = 3, // returns 4-byte mean cycles
+    DSC_GET_HIST = 4, // returns 4 x 2-byte buckets starting at bucket data[2]
+    DSC_RESET = 5 // clears all stats, returns 1 byte (0)
+} dev_stats_cmd_t;
+
+// stats ioctl
+// 2-3 bytes input - dev_stats_cmd_t, device address, (first bucket for DSC_GET_HIST)
+// n bytes output depending on command for the id tracked at the address, 1 byte (0xFF) if none
+data_field_t* dev_stats_ioctl(data_field_t* cmd);
+data_field_t* dev_stats_ioctl_r(data_field_t* cmd, data_field_t* res);
+extern const device_t dev_stats_dev;
+
+#endif // __INCLUDE_DEV_STATS_H
\ No newline at end of file
@@ -4,10 +4,19 @@
 #include "main.h"
 #include "stm32h5xx_hal.h"
 
-#define LOCAL_DEVTAB_SIZE 32
+#ifndef LOCAL_DEVTAB_SIZE
+#define LOCAL_DEVTAB_SIZE 8 // dynamically registered devices only, see DEV_STATIC
+#endif
+
+// direct-mapped lookup index keyed on the 8-bit CAN address (low byte of id)
+#define DEV_INDEX_SIZE 256
+#define DEV_INDEX_KEY(id) ((id) & 0xFF)
 
 #define DEV_EMPTY_DEVICE_ID 0xF800
 #define DEV_TEST_DEVICE_ID 0xF801
+#define DEV_VECTOR_DEVICE_ID 0x0002
+
+#define DEV_IOCTLV_MAX 4 // entries in one vectored CAN command (address + command byte each)
 
 typedef struct device_data_field {
     uint8_t length;
@@ -15,39 +24,118 @@ typedef struct device_data_field {
     uint8_t data[8];
 } data_field_t;
 
+// one (device id, command) entry of a vectored ioctl
+typedef struct device_iovec {
+    uint16_t id;
+    uint8_t ok; // set by dev_ioctlv: 1 if res is valid
+    data_field_t cmd;
+    data_field_t res;
+} dev_iovec_t;
+
 typedef data_field_t* (*device_ioctl) (data_field_t* cmd);
+typedef data_field_t* (*device_ioctl_r) (data_field_t* cmd, data_field_t* res);
+typedef size_t (*device_ioctlv) (dev_iovec_t* iov, size_t n);
+typedef void (*device_set_fn) (uint8_t value);
+typedef uint32_t (*device_get_fn) (void);
 
 typedef struct device {
     uint16_t id; // 11-bit identifier corresponding to CAN (only top 8 should be used)
     const char* name;
     device_ioctl ioctl; // ioctl function: pass in a uint8_t* (up to 8 bytes) and returns a uint8_t* (up to 8 bytes)
+    device_set_fn set; // optional fast path: write a single value (e.g. an output bit), NULL if unsupported
+    device_get_fn get; // optional fast path: read a single u32, NULL if unsupported
+    device_ioctl_r ioctl_r; // optional caller-buffered ioctl: result is written to res, returns res (or NULL on error)
+    uint8_t flags; // DEV_FLAG_* bits
+    device_ioctlv ioctlv; // optional batch hook: serve n consecutive entries for this device, returns number ok
 } device_t;
 
+// ioctl_r may run concurrently from several ISRs (and the CAN path):
+// no shared result buffer and no multi-step updates of shared driver state
+#define DEV_FLAG_REENTRANT 0x01
+// ioctl is short enough to run inline in the FDCAN ISR, otherwise CAN commands
+// are deferred to the main loop (see can_dev_process)
+#define DEV_FLAG_INLINE 0x02
+
+// handle to a local device, resolved once with dev_bind()
+typedef const device_t* dev_handle_t;
+
+// define a const device_t and place it in the flash device table (.devtab in the linker script)
+// the linker sorts the table by section name, so id must be a literal or a macro
+// expanding to 0x followed by 4 uppercase hex digits (e.g. 0x0021)
+// usage: DEV_STATIC(din_dev, DIN_DEVICE_ID) = { .id = DIN_DEVICE_ID, ... };
+#define DEV_STR_(x) #x
+#define DEV_STR(x) DEV_STR_(x)
+#define DEV_STATIC(name, id) const device_t name __attribute__((used, section(".devtab." DEV_STR(id))))
+
+// flash device table bounds, provided by the linker script
+extern const device_t __devtab_start[];
+extern const device_t __devtab_end[];
+
 // handle empty device cases
 extern const char dev_empty_dev_name[];
 data_field_t* dev_empty_dev_ioctl(__unused data_field_t* cmd);
+data_field_t* dev_empty_dev_ioctl_r(__unused data_field_t* cmd, data_field_t* res);
 extern const device_t dev_empty_dev;
 
 // handle test device - life led
 // input, output both 1 byte, write 0 or 1 to turn on or off led, returns new led state or 0xff if fail.
 extern const char dev_test_dev_name[];
 data_field_t* dev_test_dev_ioctl(data_field_t* cmd);
+data_field_t* dev_test_dev_ioctl_r(data_field_t* cmd, data_field_t* res);
+void dev_test_dev_set(uint8_t value);
 extern const device_t dev_test_dev;
 
+// handle vector device - dev_ioctlv over CAN
+// input: up to DEV_IOCTLV_MAX pairs of (device address, 1-byte command)
+// output: byte 0 is a bitmask of entries that succeeded, then the results
+// of the successful entries packed back to back; an entry whose whole result
+// no longer fits in the 7 bytes left has its bit clear
+extern const char dev_vector_dev_name[];
+data_field_t* dev_vector_dev_ioctl(data_field_t* cmd);
+data_field_t* dev_vector_dev_ioctl_r(data_field_t* cmd, data_field_t* res);
+extern const device_t dev_vector_dev;
+
 // initialize devtab
 // returns pointer to devtab
 device_t* dev_init_devtab();
 
-// register device in devtab
+// register a device at runtime (devices known at compile time use DEV_STATIC instead)
 // returns pointer to device placed in devtab
+// fails (NULL) if devtab is full, the id exists, or the 8-bit address is already taken
 device_t* dev_register(device_t dev);
 
 // get device corresponding to id
+// binary search over the flash table, then the dynamic devtab index
 // returns pointer to device, else NULL
-device_t* dev_get_device(uint16_t id);
+const device_t* dev_get_device(uint16_t id);
 
 // call ioctl corresponding to id
 // returns ioctl result, else NULL
 data_field_t* dev_ioctl(uint16_t id, data_field_t* cmd);
 
+// call ioctl corresponding to id, result written to the caller's res buffer
+// safe to call from any ISR for devices flagged DEV_FLAG_REENTRANT
+// returns res, else NULL
+data_field_t* dev_ioctl_r(uint16_t id, data_field_t* cmd, data_field_t* res);
+
+// caller-buffered ioctl on an already resolved device
+// devices without ioctl_r fall back to ioctl and a copy (not reentrant)
+// returns res, else NULL
+data_field_t* dev_call_r(dev_handle_t dev, data_field_t* cmd, data_field_t* res);
+
+// vectored ioctl: run n (device id, command) entries in one dispatch
+// consecutive entries for the same device are handed to its ioctlv hook in one call
+// remote (CAN) devices are not forwarded and fail
+// returns number of entries that succeeded (see iov[i].ok)
+size_t dev_ioctlv(dev_iovec_t* iov, size_t n);
+
+// resolve a local device once (at init) for hot-path calls
+// returns handle, else NULL (remote devices cannot be bound)
+dev_handle_t dev_bind(uint16_t id);
+
+// bound fast paths: no lookup, no data_field_t packing, straight into the driver
+// the handle must expose the entry point (check dev->set / dev->get after binding)
+static inline void dev_set(dev_handle_t dev, uint8_t value) { dev->set(value); }
+static inline uint32_t dev_get(dev_handle_t dev) { return dev->get(); }
+
 #endif // __INCLUDE_DEVICE_H
\ No newline at end of file
@@ -4,28 +4,105 @@
 #include "main.h"
 #include "stm32h5xx_hal.h"
 #include "device.h"
+#include "core.h"
 
 #define DIN_COUNT 4
 #define DIN_DEVICE_ID 0x0021
 
+#define DIN_DEFAULT_DEBOUNCE_US 2000
+
 typedef struct din {
     GPIO_TypeDef* port;
     uint16_t pin;
+    IRQn_Type irq; // EXTI line of the pin
 } din_t;
 
+// pins of one port gathered into the snapshot mask
+// bits = ((IDR & mask) >> rshift) << lshift
+typedef struct din_gather {
+    GPIO_TypeDef* port;
+    uint16_t mask;
+    uint8_t rshift;
+    uint8_t lshift;
+} din_gather_t;
+
+// all inputs from one read per port
+typedef struct din_snapshot {
+    uint32_t mask; // bit i is din i (bit 0 clones din 1, see dintab)
+    core_tick_t tick;
+} din_snapshot_t;
+
+// called on every debounced change, from interrupt context
+// level is the new input level, tick the core tick of the edge that caused it
+typedef void (*din_change_fn) (uint8_t i, uint8_t level, core_tick_t tick);
+
+typedef enum din_debounce_state {
+    DDS_STABLE = 0, // waiting for an edge
+    DDS_LOCKOUT = 1 // change reported, edges ignored until the debounce time passed
+} din_debounce_state_t;
+
+// input engine state of one din
+typedef struct din_channel {
+    uint8_t state; // din_debounce_state_t
+    uint8_t level; // debounced level
+    int task; // lockout timer, -1 if none
+    core_ticks_t debounce; // ticks, 0 reports every edge
+    core_tick_t last_edge; // tick of the last raw edge
+    core_tick_t last_change; // tick of the last debounced change
+    uint32_t edges; // raw edges, bounces included
+    uint32_t changes; // debounced changes
+    din_change_fn callback;
+} din_channel_t;
+
 // add one to dintab size because we aren't using dintab[0]
 // this is just for conventions on the littleECU v1
 extern const din_t dintab[DIN_COUNT+1];
 
-// initialize dintab 
+// initialize dintab, switches the inputs to edge interrupts
 void din_init();
 
+// set the change callback of din i, NULL to remove
+void din_set_callback(uint8_t i, din_change_fn callback);
+
+// set the debounce time of din i
+void din_set_debounce(uint8_t i, core_ticks_t debounce);
+
+// get input engine state of din i, else NULL
+const din_channel_t* din_get_channel(uint8_t i);
+
+// EXTI interrupt for din i, call from the EXTI line's IRQ handler
+void din_exti_irq_handler(uint8_t i);
+
 // get single input (default 0, invalid -1)
 uint8_t din_get(uint8_t i);
 
+// get all inputs as a bitmask (bit i is din i), fast path for bound handles
+uint32_t din_get_all();
+
+// get all inputs with the time they were read
+din_snapshot_t din_snapshot();
+
+// ioctl commands (second byte)
+typedef enum din_ioctl_cmd {
+    DINC_GET_EDGES = 0, // returns 4-byte raw edge count
+    DINC_GET_CHANGES = 1, // returns 4-byte debounced change count
+    DINC_GET_CHANGE_TICK = 2, // returns 8-byte tick of the last change
+    DINC_SET_DEBOUNCE = 3 // 2-byte debounce in us, returns 1 byte (0)
+} din_ioctl_cmd_t;
+
+#define DIN_SNAPSHOT 0xFF // din number for the snapshot command
+
 // 1 byte input: din number
 // 1 byte output: din value
+// 1 byte input: DIN_SNAPSHOT
+// 8 bytes output: 1-byte mask, low 7 bytes of the read tick (wraps after 228 years)
+// 2+ bytes input: din number, din_ioctl_cmd_t, (value)
+// n bytes output depending on command
 data_field_t* din_ioctl(data_field_t* cmd);
+data_field_t* din_ioctl_r(data_field_t* cmd, data_field_t* res);
+
+// batch hook: serves every entry from one read of all inputs
+size_t din_ioctlv(dev_iovec_t* iov, size_t n);
 
 extern const device_t din_dev;
 
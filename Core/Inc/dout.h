@@ -13,6 +13,13 @@ typedef struct dout {
     uint16_t pin;
 } dout_t;
 
+// douts of one port for masked writes
+// pins[m] is the port's pin mask for the dout nibble m (bit n is dout n+1)
+typedef struct dout_port {
+    GPIO_TypeDef* port;
+    uint16_t pins[1 << DOUT_COUNT];
+} dout_port_t;
+
 typedef struct dout_input {
     uint8_t i;
     uint8_t value;
@@ -28,9 +35,18 @@ void dout_init();
 // set single output (ignores invalid)
 void dout_set(uint8_t i, uint8_t v);
 
+// set the outputs selected by mask to values (bit i is dout i, bit 0 unused)
+// each port is written with one BSRR store, so its outputs switch together
+void dout_set_masked(uint32_t mask, uint32_t values);
+
+#define DOUT_MASKED 0xFF // dout number for the masked write command
+
 // 2 bytes input: dout number, dout value (dout_input_t)
 // 1 byte output: 0 if success, -1 if invalid
+// 3 bytes input: DOUT_MASKED, mask, values (bit i is dout i)
+// 1 byte output: 0
 data_field_t* dout_ioctl(data_field_t* cmd);
+data_field_t* dout_ioctl_r(data_field_t* cmd, data_field_t* res);
 
 extern const device_t dout_dev;
 
@@ -11,16 +11,10 @@
 #define HSD_50_ID 0x0013
 #define HSD_51_ID 0x0014
 #define HSD_5X_DIA_ID 0x0015
-
-typedef struct hsd_dia_state {
-    uint8_t latch : 1;
-    uint8_t dia_en : 1;
-    uint8_t sel1 : 1;
-    uint8_t sel2 : 1;
-} hsd_dia_state_t;
+#define HSD_BULK_ID 0x001B
 
 typedef struct hsd_config {
-    GPIO_TypeDef* latch_port; 
+    GPIO_TypeDef* latch_port;
     uint16_t latch_pin;
     GPIO_TypeDef* dia_en_port;
     uint16_t dia_en_pin;
@@ -32,7 +26,7 @@ typedef struct hsd_config {
     uint16_t en1_pin;
     GPIO_TypeDef* en2_port;
     uint16_t en2_pin;
-    // TODO: add analog config for SNS (not implemented yet)
+    uint32_t sns_channel; // ADC1 channel of the SNS pin
 } hsd_config_t;
 
 typedef enum hsd_dia_options {
@@ -41,18 +35,54 @@ typedef enum hsd_dia_options {
     HSDD_I_CH2 = 2,
     HSDD_TEMP = 3,
     HSDD_LATCH = 4,
+    HSDD_AUTO = 5, // the sense sequencer walks the mux
+    HSDD_GUARD = 0xFE, // overcurrent guard commands, see hsd_guard.h
     HSDD_READ = 0xFF
 } hsd_dia_options_t;
 
+// control signals, bit n of a state word
+typedef enum hsd_signal {
+    HSD_SIG_LATCH = 0,
+    HSD_SIG_DIA_EN = 1,
+    HSD_SIG_SEL1 = 2,
+    HSD_SIG_SEL2 = 3,
+    HSD_SIG_EN1 = 4, // enable n is HSD_SIG_EN1 + n
+    HSD_SIG_EN2 = 5,
+    HSD_SIG_COUNT = 6
+} hsd_signal_t;
+
+#define HSD_DIA_MASK ((1 << HSD_SIG_LATCH) | (1 << HSD_SIG_DIA_EN) | (1 << HSD_SIG_SEL1) | (1 << HSD_SIG_SEL2))
+
+// pin layout precomputed from hsd_config_t by hsd_init
+typedef struct hsd_layout {
+    GPIO_TypeDef* ports[HSD_SIG_COUNT]; // distinct ports used by the chip
+    uint8_t port_count;
+    uint8_t sig_port[HSD_SIG_COUNT]; // index into ports for each signal
+    uint16_t sig_pin[HSD_SIG_COUNT];
+} hsd_layout_t;
+
+// one driver chip
 typedef struct hsd {
     hsd_config_t config;
-    hsd_dia_state_t dia_state;
-    uint8_t en1;
-    uint8_t en2;
+    uint8_t state; // wanted state word
+    uint8_t shadow; // state word last written to the pins
+    uint8_t dia; // selected hsd_dia_options_t, HSDD_AUTO when the sequencer owns the mux
+    uint8_t block; // enable bits held off by the overcurrent guard, state keeps the request
+    hsd_layout_t layout;
 } hsd_t;
 
-extern hsd_t hsd_12x;
-extern hsd_t hsd_5x;
+// one enable output, bit n of a bulk channel mask is hsd_channels[n]
+typedef struct hsd_channel {
+    uint16_t id;
+    uint8_t chip; // index into hsdtab
+    uint8_t en; // enable of the chip, 0 or 1
+} hsd_channel_t;
+
+// the board's drivers, add chips to hsdtab and channels to HSD_CHANNEL_LIST in hsd.c
+extern hsd_t hsdtab[];
+extern const size_t hsd_chip_count;
+extern const hsd_channel_t hsd_channels[];
+extern const size_t hsd_channel_count;
 
 extern const device_t hsd_120_dev;
 extern const device_t hsd_121_dev;
@@ -62,28 +92,71 @@ extern const device_t hsd_50_dev;
 extern const device_t hsd_51_dev;
 extern const device_t hsd_5x_dia_dev;
 
+extern const device_t hsd_bulk_dev;
+
 // init
 void hsd_init();
 
 // update state for a given hsd, given current configuration
+// only pins that differ from the shadow are written, one BSRR store per port
 void hsd_update_state(hsd_t* hsd);
 
-// input: 1 byte (1 or 0), output: 1 byte (0)
-data_field_t* hsd_120_ioctl(data_field_t* cmd);
-// input: 1 byte (1 or 0), output: 1 byte (0)
-data_field_t* hsd_121_ioctl(data_field_t* cmd);
-// input: 4 bytes (hsd_dia_options_t), output: 4 bytes (0 or 0xFF or ADC reading as a float)
-data_field_t* hsd_12x_dia_ioctl(data_field_t* cmd);
+// set one channel (index into hsd_channels)
+void hsd_set_channel(uint8_t ch, uint8_t value);
 
+// set the channels selected by mask to values (bit n is hsd_channels[n])
+// all changed pins of a port are written with one BSRR store, across chips
+void hsd_set_channels(uint32_t mask, uint32_t values);
+
+// hold a channel off regardless of its state (or release it), used by the overcurrent guard
+void hsd_block_channel(uint8_t ch, uint8_t blocked);
+
+// called by hsd_block_channel, for the owner of an enable pin that was handed to a timer
+// (the BSRR cut has no effect on a pin in alternate function mode)
+typedef void (*hsd_block_hook) (uint16_t id, uint8_t blocked);
+
+// set the block hook, NULL removes it
+void hsd_set_block_hook(hsd_block_hook hook);
+
+// select the diagnostic option of a chip, HSDD_AUTO hands the mux to the sense sequencer
+// returns 0 on success, 0xFF for an unknown option
+uint8_t hsd_set_dia(uint8_t chip, hsd_dia_options_t option);
+
+// switch the diagnostic mux of a chip without changing its selection, used by the sequencer
+// returns 0 on success, 0xFF for an unknown option
+uint8_t hsd_set_mux(uint8_t chip, hsd_dia_options_t option);
+
+// enable channel device, generated per channel in hsd.c
 // input: 1 byte (1 or 0), output: 1 byte (0)
-data_field_t* hsd_50_ioctl(data_field_t* cmd);
-// input: 1 byte (1 or 0), output: 1 byte (0)
-data_field_t* hsd_51_ioctl(data_field_t* cmd);
-// input: 4 bytes (hsd_dia_options_t), output: 4 bytes (0 or 0xFF or ADC reading as a float)
-data_field_t* hsd_5x_dia_ioctl(data_field_t* cmd);
+#define HSD_CHANNEL_DECLARE(dev) \
+    data_field_t* hsd_##dev##_ioctl(data_field_t* cmd); \
+    data_field_t* hsd_##dev##_ioctl_r(data_field_t* cmd, data_field_t* res); \
+    void hsd_##dev##_set(uint8_t value);
+
+// diagnostics device, generated per chip in hsd.c
+// input: 1 byte (hsd_dia_options_t), output: 1 byte (0 or 0xFF)
+// HSDD_READ: input 1 byte, optional 1 byte option to read (default the selected one,
+// HSDD_AUTO reads the newest sample of the sequencer), output: 5 bytes (cached SNS
+// voltage as a float, option it was taken in) or 1 byte (0xFF, no sample)
+// HSDD_GUARD: see hsd_guard_ioctl_r
+#define HSD_DIA_DECLARE(dev) \
+    data_field_t* hsd_##dev##_dia_ioctl(data_field_t* cmd); \
+    data_field_t* hsd_##dev##_dia_ioctl_r(data_field_t* cmd, data_field_t* res);
+
+HSD_CHANNEL_DECLARE(120)
+HSD_CHANNEL_DECLARE(121)
+HSD_DIA_DECLARE(12x)
+HSD_CHANNEL_DECLARE(50)
+HSD_CHANNEL_DECLARE(51)
+HSD_DIA_DECLARE(5x)
+
+// bulk ioctl
+// input: 4-byte channel mask, 4-byte values (bit n is hsd_channels[n]), output: 1 byte (0)
+data_field_t* hsd_bulk_ioctl(data_field_t* cmd);
+data_field_t* hsd_bulk_ioctl_r(data_field_t* cmd, data_field_t* res);
 
 // three ioctls per hsd
 // one for each enable output (en1, en2)
 // one for diagnostics, either return or change configuration using hsd_sns_mux
 
-#endif // __INCLUDE_HSD_H
\ No newline at end of file
+#endif // __INCLUDE_HSD_H
@@ -0,0 +1,78 @@
+#ifndef __INCLUDE_HSD_GUARD_H
+#define __INCLUDE_HSD_GUARD_H
+
+#include "main.h"
+#include "stm32h5xx_hal.h"
+#include "device.h"
+#include "core.h"
+#include "hsd.h"
+
+// a channel is watched while the mux of its chip has settled on its current, and
+// ADC1 converts continuously between sense steps, so the watchdog compares every
+// conversion and an overcurrent is cut within one ADC scan (tens of us)
+// in HSDD_AUTO the mux stays on the current of the one enabled channel of a chip,
+// leaving it for two steps every HSD_SENSE_TEMP_STEPS; with both channels on the
+// SNS pin is shared and each current is shown in turn, an overcurrent is then cut
+// within (HSD_SENSE_HOLD_STEPS + 2) * HSD_SENSE_SETTLE_US (1.5 ms)
+#define HSD_GUARD_CHIPS 2 // ADC1 watchdogs 2 and 3, one per chip
+#define HSD_GUARD_MAX_CHANNELS 8
+#define HSD_GUARD_DEFAULT_THRESHOLD 3900 // ADC counts, SNS near its fault level
+#define HSD_GUARD_RETRY_MS 10 // first retry, doubled on every trip in a row
+#define HSD_GUARD_RETRY_MAX_MS 1000
+#define HSD_GUARD_MAX_RETRIES 5 // trips in a row before the channel latches off
+#define HSD_GUARD_HEALTHY_MS 1000 // time on without a trip that clears the retry count
+
+typedef enum hsd_guard_state {
+    HGS_OK = 0, // output follows its state, watched whenever the mux shows its current
+    HGS_BACKOFF = 1, // tripped, held off until the retry time
+    HGS_LATCHED = 2 // tripped too often, held off until cleared
+} hsd_guard_state_t;
+
+typedef struct hsd_guard_channel {
+    uint16_t threshold; // ADC counts of the SNS current reading, 0 disables the guard
+    uint8_t state; // hsd_guard_state_t
+    uint8_t retries; // trips in a row
+    core_tick_t retry_at; // end of the backoff
+    core_tick_t since; // last release
+    uint32_t trips;
+    uint32_t latches;
+    core_ticks_t latency; // worst trip from the start of its sense step to the cut
+} hsd_guard_channel_t;
+
+// set up the watchdog interrupt, called by hsd_sense_init once ADC1 is configured
+void hsd_guard_init(ADC_HandleTypeDef* adc);
+
+// point the watchdogs at the settled chips (bit n is hsdtab[n]) whose mux shows a
+// guarded current, ADC1 must be idle
+void hsd_guard_arm(uint32_t settled);
+
+// 1 if a watchdog is armed, the sense sequencer converts continuously between scans
+uint8_t hsd_guard_watching();
+
+// stop acting on the watchdog of a chip until the next hsd_guard_arm, called on every
+// mux change (a changed mux would compare another reading against the threshold)
+void hsd_guard_disarm(uint8_t chip);
+
+// release channels whose backoff ran out, called on every sense step
+void hsd_guard_poll(core_tick_t now);
+
+// ADC1 interrupt, cuts a tripped channel with one BSRR store
+void hsd_guard_irq_handler();
+
+// guard of a channel (index into hsd_channels), else NULL
+const hsd_guard_channel_t* hsd_guard_get(uint8_t ch);
+
+// ioctl commands, sent to a diagnostics device as [HSDD_GUARD, cmd, enable (0 or 1), value]
+typedef enum hsd_guard_ioctl_cmd {
+    HGC_GET_STATE = 0, // returns 1-byte hsd_guard_state_t, 1-byte retries in a row
+    HGC_GET_TRIPS = 1, // returns 4-byte trip count
+    HGC_GET_LATCHES = 2, // returns 4-byte latch count
+    HGC_GET_LATENCY = 3, // returns 4-byte worst trip latency in core ticks
+    HGC_SET_THRESHOLD = 4, // 2-byte threshold in ADC counts (0 off), returns 1 byte (0)
+    HGC_CLEAR = 5 // releases the channel and clears its retries, returns 1 byte (0)
+} hsd_guard_ioctl_cmd_t;
+
+// guard ioctl of a chip, called by its diagnostics device
+data_field_t* hsd_guard_ioctl_r(uint8_t chip, data_field_t* cmd, data_field_t* res);
+
+#endif // __INCLUDE_HSD_GUARD_H
@@ -0,0 +1,55 @@
+#ifndef __INCLUDE_HSD_SENSE_H
+#define __INCLUDE_HSD_SENSE_H
+
+#include "main.h"
+#include "stm32h5xx_hal.h"
+#include "core.h"
+#include "sched.h"
+#include "hsd.h"
+
+#define HSD_SENSE_MAX_CHIPS 4 // one ADC rank per chip
+#define HSD_SENSE_SETTLE_US 500 // mux settle time before a conversion, also the step period
+#define HSD_SENSE_TEMP_STEPS 200 // HSDD_AUTO reads the temperature once in this many steps (100 ms)
+#define HSD_SENSE_HOLD_STEPS 1 // HSDD_AUTO with both channels on: settled scans of each current in turn
+#define HSD_SENSE_OPTIONS (HSDD_TEMP + 1) // cache slots, indexed by hsd_dia_options_t
+#define HSD_SENSE_VREF_MV 3300
+#define HSD_SENSE_FULL_SCALE 4095 // 12-bit, oversampled and shifted back
+
+// latest conversion of one mux option
+typedef struct hsd_sense_sample {
+    uint16_t raw; // ADC counts
+    core_tick_t tick; // core tick of the conversion, 0 if none yet
+} hsd_sense_sample_t;
+
+// sequencer counters
+typedef struct hsd_sense_stats {
+    uint32_t conversions; // completed scans
+    uint32_t skipped; // steps skipped, previous scan still running
+    uint32_t discarded; // samples dropped, the mux was changed while settling
+    uint32_t errors; // scans that failed to start
+} hsd_sense_stats_t;
+
+// take over ADC1 with DMA, one scan rank per chip, and start the sequencer
+// chips in HSDD_AUTO show the currents of their enabled channels and now and then the
+// temperature, the others are sampled in their selected option; the overcurrent guard
+// is set up on the same ADC, which converts continuously between scans while it watches
+void hsd_sense_init(ADC_HandleTypeDef* adc);
+
+// latest sample of a chip for an option, returns 0 on success, 1 if there is none
+uint8_t hsd_sense_get(uint8_t chip, hsd_dia_options_t option, hsd_sense_sample_t* sample);
+
+// mux option of a chip during the running or next scan
+hsd_dia_options_t hsd_sense_option(uint8_t chip);
+
+// core tick of the last scan start
+core_tick_t hsd_sense_scan_start();
+
+// SNS pin voltage of a sample
+float hsd_sense_to_volts(uint16_t raw);
+
+const hsd_sense_stats_t* hsd_sense_get_stats();
+
+// DMA channel of the scans, serviced by GPDMA1_Channel0_IRQHandler
+extern DMA_HandleTypeDef hsd_sense_dma;
+
+#endif // __INCLUDE_HSD_SENSE_H
@@ -0,0 +1,91 @@
+#ifndef __INCLUDE_MONITOR_H
+#define __INCLUDE_MONITOR_H
+
+#include "main.h"
+#include "stm32h5xx_hal.h"
+#include "device.h"
+#include "core.h"
+#include "sched.h"
+
+#define MONITOR_DEVICE_ID 0x0019
+
+#define MONITOR_EMA_SHIFT 4 // running average weight 1/16
+
+// monitored interrupts and scheduler tasks
+typedef enum monitor_slot {
+    MON_SCHED_ISR = 0, // scheduler compare interrupt, tasks included
+    MON_TDC_ISR = 1, // hall sensor
+    MON_TIMER_ISR = 2, // timing timer
+    MON_CAN0_ISR = 3, // FDCAN interrupt 0
+    MON_CAN1_ISR = 4, // FDCAN interrupt 1
+    MON_DIN_ISR = 5, // DIN edges, all lines
+    MON_SENSE_ISR = 6, // HSD sense DMA
+    MON_GUARD_ISR = 7, // HSD overcurrent watchdog
+    MON_TASK_0 = 8, // scheduler task n is MON_TASK_0 + n
+    MON_SLOTS = MON_TASK_0 + SCHED_MAX_TASKS
+} monitor_slot_t;
+
+typedef struct monitor_stats {
+    uint32_t count;
+    uint32_t wcet; // cycles
+    uint32_t avg_q; // cycles << MONITOR_EMA_SHIFT, exponential moving average
+    uint32_t budget; // cycles, 0 for no budget
+    uint32_t overruns; // runs longer than budget
+    uint32_t stacked; // exits with another interrupt already pending
+} monitor_stats_t;
+
+// instrumentation can be compiled out with a global C define
+#ifndef MONITOR_ENABLED
+#define MONITOR_ENABLED 1
+#endif
+
+#if MONITOR_ENABLED
+#define MONITOR_BEGIN() uint32_t monitor_start = CORE_CYCLES()
+#define MONITOR_END(slot) monitor_record((slot), CORE_CYCLES() - monitor_start)
+#define MONITOR_ISR_END(slot) monitor_record_isr((slot), CORE_CYCLES() - monitor_start)
+#else
+#define MONITOR_BEGIN()
+#define MONITOR_END(slot)
+#define MONITOR_ISR_END(slot)
+#endif
+
+// clear all stats, budgets are kept
+void monitor_init();
+
+// set the cycle budget of a slot, runs above it count as overruns
+void monitor_set_budget(monitor_slot_t slot, uint32_t cycles);
+
+// record one run
+void monitor_record(monitor_slot_t slot, uint32_t cycles);
+
+// record one interrupt, also counts interrupts left pending behind it
+void monitor_record_isr(monitor_slot_t slot, uint32_t cycles);
+
+// record time spent sleeping in the main loop
+void monitor_record_idle(uint32_t cycles);
+
+// close the load window, called periodically
+void monitor_update_load();
+
+// get stats of a slot, else NULL
+const monitor_stats_t* monitor_get(monitor_slot_t slot);
+
+// ioctl commands
+typedef enum monitor_ioctl_cmd {
+    MNC_GET_COUNT = 0, // returns 4-byte run count
+    MNC_GET_WCET = 1, // returns 4-byte worst case cycles
+    MNC_GET_AVG = 2, // returns 4-byte average cycles
+    MNC_GET_OVERRUNS = 3, // returns 4-byte overrun count
+    MNC_GET_STACKED = 4, // returns 4-byte stacked interrupt count
+    MNC_GET_LOAD = 5, // returns 2-byte CPU load of the last window, 2-byte peak, in 1/1000
+    MNC_RESET = 6 // clears all stats, returns 1 byte (0)
+} monitor_ioctl_cmd_t;
+
+// monitor ioctl
+// 2 bytes input - monitor_ioctl_cmd_t, monitor_slot_t (ignored for load and reset)
+// n bytes output depending on command
+data_field_t* monitor_ioctl(data_field_t* cmd);
+data_field_t* monitor_ioctl_r(data_field_t* cmd, data_field_t* res);
+extern const device_t monitor_dev;
+
+#endif // __INCLUDE_MONITOR_H
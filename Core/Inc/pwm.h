@@ -0,0 +1,77 @@
+#ifndef __INCLUDE_PWM_H
+#define __INCLUDE_PWM_H
+
+#include "main.h"
+#include "stm32h5xx_hal.h"
+#include "device.h"
+#include "core.h"
+#include "sched.h"
+
+#define PWM_DEVICE_ID 0x001A
+
+#define PWM_MAX_CHANNELS 4
+#define PWM_DUTY_FULL 10000 // duty is in 1/100 %
+
+typedef enum pwm_backend {
+    PWM_BACKEND_SCHED = 0, // scheduler task toggles the target device on each edge
+    PWM_BACKEND_TIMER = 1 // timer output-compare drives the pin directly
+} pwm_backend_t;
+
+typedef struct pwm_channel {
+    uint8_t backend; // pwm_backend_t
+    uint8_t enabled;
+    uint8_t level; // current output level (scheduler backend)
+    uint32_t freq_mhz; // frequency in 1/1000 Hz
+    uint16_t duty; // 0..PWM_DUTY_FULL
+    core_ticks_t on_ticks;
+    core_ticks_t off_ticks;
+
+    // scheduler backend
+    dev_handle_t out;
+    int task;
+
+    // timer backend
+    TIM_HandleTypeDef* tim;
+    uint32_t tim_channel;
+    uint32_t tim_hz; // timer counting frequency
+} pwm_channel_t;
+
+// initialize pwm channels
+void pwm_init();
+
+// add a channel driving a device through its set fast path (scheduler backend)
+// returns channel, else -1
+int pwm_register(uint16_t id);
+
+// add a channel on a timer output-compare channel, the pin must be configured
+// for the timer's alternate function and the timer must count at tim_hz
+// returns channel, else -1
+int pwm_register_timer(TIM_HandleTypeDef* tim, uint32_t tim_channel, uint32_t tim_hz);
+
+// set frequency (1/1000 Hz) and duty (1/100 %), starts the channel
+// returns 0 on success, 1 on bad parameters
+uint8_t pwm_set(int channel, uint32_t freq_mhz, uint16_t duty);
+
+// stop the channel and drive its output low
+void pwm_stop(int channel);
+
+// get channel, else NULL
+const pwm_channel_t* pwm_get(int channel);
+
+// ioctl commands
+typedef enum pwm_ioctl_cmd {
+    PWC_SET_FREQ = 0, // 4-byte frequency in 1/1000 Hz, returns 1 byte (0 ok, 1 error)
+    PWC_SET_DUTY = 1, // 2-byte duty in 1/100 %, returns 1 byte (0 ok, 1 error)
+    PWC_GET_FREQ = 2, // returns 4-byte frequency in 1/1000 Hz
+    PWC_GET_DUTY = 3, // returns 2-byte duty in 1/100 %
+    PWC_STOP = 4 // returns 1 byte (0)
+} pwm_ioctl_cmd_t;
+
+// pwm ioctl
+// 2+ bytes input - pwm_ioctl_cmd_t, channel, (value, little endian)
+// n bytes output depending on command
+data_field_t* pwm_ioctl(data_field_t* cmd);
+data_field_t* pwm_ioctl_r(data_field_t* cmd, data_field_t* res);
+extern const device_t pwm_dev;
+
+#endif // __INCLUDE_PWM_H
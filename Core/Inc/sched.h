@@ -0,0 +1,72 @@
+#ifndef __INCLUDE_SCHED_H
+#define __INCLUDE_SCHED_H
+
+#include "main.h"
+#include "stm32h5xx_hal.h"
+#include "device.h"
+#include "core.h"
+
+#define SCHED_DEVICE_ID 0x0018
+
+#define SCHED_MAX_TASKS 8
+
+// scheduler time is the free-running 100ns tick timer (TIM2)
+#define SCHED_TICKS_PER_US CORE_TICKS_PER_US
+#define SCHED_US(us) CORE_US_TO_TICKS(us)
+#define SCHED_MS(ms) CORE_MS_TO_TICKS(ms)
+
+// ticks per interrupt of the retired 10us timer, for comparison
+#define SCHED_LEGACY_TICK SCHED_US(10)
+
+typedef void (*sched_fn) (void);
+
+typedef struct sched_task {
+    const char* name;
+    sched_fn fn; // NULL if slot unused
+    uint32_t period; // ticks, 0 for a one-shot task
+    uint32_t due; // absolute tick of next run (wraps, compared by distance)
+    uint8_t priority; // lower runs first when several tasks are due
+    uint32_t runs;
+    uint32_t overruns; // periods skipped because the task ran late
+} sched_task_t;
+
+// start the scheduler on the free-running timer, uses compare channel 1
+void sched_init(TIM_HandleTypeDef* tim);
+
+// add a task, first run is phase ticks from now
+// returns task id, else -1 if the table is full
+int sched_add(const char* name, sched_fn fn, uint32_t period, uint32_t phase, uint8_t priority);
+
+// remove a task
+void sched_remove(int task);
+
+// change the period of a task, applied when its next run is computed
+// (a task may call this on itself to vary its own period)
+void sched_set_period(int task, uint32_t period);
+
+// move the next run of a task to delay ticks from now
+void sched_set_next(int task, uint32_t delay);
+
+// get task, else NULL if not in use
+const sched_task_t* sched_get_task(int task);
+
+// compare interrupt, call from TIM2_IRQHandler before the HAL handler
+void sched_irq_handler();
+
+// ioctl commands
+typedef enum sched_ioctl_cmd {
+    SCC_GET_WAKEUPS = 0, // returns 4-byte scheduler interrupts
+    SCC_GET_LEGACY_TICKS = 1, // returns 4-byte interrupts the 10us timer would have taken
+    SCC_GET_OVERHEAD = 2, // returns 4-byte mean cycles per wakeup spent outside tasks
+    SCC_GET_SAVED = 3, // returns 4-byte estimated CPU saved vs the 10us timer, in 1/1000
+    SCC_RESET = 4 // clears the counters, returns 1 byte (0)
+} sched_ioctl_cmd_t;
+
+// scheduler ioctl
+// 1 byte input - sched_ioctl_cmd_t
+// n bytes output depending on command
+data_field_t* sched_ioctl(data_field_t* cmd);
+data_field_t* sched_ioctl_r(data_field_t* cmd, data_field_t* res);
+extern const device_t sched_dev;
+
+#endif // __INCLUDE_SCHED_H
@@ -62,6 +62,12 @@ void TIM2_IRQHandler(void);
 void TIM6_IRQHandler(void);
 void TIM7_IRQHandler(void);
 /* USER CODE BEGIN EFP */
+void EXTI0_IRQHandler(void);
+void EXTI1_IRQHandler(void);
+void EXTI14_IRQHandler(void);
+void EXTI15_IRQHandler(void);
+void GPDMA1_Channel0_IRQHandler(void);
+void ADC1_IRQHandler(void);
 
 /* USER CODE END EFP */
 
@@ -6,6 +6,8 @@
 #include "device.h"
 #include "core.h"
 #include "hsd.h"
+#include "timing_queue.h"
+#include "timing_compare.h"
 
 #define US_PER_S 1000000
 #define S_PER_M 60
@@ -14,9 +16,27 @@
 #define TIMING_VALID_RANGE_MAX_US 120000 // 500rpm - cannot be more than 65536 * 2
 
 #define NUM_TIMING_EVENTS 4
+#define TIMING_EVENT_SPARK 2 // event whose angle follows the advance map
+
+// constant dwell mode: the output is the coil, on for the dwell and off at the spark angle
+#define TIMING_EVENT_COIL_ON 0 // HOLD, reported for the coil-on edge
+#define TIMING_EVENT_COIL_OFF 1 // WAIT, reported for the spark edge
+#define TIMING_DWELL_SPARKS 2 // this rotation's spark and the next one if its coil-on comes before TDC
+#define TIMING_DWELL_MAX_DUTY (TIMING_ANGLE_ONE * 3 / 4) // Q16 share of the period, leaves the coil off time
+
+// angles are Q16 fractions of a rotation, 1 << 16 is a full rotation
+#define TIMING_ANGLE_ONE (1u << 16)
+#define TIMING_DEG(deg) ((uint32_t) ((deg) * 65536.0 / 360 + 0.5)) // constants only, folds at compile time
+#define TIMING_RPM_US (US_PER_S * S_PER_M) // rpm = TIMING_RPM_US / period in us
 
 #define TIMING_DEV_ID 0x0016
 
+// drive HSD50_EN1 (PB3, TIM2_CH2) from the tick timer compare as a second timing channel
+// the pin leaves HSD_50, and so the DIN3 follower, while this is enabled
+#ifndef TIMING_HSD50_COMPARE
+#define TIMING_HSD50_COMPARE 0
+#endif
+
 typedef enum timing_state {
     TS_INVALID = 0,
     TS_HOLD = 1,
@@ -24,44 +44,72 @@ typedef enum timing_state {
     TS_SPARK = 3
 } timing_state_t;
 
+// one state change of the rotation, the last entry only ends the table
 typedef struct timing_event {
     timing_state_t state;
-    uint8_t halt_timer; // if 1, the timer will not start again once this event is transitioned into
-    float time_fraction; // value less than 1 (where 1 is full rotation)
-    uint64_t end_us; // autoupdated - at some point refactor so this is a pointer to a struct containing end times
-    uint64_t real_us;
+    uint32_t angle; // start of the state, Q16 fraction of a rotation (TIMING_ANGLE_ONE is full)
+    core_ticks_t ticks; // since TDC for an offset of 0, autoupdated
+    core_ticks_t real_ticks; // since TDC, measured on channel 0
 } timing_event_t;
 
+// one output running the event table, shifted by its offset (e.g. a cylinder)
+// edges go through the event queue to the device, or with tim_channel set straight
+// from a tick timer compare to the pin
+typedef struct timing_channel {
+    uint16_t id; // device with a set fast path
+    uint32_t offset; // Q16 fraction of a rotation added to every event
+    dev_handle_t out; // bound in timing_init
+
+    // output-compare mode, the pin must have the timer channel as alternate function af
+    uint32_t tim_channel; // TIM_CHANNEL_2..4, 0 for the event queue
+    GPIO_TypeDef* port;
+    uint16_t pin;
+    uint32_t af;
+    int compare; // timing_compare output, -1 for the event queue
+
+    // constant dwell mode, sparks of this rotation kept to reschedule on a dwell change
+    core_tick_t spark[TIMING_DWELL_SPARKS];
+    uint8_t sparks;
+
+    // edge error against the due tick in core ticks, event queue mode
+    // signed, the queue fires edges up to half a count early
+    int32_t late_error; // latest edge, 0 until one is late
+    int32_t early_error; // earliest edge, 0 until one is early
+    int32_t last_error;
+} timing_channel_t;
+
 // callback for top dead center
 void timing_tdc_callback();
 
-// init timing system
-void timing_init(TIM_HandleTypeDef* tim);
+// init timing system, tim is the one-shot of the event queue, tick_tim carries the compare outputs
+// returns 0 on success, 1 if a channel output could not be bound or registered
+uint8_t timing_init(TIM_HandleTypeDef* tim, TIM_HandleTypeDef* tick_tim);
 
-// configure timer for n * 10us
-void timing_timer_setup(uint32_t us);
-
-// start timer
-void timing_timer_begin();
-
-// timer interrupt
-void timing_timer_callback();
-
-// configure state
+// set every channel to the level of a state, does not touch the queue
 void timing_set_state(timing_state_t state);
 
+// constant dwell in us, 0 runs the event table angles
+// a new dwell moves the pending coil-on edges of this rotation, a mode change waits for TDC
+void timing_set_dwell(uint16_t dwell_us);
+
 // ioctl commands
 typedef enum timing_ioctl_cmd {
     TIC_GET_RPM = 0, // returns 4-byte RPM 
     TIC_GET_TICK = 1, // returns 8-byte tick counter
     TIC_GET_PERIOD = 2, // returns 4-byte period in us
-    TIC_GET_STATE = 3 // returns 4-byte state enum (timing_state_t) 
+    TIC_GET_STATE = 3, // returns 4-byte state enum (timing_state_t) of channel 0
+    TIC_GET_LATE = 4, // returns 4-byte worst event lateness in core ticks
+    TIC_GET_DROPPED = 5, // returns 4-byte count of events the queue had no room for
+    TIC_GET_EDGE_ERROR = 6, // 1-byte channel, returns 4-byte latest and 4-byte earliest edge error, signed core ticks
+    TIC_SET_DWELL = 7, // 2-byte dwell in us (0 for the event table angles), returns 1 byte (0)
+    TIC_GET_DWELL = 8 // returns 2-byte target and 2-byte applied dwell in us, 4-byte count of clamped rotations
 } timing_ioctl_cmd_t;
 
 // timing ioctl
-// 1 byte input - timing_ioctl_cmd_t
+// 1+ bytes input - timing_ioctl_cmd_t (and the channel for TIC_GET_EDGE_ERROR, the dwell for TIC_SET_DWELL)
 // n bytes output depending on command
 data_field_t* timing_ioctl(data_field_t* cmd);
+data_field_t* timing_ioctl_r(data_field_t* cmd, data_field_t* res);
 extern const device_t timing_dev;
 
 #endif // __INCLUDE_TIMING_H
\ No newline at end of file
@@ -0,0 +1,65 @@
+#ifndef __INCLUDE_TIMING_COMPARE_H
+#define __INCLUDE_TIMING_COMPARE_H
+
+#include "main.h"
+#include "stm32h5xx_hal.h"
+#include "core.h"
+
+#define TIMING_COMPARE_MAX_OUTPUTS 3 // TIM2 channels 2 to 4, channel 1 is the scheduler
+#define TIMING_COMPARE_EDGES 4 // pending edges per output, one rotation
+
+typedef struct timing_compare_edge {
+    core_tick_t due;
+    uint8_t level;
+    uint8_t index; // timing event, for the hook
+} timing_compare_edge_t;
+
+// one pin driven by an output-compare channel of the tick timer
+// the hardware sets the pin on the compare match, the interrupt only loads the next edge
+typedef struct timing_compare {
+    TIM_HandleTypeDef* tim;
+    uint32_t channel; // TIM_CHANNEL_2..4
+    timing_compare_edge_t edges[TIMING_COMPARE_EDGES]; // sorted by due, edges[0] is armed
+    uint8_t count;
+    uint8_t tag; // owner data, passed back to the hook
+    uint8_t blocked; // held low, edges are armed in forced inactive mode
+
+    // edge error: only edges forced late in software carry one, taken from the core tick,
+    // hardware edges change the pin on the match of their due tick and count 0
+    uint32_t edges_done;
+    uint32_t forced; // edges armed after their tick, forced late
+    core_ticks_t worst_error;
+    core_ticks_t last_error;
+} timing_compare_t;
+
+// called from the timer interrupt after an edge was output
+typedef void (*timing_compare_hook) (uint8_t tag, uint8_t index, core_tick_t due);
+
+// set the hook for all outputs
+void timing_compare_init(timing_compare_hook hook);
+
+// hand a pin to a compare channel of the tick timer, output starts low
+// af is the pin's alternate function for the timer channel
+// returns output, else -1
+int timing_compare_register(TIM_HandleTypeDef* tim, uint32_t channel, GPIO_TypeDef* port, uint16_t pin, uint32_t af, uint8_t tag);
+
+// add an edge, returns 0 on success, 1 if the output has no room
+uint8_t timing_compare_push(int oc, core_tick_t due, uint8_t level, uint8_t index);
+
+// drop pending edges, the pin keeps its level
+void timing_compare_flush(int oc);
+
+// set the pin now, pending edges are dropped
+void timing_compare_force(int oc, uint8_t level);
+
+// hold the pin low now and on every edge until released (overcurrent guard)
+// pending edges keep running, the pin follows them again from the first edge after a release
+void timing_compare_block(int oc, uint8_t blocked);
+
+// get output, else NULL
+const timing_compare_t* timing_compare_get(int oc);
+
+// tick timer interrupt, loads the next edge of every output that matched
+void timing_compare_irq_handler();
+
+#endif // __INCLUDE_TIMING_COMPARE_H
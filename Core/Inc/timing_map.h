@@ -0,0 +1,62 @@
+#ifndef __INCLUDE_TIMING_MAP_H
+#define __INCLUDE_TIMING_MAP_H
+
+#include "main.h"
+#include "stm32h5xx_hal.h"
+#include "device.h"
+
+#define TIMING_MAP_ID 0x001C
+
+#define TIMING_MAP_RPM_POINTS 8
+#define TIMING_MAP_LOAD_POINTS 8
+#define TIMING_MAP_MIN_ADVANCE 1 // a spark at TDC would wrap to the start of the rotation, next to HOLD
+#define TIMING_MAP_MAX_ADVANCE 0x7FFF // half a rotation, keeps the interpolation in 32 bits
+#define TIMING_MAP_LOAD_FULL 1000 // load is in 1/10 %
+
+// spark advance over rpm and load, angles are Q16 fractions of a rotation before TDC
+typedef struct timing_map_table {
+    uint16_t rpm[TIMING_MAP_RPM_POINTS]; // strictly ascending
+    uint16_t load[TIMING_MAP_LOAD_POINTS]; // strictly ascending
+    uint16_t advance[TIMING_MAP_RPM_POINTS][TIMING_MAP_LOAD_POINTS];
+    // 2^32 / axis step, filled on commit so a lookup never divides
+    uint32_t rpm_recip[TIMING_MAP_RPM_POINTS - 1];
+    uint32_t load_recip[TIMING_MAP_LOAD_POINTS - 1];
+} timing_map_table_t;
+
+// init both tables with the flat default advance
+void timing_map_init(uint16_t advance);
+
+// advance at rpm and the current load, bilinear, clamped at the table edges
+// bounded time: the cached bracket is checked first, else a log2(n) search per axis
+uint16_t timing_map_lookup(uint32_t rpm);
+
+// set the load used by lookups, 0..TIMING_MAP_LOAD_FULL
+void timing_map_set_load(uint16_t load);
+
+// validate the edited table and swap it in with one pointer store
+// returns 0 on success, 1 if an axis is not ascending or a cell is out of range
+uint8_t timing_map_commit();
+
+// active table, read once per rotation
+const timing_map_table_t* timing_map_get();
+
+// ioctl commands, edits go to a shadow table until TMC_COMMIT
+typedef enum timing_map_ioctl_cmd {
+    TMC_SET_RPM = 0, // 1-byte index, 2-byte rpm, returns 1 byte (0 ok, 1 error)
+    TMC_SET_LOAD_AXIS = 1, // 1-byte index, 2-byte load, returns 1 byte (0 ok, 1 error)
+    TMC_SET_CELL = 2, // 1-byte rpm index, 1-byte load index, 2-byte advance (not 0), returns 1 byte (0 ok, 1 error)
+    TMC_COMMIT = 3, // returns 1 byte (0 ok, 1 table rejected, the shadow keeps the edits)
+    TMC_SET_LOAD = 4, // 2-byte load, returns 1 byte (0)
+    TMC_GET_ADVANCE = 5, // returns 2-byte advance of the last lookup
+    TMC_GET_CELL = 6, // 1-byte rpm index, 1-byte load index, returns 2-byte advance of the active table
+    TMC_GET_MISSES = 7 // returns 4-byte lookups, 4-byte bracket searches
+} timing_map_ioctl_cmd_t;
+
+// timing map ioctl
+// n bytes output depending on command, NULL before timing_map_init
+// n bytes output depending on command
+data_field_t* timing_map_ioctl(data_field_t* cmd);
+data_field_t* timing_map_ioctl_r(data_field_t* cmd, data_field_t* res);
+extern const device_t timing_map_dev;
+
+#endif // __INCLUDE_TIMING_MAP_H
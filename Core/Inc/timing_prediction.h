@@ -6,11 +6,11 @@
 
 #define TP_NUM_POINTS 5 // Number of data points for quadratic fit
 #define TP_ELAPSED_US TIMING_VALID_RANGE_MAX_US
-#define TP_ELAPSED_TICKS 10 * TP_ELAPSED_US
+#define TP_ELAPSED_TICKS CORE_US_TO_TICKS(TP_ELAPSED_US)
 #define TP_INVALID_RESET_THRESHOLD 10
 
 typedef struct timing_data_point {
-    uint64_t timestamp;
+    core_tick_t timestamp;
     int32_t time_us;    // x (negative, with latest point being closest to zero)
     int32_t period_us;  // y
 } timing_data_point_t;
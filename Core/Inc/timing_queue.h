@@ -0,0 +1,50 @@
+#ifndef __INCLUDE_TIMING_QUEUE_H
+#define __INCLUDE_TIMING_QUEUE_H
+
+#include "main.h"
+#include "stm32h5xx_hal.h"
+#include "device.h"
+#include "core.h"
+
+#define TIMING_QUEUE_SIZE 32
+#define TIMING_QUEUE_TICKS_PER_COUNT 20 // 2us timer resolution
+#define TIMING_QUEUE_MAX_COUNTS 0xFFFF // 16-bit timer, longer waits wake early and re-arm
+
+// one output edge at an absolute core tick
+typedef struct timing_queue_event {
+    core_tick_t due;
+    dev_handle_t out; // device set fast path
+    uint8_t value;
+    uint8_t channel; // owner data, passed back to the hook
+    uint8_t index;
+} timing_queue_event_t;
+
+// called from the timer interrupt after an event's output was set
+typedef void (*timing_queue_hook) (const timing_queue_event_t* ev, core_tick_t now);
+
+typedef struct timing_queue_stats {
+    uint32_t fired;
+    uint32_t wakeups; // timer interrupts, several events may fire per wakeup
+    uint32_t dropped; // pushes refused, queue full
+    core_ticks_t late; // worst time between an event's due tick and its output
+} timing_queue_stats_t;
+
+// init queue on a one-shot timer counting at TIMING_QUEUE_TICKS_PER_COUNT
+void timing_queue_init(TIM_HandleTypeDef* tim, timing_queue_hook hook);
+
+// add an event, O(log n), returns 0 on success, 1 if the queue is full or out is NULL
+// an event already due is fired before this returns, from the caller's context
+uint8_t timing_queue_push(core_tick_t due, dev_handle_t out, uint8_t value, uint8_t channel, uint8_t index);
+
+// drop all pending events and stop the timer
+void timing_queue_flush();
+
+// number of pending events
+uint8_t timing_queue_pending();
+
+const timing_queue_stats_t* timing_queue_get_stats();
+
+// timer interrupt, fires every due event then re-arms for the next one
+void timing_queue_irq_handler();
+
+#endif // __INCLUDE_TIMING_QUEUE_H
@@ -1,10 +1,50 @@
 #include "can_device.h"
+#include "dev_stats.h"
 
 can_device_t can_devtab[LOCAL_CAN_DEVTAB_SIZE];
 size_t can_device_count;
 
 canlib2_fdcan_t* can;
 
+// lock-free work queue: any ISR (or the main loop) produces, the main loop consumes
+// producers reserve a slot by CAS on the head, then publish it with the ready flag
+can_dev_work_t can_dev_work_queue[CAN_DEV_WORK_QUEUE_SIZE];
+uint32_t can_dev_work_head; // next slot to reserve
+uint32_t can_dev_work_tail; // next slot to consume, main loop only
+uint32_t can_dev_work_dropped; // items lost because the queue was full
+
+// remote ioctls in flight, at most one per address, slots are claimed with interrupts masked
+can_dev_pending_t can_dev_pending[CAN_DEV_PENDING_SIZE];
+uint16_t can_dev_async_tag;
+uint32_t can_dev_sync_dropped; // can_dev_ioctl commands lost to a request in flight or a full pool
+
+// outgoing frames go here instead of the FDCAN when set
+can_dev_tx_fn can_dev_tx_hook;
+
+// add work to the queue
+// returns 0 if queued, 1 if the queue is full
+static int can_dev_enqueue(can_dev_work_kind_t kind, dev_handle_t dev, uint8_t priority, uint8_t address, uint8_t length, uint8_t* data) {
+    uint32_t head = __atomic_load_n(&can_dev_work_head, __ATOMIC_RELAXED);
+    do {
+        if (head - __atomic_load_n(&can_dev_work_tail, __ATOMIC_ACQUIRE) >= CAN_DEV_WORK_QUEUE_SIZE) {
+            ++can_dev_work_dropped;
+            return 1;
+        }
+    } while (!__atomic_compare_exchange_n(&can_dev_work_head, &head, head + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    can_dev_work_t* w = &can_dev_work_queue[head & (CAN_DEV_WORK_QUEUE_SIZE - 1)];
+    w->kind = kind;
+    w->dev = dev;
+    w->priority = priority;
+    w->address = address;
+    w->data.length = length > 8 ? 8 : length;
+    for (int i = 0; i < w->data.length; i++) {
+        w->data.data[i] = data[i];
+    }
+    __atomic_store_n(&w->ready, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
 // initialize can devtab
 // returns pointer to can devtab
 can_device_t* can_dev_init_devtab(FDCAN_HandleTypeDef* fdcan) {
@@ -46,7 +86,7 @@ can_device_t* can_dev_register(uint16_t id, uint8_t priority, uint8_t input_leng
     if (can_device_count >= LOCAL_CAN_DEVTAB_SIZE) return NULL;
     can_device_t dev = {.id = id, .name="CAN device", 
                         .priority=priority, .input_length=input_length,
-                        .prev_data={0, 0, 0, 0, 0, 0, 0, 0}, .callback=NULL};
+                        .prev_data={0, 0, 0, 0, 0, 0, 0, 0}, .callback=NULL, .unsolicited=0};
     can_devtab[can_device_count] = dev;
     ++can_device_count;
     return &can_devtab[can_device_count-1];
@@ -65,50 +105,231 @@ void can_dev_set_callback(uint16_t id, can_dev_rcv_fn callback) {
     can_device_t* dev = can_dev_get_device(id);
     if (dev == NULL) return;
     dev->callback = callback;
+    dev->unsolicited = callback != NULL;
+}
+
+// claim a pending slot for a command to dev and queue it
+// returns tag (never 0), else 0 if a request to dev is in flight, the pool is full or the queue is full
+static uint16_t can_dev_send_tracked(can_device_t* dev, data_field_t* cmd, uint32_t timeout_ms, can_dev_async_fn done, uint8_t discard) {
+    uint8_t address = dev->id & 0xFF;
+    can_dev_pending_t* p = NULL;
+
+    // the address check and the claim are one step, an ISR may send to the same device
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (int i = 0; i < CAN_DEV_PENDING_SIZE; i++) {
+        can_dev_pending_t* s = &can_dev_pending[i];
+        if (s->status == CDA_FREE) {
+            if (p == NULL) p = s;
+        } else if (s->status <= CDA_PENDING && s->address == address) {
+            __set_PRIMASK(primask);
+            return 0;
+        }
+    }
+    if (p == NULL) {
+        __set_PRIMASK(primask);
+        return 0;
+    }
+    p->status = CDA_ALLOC;
+    p->address = address;
+    __set_PRIMASK(primask);
+
+    uint16_t tag;
+    do {
+        tag = __atomic_add_fetch(&can_dev_async_tag, 1, __ATOMIC_RELAXED);
+    } while (tag == 0);
+    p->tag = tag;
+    p->deadline = HAL_GetTick() + timeout_ms;
+    p->done = done;
+    p->discard = discard;
+    p->res.length = 0;
+
+    // pending before the command is queued, so an early response finds it
+    __atomic_store_n(&p->status, CDA_PENDING, __ATOMIC_RELEASE);
+    if (can_dev_enqueue(CDW_TX, NULL, (dev->priority << 1) | 0x0, address, dev->input_length, cmd->data)) {
+        __atomic_store_n(&p->status, CDA_FREE, __ATOMIC_RELEASE);
+        return 0;
+    }
+    return tag;
 }
 
-// call ioctl corresponding to id
-// returns ioctl result, else NULL
+// queue a command to a remote device (sent from the main loop)
+// the response is not returned, but the command holds the device's request slot
+// until it is answered, so the response cannot complete a later async request
 void can_dev_ioctl(uint16_t id, data_field_t* cmd) {
     can_device_t* dev = can_dev_get_device(id);
     if (dev == NULL) return;
-    if (canlib2_send_data_p(can, (dev->priority << 1) | 0x0, dev->id & 0xFF, dev->input_length, cmd->data)) Error_Handler();
+    if (dev->unsolicited) {
+        can_dev_enqueue(CDW_TX, NULL, (dev->priority << 1) | 0x0, dev->id & 0xFF, dev->input_length, cmd->data);
+        return;
+    }
+    // an untracked command could answer a later request, so drop it instead
+    if (can_dev_send_tracked(dev, cmd, CAN_DEV_SYNC_TIMEOUT_MS, NULL, 1) == 0) ++can_dev_sync_dropped;
+}
+
+// send a command to a remote device and track its response
+// done is called from the main loop on completion or timeout, pass NULL to poll instead
+// returns tag (never 0), else 0 if the device is unknown, sends unsolicited frames,
+// already has a request in flight, or too many requests are in flight
+uint16_t can_dev_ioctl_async(uint16_t id, data_field_t* cmd, uint32_t timeout_ms, can_dev_async_fn done) {
+    can_device_t* dev = can_dev_get_device(id);
+    if (dev == NULL || dev->unsolicited) return 0;
+    return can_dev_send_tracked(dev, cmd, timeout_ms, done, 0);
+}
+
+// poll a request started without callback, copies the response into res on CDA_DONE
+// the request is released once a final status (CDA_DONE, CDA_TIMEOUT) is returned
+can_dev_async_status_t can_dev_async_poll(uint16_t tag, data_field_t* res) {
+    for (int i = 0; i < CAN_DEV_PENDING_SIZE; i++) {
+        can_dev_pending_t* p = &can_dev_pending[i];
+        uint8_t status = __atomic_load_n(&p->status, __ATOMIC_ACQUIRE);
+        if (status < CDA_PENDING || p->tag != tag) continue;
+        if (status == CDA_PENDING) return CDA_PENDING;
+
+        if (status == CDA_DONE && res != NULL) *res = p->res;
+        __atomic_store_n(&p->status, CDA_FREE, __ATOMIC_RELEASE);
+        return status;
+    }
+    return CDA_FREE;
+}
+
+// time out requests past their deadline, run pending callbacks
+// called by can_dev_process
+void can_dev_async_expire(uint32_t now) {
+    for (int i = 0; i < CAN_DEV_PENDING_SIZE; i++) {
+        can_dev_pending_t* p = &can_dev_pending[i];
+        uint8_t status = __atomic_load_n(&p->status, __ATOMIC_ACQUIRE);
+        if (status == CDA_PENDING && (int32_t) (now - p->deadline) >= 0) {
+            // the receive ISR may complete it first
+            if (__atomic_compare_exchange_n(&p->status, &status, CDA_TIMEOUT, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                p->res.length = 0;
+                status = CDA_TIMEOUT;
+            }
+        }
+
+        // polled requests stay until collected, fire-and-forget ones are dropped
+        if (status >= CDA_DONE && (p->done != NULL || p->discard)) {
+            if (p->done != NULL) p->done(p->tag, status, &p->res);
+            __atomic_store_n(&p->status, CDA_FREE, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+// complete the pending request for address with a response
+// returns 1 if a request was completed, 0 if none was waiting
+uint8_t can_dev_async_complete(uint8_t address, uint8_t length, uint8_t* data) {
+    for (int i = 0; i < CAN_DEV_PENDING_SIZE; i++) {
+        can_dev_pending_t* p = &can_dev_pending[i];
+        if (__atomic_load_n(&p->status, __ATOMIC_ACQUIRE) != CDA_PENDING || p->address != address) continue;
+
+        uint8_t expected = CDA_PENDING;
+        p->res.length = length > 8 ? 8 : length;
+        for (int j = 0; j < p->res.length; j++) {
+            p->res.data[j] = data[j];
+        }
+        return __atomic_compare_exchange_n(&p->status, &expected, CDA_DONE, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+// send outgoing frames through tx instead of the FDCAN, NULL restores the FDCAN
+void can_dev_set_loopback(can_dev_tx_fn tx) {
+    can_dev_tx_hook = tx;
+}
+
+// loopback stand-in: answers commands with the local device of the same address
+void can_dev_loopback_tx(uint8_t priority, uint8_t address, uint8_t length, uint8_t* data) {
+    // responses have nowhere to go
+    if (priority & 0x1) return;
+
+    const device_t* dev = dev_get_device(address);
+    if (dev == NULL) return;
+    data_field_t cmd = {.length = length > 8 ? 8 : length};
+    data_field_t res = {.length = 0};
+    for (int i = 0; i < cmd.length; i++) {
+        cmd.data[i] = data[i];
+    }
+    data_field_t* out = dev_call_r(dev, &cmd, &res);
+    if (out != NULL) can_dev_async_complete(address, out->length, out->data);
+}
+
+// run deferred ioctls and all pending transmissions
+// main loop only, returns number of work items processed
+size_t can_dev_process() {
+    size_t done = 0;
+    while (can_dev_work_tail != __atomic_load_n(&can_dev_work_head, __ATOMIC_ACQUIRE)) {
+        can_dev_work_t* w = &can_dev_work_queue[can_dev_work_tail & (CAN_DEV_WORK_QUEUE_SIZE - 1)];
+        if (!__atomic_load_n(&w->ready, __ATOMIC_ACQUIRE)) break; // reserved but not yet filled
+
+        data_field_t* out = &w->data;
+        data_field_t res = {.length = 0};
+        if (w->kind == CDW_IOCTL) out = dev_call_r(w->dev, &w->data, &res);
+        if (out != NULL && can_dev_tx_hook != NULL) {
+            can_dev_tx_hook(w->priority, w->address, out->length, out->data);
+        } else if (out != NULL) {
+            if (canlib2_send_data_p(can, w->priority, w->address, out->length, out->data)) Error_Handler();
+        }
+
+        w->ready = 0;
+        __atomic_store_n(&can_dev_work_tail, can_dev_work_tail + 1, __ATOMIC_RELEASE);
+        ++done;
+    }
+    can_dev_async_expire(HAL_GetTick());
+    return done;
+}
+
+// 1 if there is queued work for can_dev_process
+uint8_t can_dev_work_pending() {
+    return can_dev_work_tail != __atomic_load_n(&can_dev_work_head, __ATOMIC_ACQUIRE);
+}
+
+// run one received command, inline or queued for the main loop
+static void can_dev_cmd_run(canlib2_rx_return_t* ret) {
+    // make call to local device
+    uint16_t id = ret->identifier.address;
+    const device_t* dev = dev_get_device(id);
+    if (dev == NULL) return;
+    uint8_t priority = ret->identifier.priority | 0x1;
+
+    // slow ioctls run from the main loop
+    if (!(dev->flags & DEV_FLAG_INLINE)) {
+        can_dev_enqueue(CDW_IOCTL, dev, priority, dev->id & 0xFF, ret->length, ret->data);
+        return;
+    }
+
+    // command and result live on this ISR's stack, so a timer ISR calling
+    // the same driver cannot clobber them (see DEV_FLAG_REENTRANT)
+    data_field_t cmd = {.length = ret->length > 8 ? 8 : ret->length};
+    data_field_t res = {.length = 0};
+    for (int i = 0; i < cmd.length; i++) {
+        cmd.data[i] = ret->data[i];
+    }
+    if (dev_call_r(dev, &cmd, &res) == NULL) return;
+
+    // return call over CAN, the TX itself (which may wait on a full FIFO) is done by the main loop
+    can_dev_enqueue(CDW_TX, NULL, priority, dev->id & 0xFF, res.length, res.data);
 }
 
-data_field_t can_dev_df;
-data_field_t* can_dev_result_df;
 void can_dev_cmd_callback(FDCAN_HandleTypeDef* fdcan, canlib2_rx_return_t ret) {
     if (fdcan != can->fdcan) return;
     if (ret.event == CANLIB2_RX_FIFO0_NEW_MESSAGE && ret.frame_type == CANLIB2_DATA_FRAME) {
         // if it is not a command, do not respond
         if (ret.identifier.priority | 0x0) return;
 
-        // make call to local device
-        uint16_t id = ret.identifier.address;
-        device_t* dev = dev_get_device(id);
-        if (dev == NULL) return;
-        can_dev_df.length = ret.length;
-        for (int i = 0; i < ret.length; i++) {
-            can_dev_df.data[i] = ret.data[i];
-        }
-        can_dev_result_df = dev->ioctl(&can_dev_df);
-        
-        // return call over CAN
-        uint16_t priority = ret.identifier.priority;
-        if (can_dev_result_df == NULL) return;
-        if (canlib2_send_data_p(
-            can, priority | 0x1, dev->id & 0xFF, 
-            can_dev_result_df->length, can_dev_result_df->data)
-        ) Error_Handler();
+        // every command is recorded, including unknown devices and failed ioctls
+        DEV_STATS_BEGIN();
+        can_dev_cmd_run(&ret);
+        DEV_STATS_END(DEV_STATS_CAN_CMD_ID);
     }
 }
 
 void can_dev_rcv_callback(FDCAN_HandleTypeDef* fdcan, canlib2_rx_return_t ret) {
     if (fdcan != can->fdcan) return;
-    if (ret.event == CANLIB2_RX_FIFO0_NEW_MESSAGE && ret.frame_type == CANLIB2_DATA_FRAME) {
+    if (ret.event == CANLIB2_RX_FIFO1_NEW_MESSAGE && ret.frame_type == CANLIB2_DATA_FRAME) {
         uint16_t id = ret.identifier.address;
         can_device_t* dev = can_dev_get_device(id);
         if (dev == NULL) return;
+        if (!dev->unsolicited) can_dev_async_complete(id & 0xFF, ret.length, ret.data);
         for (int i = 0; i < ret.length; i++) {
             dev->prev_data[i] = ret.data[i];
         }
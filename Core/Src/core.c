@@ -4,127 +4,164 @@
 #include "din.h"
 #include "dout.h"
 #include "hsd.h"
+#include "hsd_sense.h"
 #include "timing.h"
 #include "timing_prediction.h"
 #include "can_device.h"
+#include "dev_stats.h"
+#include "sched.h"
+#include "monitor.h"
+#include "pwm.h"
 #include "stm32h5xx_hal.h"
 
-uint64_t core_100ns_tick;
-uint64_t core_100ns_start;
+core_tick_t core_100ns_start;
+volatile uint32_t core_100ns_hi; // TIM2 overflows, upper half of the 64-bit tick
 
-uint32_t core_10us_tick;
-
-TIM_HandleTypeDef* htim_10us;
 TIM_HandleTypeDef* htim_100ns_tick;
 
+// PWM on HSD_121: 1Hz, 5%
+#define CORE_PWM_FREQ_MHZ 1000
+#define CORE_PWM_DUTY 500
+
+dev_handle_t core_din3_out; // HSD_50, follows DIN3
+dev_handle_t core_din4_out; // HSD_51, follows DIN4
+
 
-void core_init(TIM_HandleTypeDef* htim_10us_i, TIM_HandleTypeDef* htim_100ns_tick_i, TIM_HandleTypeDef* htim_timing, FDCAN_HandleTypeDef* fdcan) {
-    htim_10us = htim_10us_i;
+void core_init(TIM_HandleTypeDef* htim_100ns_tick_i, TIM_HandleTypeDef* htim_timing, FDCAN_HandleTypeDef* fdcan, ADC_HandleTypeDef* adc) {
     htim_100ns_tick = htim_100ns_tick_i;
 
-    HAL_TIM_Base_Start_IT(htim_10us);
+    // update interrupt extends the tick to 64 bits
+    core_100ns_hi = 0;
+    __HAL_TIM_CLEAR_FLAG(htim_100ns_tick, TIM_FLAG_UPDATE);
     HAL_TIM_Base_Start_IT(htim_100ns_tick);
-    core_100ns_start = htim_100ns_tick->Instance->CNT;
-    core_100ns_tick = 0;
-    core_10us_tick = 0;
-
+    core_100ns_start = core_get_raw_tick();
+    sched_init(htim_100ns_tick);
+
+    // local devices are placed in the flash devtab with DEV_STATIC,
+    // only devices added at runtime need dev_register()
+    core_cycles_init();
+    monitor_init();
+    dev_stats_init();
     dev_init_devtab();
     can_dev_init_devtab(fdcan);
 
-    dev_register(dev_test_dev);
-
     din_init();
-    dev_register(din_dev);
-
     dout_init();
-    dev_register(dout_dev);
-
     hsd_init();
-    dev_register(hsd_120_dev);
-    dev_register(hsd_121_dev);
-    dev_register(hsd_12x_dia_dev);
-    dev_register(hsd_5x_dia_dev);
-    dev_register(hsd_50_dev);
-    dev_register(hsd_51_dev);
+    hsd_sense_init(adc);
+    if (timing_init(htim_timing, htim_100ns_tick)) Error_Handler();
 
-    timing_init(htim_timing);
-    dev_register(timing_dev);
+    // no timer channel is routed to the HSD enables, so this uses the scheduler backend
+    pwm_init();
+    int pwm = pwm_register(HSD_121_ID);
+    if (pwm < 0) Error_Handler();
 
     can_dev_register(0xF0, 0x3, 0x1);
 
     can_dev_start(fdcan);
     predict_init();
-}
 
-uint64_t core_get_tick() {
-    core_100ns_tick = htim_100ns_tick->Instance->CNT - core_100ns_start;
-    return core_100ns_tick;
-}
+    // slow loop runs from the scheduler
+    sched_add("100ms", core_100ms_loop, SCHED_MS(100), SCHED_US(500), 2);
 
-void core_reset_tick() {
-    core_100ns_start = htim_100ns_tick->Instance->CNT;
-    core_100ns_tick = 0;
-    core_10us_tick = 0;
+    if (pwm_set(pwm, CORE_PWM_FREQ_MHZ, CORE_PWM_DUTY)) Error_Handler();
+
+    // inputs are event driven, set the outputs once and follow the changes
+    core_din3_out = dev_bind(HSD_50_ID);
+    core_din4_out = dev_bind(HSD_51_ID);
+    if (core_din3_out == NULL || core_din4_out == NULL) Error_Handler();
+    dev_set(core_din3_out, din_get_channel(3)->level);
+    dev_set(core_din4_out, din_get_channel(4)->level);
+    din_set_callback(3, core_din_changed);
+    din_set_callback(4, core_din_changed);
 }
 
-uint64_t core_get_us_tick() {
-    return core_get_tick() / 10;
+// enable the cycle counter
+void core_cycles_init() {
+#ifdef CORE_CYCLES_DWT
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
 }
 
-void core_10us_callback() {
-    // update tick
-    ++core_10us_tick;
-    if (core_10us_tick % 100 == 0) core_1ms_callback();
-    if (core_10us_tick % 10000 == 0) core_100ms_callback();
-    core_10us_tick %= 100000;
-
-    // update core_tick
-    core_get_tick();
-    // update the loop
-    core_10us_loop();
+// 64-bit tick since power up, lock-free and safe from any context
+core_tick_t core_get_raw_tick() {
+    uint32_t hi, lo, wrapped;
+    do {
+        hi = core_100ns_hi;
+        __DMB();
+        lo = CORE_TICK_CNT();
+        wrapped = CORE_TICK_SR() & TIM_SR_UIF;
+        __DMB();
+    } while (hi != core_100ns_hi);
+
+    // overflow not yet counted by the interrupt (we are running at its priority
+    // or above), only applies if CNT was read after the wrap
+    if (wrapped && lo < 0x80000000u) ++hi;
+    return ((uint64_t) hi << 32) | lo;
 }
 
-void core_1ms_callback() {
-    core_1ms_loop();
+// TIM2 update interrupt, call from TIM2_IRQHandler (the HAL handler must not run)
+void core_tick_irq_handler() {
+    if (!(CORE_TICK_SR() & TIM_SR_UIF)) return;
+
+    // readers must never see the new high word with the flag still set
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    ++core_100ns_hi;
+    __HAL_TIM_CLEAR_FLAG(htim_100ns_tick, TIM_FLAG_UPDATE);
+    __set_PRIMASK(primask);
 }
 
-void core_100ms_callback() {
-    core_100ms_loop();
+core_tick_t core_get_tick() {
+    return core_get_raw_tick() - core_100ns_start;
 }
 
-uint32_t counter = 0;
-const uint32_t compare = 5000;
-uint8_t greater = 0;
+// TIM2 counter value at a core tick, for compare channels on the tick timer
+uint32_t core_tick_to_counter(core_tick_t tick) {
+    return (uint32_t) (tick + core_100ns_start);
+}
 
-void core_10us_loop() {
-    greater = counter <= compare ? 1 : 0;
-    ++counter;
-    counter %= 100000;
+void core_reset_tick() {
+    core_100ns_start = core_get_raw_tick();
+}
 
-    dev_ioctl(HSD_121_ID, (void*) &(greater));
+// us since init or core_reset_tick
+// 64-bit / 10 as a long division in 16-bit digits, each step fits core_div10
+uint64_t core_get_us_tick() {
+    core_tick_t t = core_get_tick();
+    uint32_t hi = (uint32_t) (t >> 32);
+    uint32_t q_hi = core_div10(hi);
+    uint32_t mid = ((hi - q_hi * 10) << 16) | ((uint32_t) t >> 16);
+    uint32_t q_mid = core_div10(mid);
+    uint32_t lo = ((mid - q_mid * 10) << 16) | ((uint32_t) t & 0xFFFF);
+    uint32_t q_lo = core_div10(lo);
+    return ((uint64_t) q_hi << 32) + ((uint64_t) q_mid << 16) + q_lo;
 }
 
-void core_1ms_loop() {
-    for (uint8_t i = 1; i < 5; i++) {
-        data_field_t df = {.length=1, .data={i}};
-        uint8_t value = dev_ioctl(DIN_DEVICE_ID, &df)->data[0];
-        dout_input_t dit = {.i = i, .value = value};
-        //dev_ioctl(DOUT_DEVICE_ID, (void*) &dit);
-        switch (i) {
-            case 1:
-                //dev_ioctl(HSD_120_ID, (void*) &(dit.value));
-                break;
-            case 2:
-                //dev_ioctl(HSD_121_ID, (void*) &(dit.value));
-                break;
-            case 3:
-                dev_ioctl(HSD_50_ID, (void*) &(dit.value));
-                break;
-            case 4:
-                dev_ioctl(HSD_51_ID, (void*) &(dit.value));
-                break;
-        }
+// main loop body: deferred work, then sleep until the next interrupt
+void core_background_loop() {
+    can_dev_process();
+
+    // an ISR that queues work between the check and WFI leaves its interrupt
+    // pending, which wakes WFI even with interrupts masked
+    __disable_irq();
+    if (!can_dev_work_pending()) {
+        // the wakeup interrupt runs after __enable_irq, so this is idle time only
+        uint32_t idle_start = CORE_CYCLES();
+        __WFI();
+        monitor_record_idle(CORE_CYCLES() - idle_start);
     }
+    __enable_irq();
+}
+
+// DIN3 -> HSD_50, DIN4 -> HSD_51, run from the DIN edge interrupt on every debounced change
+// (DIN1 -> HSD_120, DIN2 -> HSD_121 and DINx -> DOUTx are disabled)
+void core_din_changed(uint8_t i, uint8_t level, core_tick_t tick) {
+    UNUSED(tick); // edge time is for callbacks that measure, the outputs just follow
+    if (i == 3) dev_set(core_din3_out, level);
+    else if (i == 4) dev_set(core_din4_out, level);
 }
 
 uint8_t i;
@@ -137,4 +174,5 @@ void core_100ms_loop() {
     dev_ioctl(0xF0, &df);
 
     predict_periodic_reset();
+    monitor_update_load();
 }
@@ -0,0 +1,124 @@
+#include "dev_stats.h"
+
+dev_stats_t dev_stats[DEV_STATS_SIZE];
+size_t dev_stats_count;
+
+// stats slot + 1 for each 8-bit address, 0 if untracked
+uint8_t dev_stats_index[DEV_INDEX_SIZE];
+
+// clear all stats
+void dev_stats_init() {
+    for (size_t i = 0; i < DEV_INDEX_SIZE; i++) {
+        dev_stats_index[i] = 0;
+    }
+    dev_stats_count = 0;
+}
+
+// record one call of the device with this id
+// slots are handed out on first call, ids beyond DEV_STATS_SIZE are not tracked,
+// nor an id sharing its 8-bit address with an id that has a slot already
+void dev_stats_record(uint16_t id, uint32_t cycles) {
+    uint8_t slot = dev_stats_index[DEV_INDEX_KEY(id)];
+    if (slot == 0) {
+        // the CAN ISR records too, claim the slot with interrupts masked
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        slot = dev_stats_index[DEV_INDEX_KEY(id)];
+        if (slot == 0 && dev_stats_count < DEV_STATS_SIZE) {
+            dev_stats[dev_stats_count] = (dev_stats_t) {.id = id, .min = UINT32_MAX};
+            slot = ++dev_stats_count;
+            dev_stats_index[DEV_INDEX_KEY(id)] = slot;
+        }
+        __set_PRIMASK(primask);
+        if (slot == 0) return;
+    }
+    dev_stats_t* st = &dev_stats[slot-1];
+    if (st->id != id) return;
+
+    ++st->count;
+    st->total += cycles;
+    if (cycles < st->min) st->min = cycles;
+    if (cycles > st->max) st->max = cycles;
+
+    uint32_t bucket = 31 - __builtin_clz(cycles | 1);
+    if (bucket >= DEV_STATS_HIST_BUCKETS) bucket = DEV_STATS_HIST_BUCKETS - 1;
+    if (st->hist[bucket] < UINT16_MAX) ++st->hist[bucket];
+}
+
+// get stats for id, else NULL if never called or untracked
+const dev_stats_t* dev_stats_get(uint16_t id) {
+    uint8_t slot = dev_stats_index[DEV_INDEX_KEY(id)];
+    if (slot == 0) return NULL;
+    const dev_stats_t* st = &dev_stats[slot-1];
+    if (st->id != id) return NULL;
+    return st;
+}
+
+// get stats for the id tracked at an 8-bit address, else NULL
+static const dev_stats_t* dev_stats_get_address(uint8_t address) {
+    uint8_t slot = dev_stats_index[address];
+    if (slot == 0) return NULL;
+    return &dev_stats[slot-1];
+}
+
+DEV_STATIC(dev_stats_dev, DEV_STATS_DEVICE_ID) = {
+    .id = DEV_STATS_DEVICE_ID,
+    .name = "stats",
+    .ioctl = dev_stats_ioctl,
+    .ioctl_r = dev_stats_ioctl_r
+};
+
+data_field_t dev_stats_data_field = {.length=0};
+data_field_t* dev_stats_ioctl(data_field_t* cmd) {
+    return dev_stats_ioctl_r(cmd, &dev_stats_data_field);
+}
+data_field_t* dev_stats_ioctl_r(data_field_t* cmd, data_field_t* res) {
+    if (cmd == NULL) return NULL;
+    if (cmd->length < 1) return NULL;
+
+    if (cmd->data[0] == DSC_RESET) {
+        dev_stats_init();
+        res->length = 1;
+        res->data[0] = 0;
+        return res;
+    }
+
+    if (cmd->length < 2) return NULL;
+    const dev_stats_t* st = dev_stats_get_address(cmd->data[1]);
+    if (st == NULL) {
+        res->length = 1;
+        res->data[0] = 0xFF;
+        return res;
+    }
+
+    switch (cmd->data[0]) {
+        case DSC_GET_COUNT:
+            *((uint32_t*) res->data) = st->count;
+            res->length = 4;
+            break;
+        case DSC_GET_MIN:
+            *((uint32_t*) res->data) = st->min;
+            res->length = 4;
+            break;
+        case DSC_GET_MAX:
+            *((uint32_t*) res->data) = st->max;
+            res->length = 4;
+            break;
+        case DSC_GET_MEAN:
+            *((uint32_t*) res->data) = st->count ? (uint32_t) (st->total / st->count) : 0;
+            res->length = 4;
+            break;
+        case DSC_GET_HIST: {
+            uint8_t first = cmd->length > 2 ? cmd->data[2] : 0;
+            for (uint8_t i = 0; i < 4; i++) {
+                uint8_t b = first + i;
+                ((uint16_t*) res->data)[i] = b < DEV_STATS_HIST_BUCKETS ? st->hist[b] : 0;
+            }
+            res->length = 8;
+            break;
+        }
+        default:
+            return NULL;
+    }
+    return res;
+}
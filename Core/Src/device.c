@@ -1,14 +1,20 @@
 #include "device.h"
 #include "can_device.h"
+#include "dev_stats.h"
 
 device_t devtab[LOCAL_DEVTAB_SIZE];
 size_t device_count;
 
+// devtab slot + 1 for each 8-bit address, 0 if no device is registered there
+uint8_t devtab_index[DEV_INDEX_SIZE];
+_Static_assert(LOCAL_DEVTAB_SIZE < DEV_INDEX_SIZE, "devtab_index holds slot + 1 in a byte");
+
 // initialize devtab
 // returns pointer to devtab
+// (only the dynamic part, the flash table needs no initialization)
 device_t* dev_init_devtab() {
-    for (size_t i = 0; i < LOCAL_DEVTAB_SIZE; i++) {
-        devtab[i] = dev_empty_dev;
+    for (size_t i = 0; i < DEV_INDEX_SIZE; i++) {
+        devtab_index[i] = 0;
     }
     device_count = 0;
     return devtab;
@@ -16,33 +22,121 @@ device_t* dev_init_devtab() {
 
 // register device in devtab
 // returns pointer to device placed in devtab, or null if not enough devices
+// or if another device already uses the same 8-bit address
 device_t* dev_register(device_t dev) {
     if (device_count >= LOCAL_DEVTAB_SIZE) return NULL;
+    if (dev_get_device(dev.id) != NULL) return NULL;
+    if (devtab_index[DEV_INDEX_KEY(dev.id)] != 0) return NULL;
     devtab[device_count] = dev;
     ++device_count;
+    devtab_index[DEV_INDEX_KEY(dev.id)] = device_count;
     return &devtab[device_count-1];
 }
 
 // get device corresponding to id
 // returns pointer to device, else NULL
-device_t* dev_get_device(uint16_t id) {
-    for (size_t i = 0; i < LOCAL_DEVTAB_SIZE; i++) {
-        if (devtab[i].id == id) return &(devtab[i]);
+const device_t* dev_get_device(uint16_t id) {
+    // flash table, sorted by id at link time
+    const device_t* lo = __devtab_start;
+    const device_t* hi = __devtab_end;
+    while (lo < hi) {
+        const device_t* mid = lo + (hi - lo) / 2;
+        if (mid->id == id) return mid;
+        if (mid->id < id) lo = mid + 1;
+        else hi = mid;
     }
-    return NULL;
+
+    // dynamic devices: one index load, plus a full id compare so aliased 11-bit ids still miss
+    uint8_t slot = devtab_index[DEV_INDEX_KEY(id)];
+    if (slot == 0) return NULL;
+    device_t* dev = &devtab[slot-1];
+    if (dev->id != id) return NULL;
+    return dev;
 }
 
 // call ioctl corresponding to id
 // returns ioctl result, else NULL
 data_field_t dev_null_data = {.data = {0, 0, 0, 0, 0, 0, 0, 0}, .length=0};
 data_field_t* dev_ioctl(uint16_t id, data_field_t* cmd) {
-    device_t* dev = dev_get_device(id);
+    const device_t* dev = dev_get_device(id);
     if (dev == NULL) {
         // try can devices
         can_dev_ioctl(id, cmd);
         return &dev_null_data;
     }
-    return dev->ioctl(cmd);
+    DEV_STATS_BEGIN();
+    data_field_t* res = dev->ioctl(cmd);
+    DEV_STATS_END(id);
+    return res;
+}
+
+// call ioctl corresponding to id, result written to the caller's res buffer
+// returns res, else NULL
+data_field_t* dev_ioctl_r(uint16_t id, data_field_t* cmd, data_field_t* res) {
+    if (res == NULL) return NULL;
+    const device_t* dev = dev_get_device(id);
+    if (dev == NULL) {
+        // try can devices
+        can_dev_ioctl(id, cmd);
+        *res = dev_null_data;
+        return res;
+    }
+    return dev_call_r(dev, cmd, res);
+}
+
+// caller-buffered ioctl on an already resolved device
+// returns res, else NULL
+data_field_t* dev_call_r(dev_handle_t dev, data_field_t* cmd, data_field_t* res) {
+    if (dev == NULL || res == NULL) return NULL;
+    DEV_STATS_BEGIN();
+    data_field_t* out;
+    if (dev->ioctl_r != NULL) {
+        out = dev->ioctl_r(cmd, res);
+    } else {
+        // legacy driver: copy out of its static result
+        out = dev->ioctl(cmd);
+        if (out != NULL) {
+            *res = *out;
+            out = res;
+        }
+    }
+    DEV_STATS_END(dev->id);
+    return out;
+}
+
+// vectored ioctl: run n (device id, command) entries in one dispatch
+// returns number of entries that succeeded
+size_t dev_ioctlv(dev_iovec_t* iov, size_t n) {
+    size_t done = 0;
+    size_t i = 0;
+    while (i < n) {
+        // group consecutive entries addressed to the same device
+        size_t run = 1;
+        while (i + run < n && iov[i + run].id == iov[i].id) ++run;
+
+        const device_t* dev = dev_get_device(iov[i].id);
+        if (dev == NULL) {
+            for (size_t j = i; j < i + run; j++) {
+                iov[j].ok = 0;
+                iov[j].res.length = 0;
+            }
+        } else if (dev->ioctlv != NULL) {
+            done += dev->ioctlv(&iov[i], run);
+        } else {
+            for (size_t j = i; j < i + run; j++) {
+                iov[j].ok = dev_call_r(dev, &iov[j].cmd, &iov[j].res) != NULL;
+                done += iov[j].ok;
+            }
+        }
+        i += run;
+    }
+    return done;
+}
+
+// resolve a local device once (at init) for hot-path calls
+// returns handle, else NULL
+dev_handle_t dev_bind(uint16_t id) {
+    return dev_get_device(id);
 }
 
 // ioctls for empty and test devices
@@ -50,24 +144,80 @@ const char dev_empty_dev_name[] = "DEVICE_EMPTY";
 const device_t dev_empty_dev = {
     .id = DEV_EMPTY_DEVICE_ID,
     .name = dev_empty_dev_name,
-    .ioctl = dev_empty_dev_ioctl
+    .ioctl = dev_empty_dev_ioctl,
+    .ioctl_r = dev_empty_dev_ioctl_r,
+    .flags = DEV_FLAG_REENTRANT | DEV_FLAG_INLINE
 };
 data_field_t* dev_empty_dev_ioctl(__unused data_field_t* cmd) {
     return &dev_null_data;
 }
+data_field_t* dev_empty_dev_ioctl_r(__unused data_field_t* cmd, data_field_t* res) {
+    *res = dev_null_data;
+    return res;
+}
 
 const char dev_test_dev_name[] = "DEVICE_TEST";
-const device_t dev_test_dev = {
+DEV_STATIC(dev_test_dev, DEV_TEST_DEVICE_ID) = {
     .id = DEV_TEST_DEVICE_ID,
     .name = dev_test_dev_name,
-    .ioctl = dev_test_dev_ioctl
+    .ioctl = dev_test_dev_ioctl,
+    .set = dev_test_dev_set,
+    .ioctl_r = dev_test_dev_ioctl_r,
+    .flags = DEV_FLAG_REENTRANT | DEV_FLAG_INLINE
 };
 data_field_t dev_test_data_field = {.length=1, .data={0,0,0,0,0,0,0,0}};
 data_field_t* dev_test_dev_ioctl(data_field_t* cmd) {
+    return dev_test_dev_ioctl_r(cmd, &dev_test_data_field);
+}
+data_field_t* dev_test_dev_ioctl_r(data_field_t* cmd, data_field_t* res) {
     if (cmd == NULL) return NULL;
     if (cmd->length < 1) return NULL;
-    if (cmd->data[0] == 1) HAL_GPIO_WritePin(LIFE_LED_GPIO_Port, LIFE_LED_Pin, GPIO_PIN_SET);
-    else if (cmd->data[0] == 0) HAL_GPIO_WritePin(LIFE_LED_GPIO_Port, LIFE_LED_Pin, GPIO_PIN_RESET); 
-    else dev_test_data_field.data[0] = 0xFF;
-    return &dev_test_data_field;
-}
\ No newline at end of file
+    res->length = 1;
+    res->data[0] = 0;
+    if (cmd->data[0] == 1 || cmd->data[0] == 0) dev_test_dev_set(cmd->data[0]);
+    else res->data[0] = 0xFF;
+    return res;
+}
+void dev_test_dev_set(uint8_t value) {
+    HAL_GPIO_WritePin(LIFE_LED_GPIO_Port, LIFE_LED_Pin, value ? GPIO_PIN_SET : GPIO_PIN_RESET);
+}
+
+const char dev_vector_dev_name[] = "DEVICE_VECTOR";
+DEV_STATIC(dev_vector_dev, DEV_VECTOR_DEVICE_ID) = {
+    .id = DEV_VECTOR_DEVICE_ID,
+    .name = dev_vector_dev_name,
+    .ioctl = dev_vector_dev_ioctl,
+    .ioctl_r = dev_vector_dev_ioctl_r
+};
+data_field_t dev_vector_data_field = {.length=0};
+data_field_t* dev_vector_dev_ioctl(data_field_t* cmd) {
+    return dev_vector_dev_ioctl_r(cmd, &dev_vector_data_field);
+}
+data_field_t* dev_vector_dev_ioctl_r(data_field_t* cmd, data_field_t* res) {
+    if (cmd == NULL) return NULL;
+    if (cmd->length < 2) return NULL;
+
+    dev_iovec_t iov[DEV_IOCTLV_MAX];
+    size_t n = cmd->length / 2;
+    if (n > DEV_IOCTLV_MAX) n = DEV_IOCTLV_MAX;
+    for (size_t i = 0; i < n; i++) {
+        iov[i].id = cmd->data[2*i];
+        iov[i].cmd.length = 1;
+        iov[i].cmd.data[0] = cmd->data[2*i + 1];
+    }
+    dev_ioctlv(iov, n);
+
+    // pack successful results behind the status mask, an entry whose result
+    // does not fit in the frame any more is left out and reported as failed
+    res->data[0] = 0;
+    res->length = 1;
+    for (size_t i = 0; i < n; i++) {
+        if (!iov[i].ok) continue;
+        if (res->length + iov[i].res.length > 8) continue;
+        res->data[0] |= 1 << i;
+        for (size_t j = 0; j < iov[i].res.length; j++) {
+            res->data[res->length++] = iov[i].res.data[j];
+        }
+    }
+    return res;
+}
@@ -1,17 +1,131 @@
 #include "din.h"
+#include "sched.h"
 
 const din_t dintab[DIN_COUNT+1] = {
-    {.port=DIN1_GPIO_Port, .pin=DIN1_Pin}, // cloning 0 and 1 because of littleECU convention
-    {.port=DIN1_GPIO_Port, .pin=DIN1_Pin},
-    {.port=DIN2_GPIO_Port, .pin=DIN2_Pin},
-    {.port=DIN3_GPIO_Port, .pin=DIN3_Pin},
-    {.port=DIN4_GPIO_Port, .pin=DIN4_Pin}
+    {.port=DIN1_GPIO_Port, .pin=DIN1_Pin, .irq=EXTI14_IRQn}, // cloning 0 and 1 because of littleECU convention
+    {.port=DIN1_GPIO_Port, .pin=DIN1_Pin, .irq=EXTI14_IRQn},
+    {.port=DIN2_GPIO_Port, .pin=DIN2_Pin, .irq=EXTI15_IRQn},
+    {.port=DIN3_GPIO_Port, .pin=DIN3_Pin, .irq=EXTI0_IRQn},
+    {.port=DIN4_GPIO_Port, .pin=DIN4_Pin, .irq=EXTI1_IRQn}
 };
 
-// initialize dintab 
+// snapshot gather tables, one entry per port
+// each port's dins must sit on adjacent pins in din order so one shift moves them all
+#define DIN_SHIFT_R(pin, din) (__builtin_ctz(pin) > (din) ? __builtin_ctz(pin) - (din) : 0)
+#define DIN_SHIFT_L(pin, din) ((din) > __builtin_ctz(pin) ? (din) - __builtin_ctz(pin) : 0)
+#define DIN_GATHER(port_, first_pin, last_pin, first_din) { \
+    .port = (port_), .mask = (first_pin) | (last_pin), \
+    .rshift = DIN_SHIFT_R(first_pin, first_din), .lshift = DIN_SHIFT_L(first_pin, first_din) }
+
+_Static_assert(DIN2_Pin == DIN1_Pin << 1, "DIN1 and DIN2 must be adjacent pins");
+_Static_assert(DIN4_Pin == DIN3_Pin << 1, "DIN3 and DIN4 must be adjacent pins");
+_Static_assert(DIN_COUNT < 8, "the snapshot mask is a byte");
+
+static const din_gather_t din_gather[] = {
+    DIN_GATHER(DIN1_GPIO_Port, DIN1_Pin, DIN2_Pin, 1),
+    DIN_GATHER(DIN3_GPIO_Port, DIN3_Pin, DIN4_Pin, 3)
+};
+#define DIN_GATHER_COUNT (sizeof(din_gather) / sizeof(din_gather[0]))
+
+din_channel_t din_channels[DIN_COUNT+1];
+
+static void din_lockout_end(uint8_t i);
+
+// scheduler tasks take no argument, one per din
+#define DIN_TASK(n) static void din_task_##n() { din_lockout_end(n); }
+DIN_TASK(1)
+DIN_TASK(2)
+DIN_TASK(3)
+DIN_TASK(4)
+static const sched_fn din_tasks[DIN_COUNT+1] = {NULL, din_task_1, din_task_2, din_task_3, din_task_4};
+
+// initialize dintab, switches the inputs to edge interrupts
 void din_init() {
-    // do nothing
-    // assume MX_Init is configured correctly in main.c
+    core_tick_t now = core_get_tick();
+    for (uint8_t i = 1; i <= DIN_COUNT; i++) {
+        din_channels[i] = (din_channel_t) {
+            .state = DDS_STABLE,
+            .level = HAL_GPIO_ReadPin(dintab[i].port, dintab[i].pin),
+            .task = -1,
+            .debounce = CORE_US_TO_TICKS(DIN_DEFAULT_DEBOUNCE_US),
+            .last_edge = now,
+            .last_change = now
+        };
+
+        // MX_GPIO_Init sets the pins up as plain inputs
+        GPIO_InitTypeDef init = {
+            .Pin = dintab[i].pin,
+            .Mode = GPIO_MODE_IT_RISING_FALLING,
+            .Pull = GPIO_NOPULL
+        };
+        HAL_GPIO_Init(dintab[i].port, &init);
+        HAL_NVIC_SetPriority(dintab[i].irq, 0, 0);
+        HAL_NVIC_EnableIRQ(dintab[i].irq);
+    }
+}
+
+// set the change callback of din i, NULL to remove
+void din_set_callback(uint8_t i, din_change_fn callback) {
+    if (i < 1 || i > DIN_COUNT) return;
+    din_channels[i].callback = callback;
+}
+
+// set the debounce time of din i
+void din_set_debounce(uint8_t i, core_ticks_t debounce) {
+    if (i < 1 || i > DIN_COUNT) return;
+    din_channels[i].debounce = debounce;
+}
+
+// get input engine state of din i, else NULL
+const din_channel_t* din_get_channel(uint8_t i) {
+    if (i < 1 || i > DIN_COUNT) return NULL;
+    return &din_channels[i];
+}
+
+// report a change if the pin no longer matches the debounced level
+// returns 1 if it changed
+static uint8_t din_commit(uint8_t i, core_tick_t tick) {
+    din_channel_t* ch = &din_channels[i];
+    uint8_t level = HAL_GPIO_ReadPin(dintab[i].port, dintab[i].pin);
+    if (level == ch->level) return 0;
+
+    ch->level = level;
+    ch->last_change = tick;
+    ++ch->changes;
+    if (ch->callback != NULL) ch->callback(i, level, tick);
+    return 1;
+}
+
+// report the change right away (leading edge), then hold off for the debounce time
+static void din_lockout_begin(uint8_t i, core_tick_t tick) {
+    din_channel_t* ch = &din_channels[i];
+    if (!din_commit(i, tick) || ch->debounce == 0) return;
+
+    ch->state = DDS_LOCKOUT;
+    ch->task = sched_add("din", din_tasks[i], 0, ch->debounce, 0);
+    if (ch->task < 0) ch->state = DDS_STABLE; // no timer, fall back to reporting every edge
+}
+
+// lockout timer expired, catch a change that happened during the bounce
+static void din_lockout_end(uint8_t i) {
+    din_channel_t* ch = &din_channels[i];
+    ch->task = -1; // one-shot, removed by the scheduler
+    ch->state = DDS_STABLE;
+    din_lockout_begin(i, ch->last_edge);
+}
+
+// EXTI interrupt for din i, call from the EXTI line's IRQ handler
+void din_exti_irq_handler(uint8_t i) {
+    if (i < 1 || i > DIN_COUNT) return;
+    uint16_t pin = dintab[i].pin;
+    if (!__HAL_GPIO_EXTI_GET_RISING_IT(pin) && !__HAL_GPIO_EXTI_GET_FALLING_IT(pin)) return;
+    __HAL_GPIO_EXTI_CLEAR_RISING_IT(pin);
+    __HAL_GPIO_EXTI_CLEAR_FALLING_IT(pin);
+
+    din_channel_t* ch = &din_channels[i];
+    ch->last_edge = core_get_tick();
+    ++ch->edges;
+    if (ch->state == DDS_STABLE) din_lockout_begin(i, ch->last_edge);
 }
 
 // get single input (default 0, invalid -1)
@@ -20,20 +134,104 @@ uint8_t din_get(uint8_t i) {
     return HAL_GPIO_ReadPin(dintab[i].port, dintab[i].pin);
 }
 
+// get all inputs as a bitmask (bit i is din i), fast path for bound handles
+// one IDR load per port
+uint32_t din_get_all() {
+    uint32_t mask = 0;
+    for (size_t g = 0; g < DIN_GATHER_COUNT; g++) {
+        mask |= ((din_gather[g].port->IDR & din_gather[g].mask) >> din_gather[g].rshift) << din_gather[g].lshift;
+    }
+    return mask | ((mask >> 1) & 1);
+}
+
+// get all inputs with the time they were read
+din_snapshot_t din_snapshot() {
+    din_snapshot_t snap;
+    snap.tick = core_get_tick();
+    snap.mask = din_get_all();
+    return snap;
+}
+
 // 1 byte input: din number
 // 1 byte output: din value
 data_field_t din_ioctl_result = {.length=1};
 data_field_t* din_ioctl(data_field_t* cmd) {
+    return din_ioctl_r(cmd, &din_ioctl_result);
+}
+data_field_t* din_ioctl_r(data_field_t* cmd, data_field_t* res) {
     if (cmd == NULL) return NULL;
     if (cmd->length < 1) return NULL;
     uint8_t i = cmd->data[0];
-    din_ioctl_result.data[0] = din_get(i);
-    return &din_ioctl_result;
+    if (i == DIN_SNAPSHOT) {
+        din_snapshot_t snap = din_snapshot();
+        uint64_t tick = snap.tick;
+        res->data[0] = snap.mask;
+        for (uint8_t b = 1; b < 8; b++, tick >>= 8) res->data[b] = tick & 0xFF;
+        res->length = 8;
+        return res;
+    }
+    if (cmd->length == 1) {
+        res->length = 1;
+        res->data[0] = din_get(i);
+        return res;
+    }
+
+    if (i < 1 || i > DIN_COUNT) return NULL;
+    din_channel_t* ch = &din_channels[i];
+    switch (cmd->data[1]) {
+        case DINC_GET_EDGES:
+            *((uint32_t*) res->data) = ch->edges;
+            res->length = 4;
+            break;
+        case DINC_GET_CHANGES:
+            *((uint32_t*) res->data) = ch->changes;
+            res->length = 4;
+            break;
+        case DINC_GET_CHANGE_TICK:
+            *((uint64_t*) res->data) = ch->last_change;
+            res->length = 8;
+            break;
+        case DINC_SET_DEBOUNCE:
+            if (cmd->length < 4) return NULL;
+            din_set_debounce(i, CORE_US_TO_TICKS(cmd->data[2] | (cmd->data[3] << 8)));
+            res->data[0] = 0;
+            res->length = 1;
+            break;
+        default:
+            return NULL;
+    }
+    return res;
+}
+
+// batch hook: serves every entry from one read of all inputs
+size_t din_ioctlv(dev_iovec_t* iov, size_t n) {
+    uint32_t mask = din_get_all();
+    size_t done = 0;
+    for (size_t j = 0; j < n; j++) {
+        iov[j].ok = 0;
+        if (iov[j].cmd.length < 1) continue;
+        if (iov[j].cmd.length > 1 || iov[j].cmd.data[0] == DIN_SNAPSHOT) {
+            // engine commands and snapshots are not single reads
+            iov[j].ok = din_ioctl_r(&iov[j].cmd, &iov[j].res) != NULL;
+            done += iov[j].ok;
+            continue;
+        }
+        uint8_t i = iov[j].cmd.data[0];
+        iov[j].res.length = 1;
+        iov[j].res.data[0] = i > DIN_COUNT ? 0xFF : (mask >> i) & 1;
+        iov[j].ok = 1;
+        ++done;
+    }
+    return done;
 }
 
 // DIN device
-const device_t din_dev = {
+DEV_STATIC(din_dev, DIN_DEVICE_ID) = {
     .id = DIN_DEVICE_ID,
     .name = "DIN",
-    .ioctl = din_ioctl
+    .ioctl = din_ioctl,
+    .get = din_get_all,
+    .ioctl_r = din_ioctl_r,
+    .flags = DEV_FLAG_REENTRANT | DEV_FLAG_INLINE,
+    .ioctlv = din_ioctlv
 };
\ No newline at end of file
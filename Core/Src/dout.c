@@ -8,10 +8,29 @@ const dout_t douttab[DOUT_COUNT+1] = {
     {.port=DOUT4_GPIO_Port, .pin=DOUT4_Pin}
 };
 
-// initialize dintab 
+// masked write layout, built from douttab
+dout_port_t dout_ports[DOUT_COUNT];
+uint8_t dout_port_count;
+
+// initialize douttab, precomputes the masked write layout
+// assume MX_Init configured the pins as outputs in main.c
 void dout_init() {
-    // do nothing
-    // assume MX_Init is configured correctly in main.c
+    dout_port_count = 0;
+    for (uint8_t i = 1; i <= DOUT_COUNT; i++) {
+        dout_port_t* p = NULL;
+        for (uint8_t j = 0; j < dout_port_count; j++) {
+            if (dout_ports[j].port == douttab[i].port) p = &dout_ports[j];
+        }
+        if (p == NULL) {
+            p = &dout_ports[dout_port_count++];
+            *p = (dout_port_t) {.port = douttab[i].port};
+        }
+
+        // every nibble containing dout i drives its pin
+        for (uint32_t m = 0; m < (1 << DOUT_COUNT); m++) {
+            if (m & (1 << (i - 1))) p->pins[m] |= douttab[i].pin;
+        }
+    }
 }
 
 // set single output (ignores invalid)
@@ -20,26 +39,49 @@ void dout_set(uint8_t i, uint8_t v) {
     HAL_GPIO_WritePin(douttab[i].port, douttab[i].pin, v ? GPIO_PIN_SET : GPIO_PIN_RESET);
 }
 
+// set the outputs selected by mask to values (bit i is dout i, bit 0 unused)
+// each port is written with one BSRR store, so its outputs switch together
+void dout_set_masked(uint32_t mask, uint32_t values) {
+    uint32_t set = (mask & values) >> 1 & ((1 << DOUT_COUNT) - 1);
+    uint32_t reset = (mask & ~values) >> 1 & ((1 << DOUT_COUNT) - 1);
+    for (uint8_t j = 0; j < dout_port_count; j++) {
+        uint32_t bsrr = dout_ports[j].pins[set] | ((uint32_t) dout_ports[j].pins[reset] << 16);
+        if (bsrr) dout_ports[j].port->BSRR = bsrr;
+    }
+}
+
 // 2 bytes input: dout number, dout value (dout_input_t)
 // 1 byte output: 0 if success, -1 if invalid
 data_field_t dout_ioctl_result = {.length=1};
 data_field_t* dout_ioctl(data_field_t* cmd) {
+    return dout_ioctl_r(cmd, &dout_ioctl_result);
+}
+data_field_t* dout_ioctl_r(data_field_t* cmd, data_field_t* res) {
     if (cmd == NULL) return NULL;
     if (cmd->length < 1) return NULL;
 
-    dout_ioctl_result.data[0] = 0;
+    res->length = 1;
+    res->data[0] = 0;
+    if (cmd->data[0] == DOUT_MASKED) {
+        if (cmd->length < 3) return NULL;
+        dout_set_masked(cmd->data[1], cmd->data[2]);
+        return res;
+    }
+
     dout_input_t* dit = (dout_input_t*) cmd->data;
     if (dit->i > DOUT_COUNT || (dit->value != 0 && dit->value != 1)) {
-        dout_ioctl_result.data[0] = -1;
-        return &dout_ioctl_result;
+        res->data[0] = -1;
+        return res;
     }
 
     dout_set(dit->i, dit->value);
-    return &dout_ioctl_result;
+    return res;
 }
 
-const device_t dout_dev = {
+DEV_STATIC(dout_dev, DOUT_DEVICE_ID) = {
     .id = DOUT_DEVICE_ID,
     .name = "DOUT",
-    .ioctl = dout_ioctl
+    .ioctl = dout_ioctl,
+    .ioctl_r = dout_ioctl_r,
+    .flags = DEV_FLAG_REENTRANT | DEV_FLAG_INLINE
 };
@@ -1,235 +1,373 @@
 #include "hsd.h"
+#include "hsd_sense.h"
+#include "hsd_guard.h"
 #include "main.h"
 
-hsd_t hsd_12x = {
-    .config = {
-        .dia_en_port = HSD120_DIA_EN_GPIO_Port,
-        .dia_en_pin = HSD120_DIA_EN_Pin,
-        .en1_port = HSD120_EN1_GPIO_Port,
-        .en1_pin = HSD120_EN1_Pin,
-        .en2_port = HSD120_EN2_GPIO_Port,
-        .en2_pin = HSD120_EN2_Pin,
-        .latch_port = HSD120_LATCH_GPIO_Port,
-        .latch_pin = HSD120_LATCH_Pin,
-        .sel1_port = HSD120_SEL1_GPIO_Port,
-        .sel1_pin = HSD120_SEL1_Pin,
-        .sel2_port = HSD120_SEL2_GPIO_Port,
-        .sel2_pin = HSD120_SEL2_Pin
-    }, 
-    .dia_state = { // DIA_OFF state by default
-        .dia_en = 0,
-        .latch = 0,
-        .sel1 = 0,
-        .sel2 = 0
-    },
-    .en1 = 0,
-    .en2 = 0
-};
-hsd_t hsd_5x = {
-    .config = {
-        .dia_en_port = HSD50_DIA_EN_GPIO_Port,
-        .dia_en_pin = HSD50_DIA_EN_Pin,
-        .en1_port = HSD50_EN1_GPIO_Port,
-        .en1_pin = HSD50_EN1_Pin,
-        .en2_port = HSD50_EN2_GPIO_Port,
-        .en2_pin = HSD50_EN2_Pin,
-        .latch_port = HSD50_LATCH_GPIO_Port,
-        .latch_pin = HSD50_LATCH_Pin,
-        .sel1_port = HSD50_SEL1_GPIO_Port,
-        .sel1_pin = HSD50_SEL1_Pin,
-        .sel2_port = HSD50_SEL2_GPIO_Port,
-        .sel2_pin = HSD50_SEL2_Pin
-    }, 
-    .dia_state = { // DIA_OFF state by default
-        .dia_en = 0,
-        .latch = 0,
-        .sel1 = 0,
-        .sel2 = 0
-    },
-    .en1 = 0,
-    .en2 = 0
-};
+// chip indices in hsdtab
+#define HSD_12X 0
+#define HSD_5X 1
 
-const device_t hsd_120_dev = {
-    .id = HSD_120_ID,
-    .name = "HSD_120",
-    .ioctl = hsd_120_ioctl
-};
-const device_t hsd_121_dev = {
-    .id = HSD_121_ID,
-    .name = "HSD_121",
-    .ioctl = hsd_121_ioctl
-};
-const device_t hsd_12x_dia_dev = {
-    .id = HSD_12X_DIA_ID,
-    .name = "HSD_12X diagnostics",
-    .ioctl = hsd_12x_dia_ioctl
-};
+// ADC1 channels of the SNS pins
+#define HSD120_SNS_ADC_CHANNEL ADC_CHANNEL_3 // PA6
+#define HSD50_SNS_ADC_CHANNEL ADC_CHANNEL_19 // PA5
+
+#define HSD_CONFIG(prefix) { \
+    .dia_en_port = prefix##_DIA_EN_GPIO_Port, \
+    .dia_en_pin = prefix##_DIA_EN_Pin, \
+    .en1_port = prefix##_EN1_GPIO_Port, \
+    .en1_pin = prefix##_EN1_Pin, \
+    .en2_port = prefix##_EN2_GPIO_Port, \
+    .en2_pin = prefix##_EN2_Pin, \
+    .latch_port = prefix##_LATCH_GPIO_Port, \
+    .latch_pin = prefix##_LATCH_Pin, \
+    .sel1_port = prefix##_SEL1_GPIO_Port, \
+    .sel1_pin = prefix##_SEL1_Pin, \
+    .sel2_port = prefix##_SEL2_GPIO_Port, \
+    .sel2_pin = prefix##_SEL2_Pin, \
+    .sns_channel = prefix##_SNS_ADC_CHANNEL \
+}
 
-const device_t hsd_50_dev = {
-    .id = HSD_50_ID,
-    .name = "HSD_50",
-    .ioctl = hsd_50_ioctl
+// everything off, the sense sequencer owns the mux by default
+hsd_t hsdtab[] = {
+    [HSD_12X] = {.config = HSD_CONFIG(HSD120), .dia = HSDD_AUTO},
+    [HSD_5X] = {.config = HSD_CONFIG(HSD50), .dia = HSDD_AUTO}
 };
-const device_t hsd_51_dev = {
-    .id = HSD_51_ID,
-    .name = "HSD_51",
-    .ioctl = hsd_51_ioctl
+const size_t hsd_chip_count = sizeof(hsdtab) / sizeof(hsdtab[0]);
+
+// every enable output: device name, id, chip, enable (0 EN1, 1 EN2)
+// the channel table, its indices and the channel devices are all generated from this list
+#define HSD_CHANNEL_LIST(X) \
+    X(120, HSD_120_ID, HSD_12X, 0) \
+    X(121, HSD_121_ID, HSD_12X, 1) \
+    X(50, HSD_50_ID, HSD_5X, 0) \
+    X(51, HSD_51_ID, HSD_5X, 1)
+
+// channel indices into hsd_channels, HSD_CH_<name>
+#define HSD_CHANNEL_INDEX(dev, id_, chip_, en_) HSD_CH_##dev,
+enum { HSD_CHANNEL_LIST(HSD_CHANNEL_INDEX) };
+
+#define HSD_CHANNEL_ENTRY(dev, id_, chip_, en_) [HSD_CH_##dev] = {.id = (id_), .chip = (chip_), .en = (en_)},
+const hsd_channel_t hsd_channels[] = {
+    HSD_CHANNEL_LIST(HSD_CHANNEL_ENTRY)
 };
-const device_t hsd_5x_dia_dev = {
-    .id = HSD_5X_DIA_ID,
-    .name = "HSD_5X diagnostics",
-    .ioctl = hsd_5x_dia_ioctl
+const size_t hsd_channel_count = sizeof(hsd_channels) / sizeof(hsd_channels[0]);
+
+_Static_assert(sizeof(hsd_channels) / sizeof(hsd_channels[0]) <= 32, "bulk masks hold 32 channels");
+
+// diagnostic mux state word for each option
+typedef struct hsd_dia_mux {
+    uint8_t option; // hsd_dia_options_t
+    uint8_t state;
+} hsd_dia_mux_t;
+
+static const hsd_dia_mux_t hsd_dia_muxes[] = {
+    {HSDD_DIA_OFF, 0},
+    {HSDD_I_CH1, 1 << HSD_SIG_DIA_EN},
+    {HSDD_I_CH2, (1 << HSD_SIG_DIA_EN) | (1 << HSD_SIG_SEL2)},
+    {HSDD_TEMP, 1 << HSD_SIG_SEL1},
+    {HSDD_LATCH, 1 << HSD_SIG_LATCH}
 };
 
+// build the pin layout of an hsd from its config
+static void hsd_init_layout(hsd_t* hsd) {
+    hsd_layout_t* l = &hsd->layout;
+    GPIO_TypeDef* ports[HSD_SIG_COUNT] = {
+        [HSD_SIG_LATCH] = hsd->config.latch_port,
+        [HSD_SIG_DIA_EN] = hsd->config.dia_en_port,
+        [HSD_SIG_SEL1] = hsd->config.sel1_port,
+        [HSD_SIG_SEL2] = hsd->config.sel2_port,
+        [HSD_SIG_EN1] = hsd->config.en1_port,
+        [HSD_SIG_EN2] = hsd->config.en2_port
+    };
+    uint16_t pins[HSD_SIG_COUNT] = {
+        [HSD_SIG_LATCH] = hsd->config.latch_pin,
+        [HSD_SIG_DIA_EN] = hsd->config.dia_en_pin,
+        [HSD_SIG_SEL1] = hsd->config.sel1_pin,
+        [HSD_SIG_SEL2] = hsd->config.sel2_pin,
+        [HSD_SIG_EN1] = hsd->config.en1_pin,
+        [HSD_SIG_EN2] = hsd->config.en2_pin
+    };
+
+    l->port_count = 0;
+    for (uint8_t s = 0; s < HSD_SIG_COUNT; s++) {
+        uint8_t p = 0;
+        while (p < l->port_count && l->ports[p] != ports[s]) ++p;
+        if (p == l->port_count) l->ports[l->port_count++] = ports[s];
+        l->sig_port[s] = p;
+        l->sig_pin[s] = pins[s];
+    }
+}
+
+// write every pin of an hsd, used once at init to sync the shadow
+static void hsd_write_all(hsd_t* hsd) {
+    for (uint8_t s = 0; s < HSD_SIG_COUNT; s++) {
+        uint32_t pin = hsd->layout.sig_pin[s];
+        hsd->layout.ports[hsd->layout.sig_port[s]]->BSRR = (hsd->state & ~hsd->block) >> s & 1 ? pin : pin << 16;
+    }
+    hsd->shadow = hsd->state & ~hsd->block;
+}
+
+// BSRR words being gathered for a commit
+// callers only zero count, the arrays are filled as ports are added (no clear per commit)
+typedef struct hsd_commit {
+    GPIO_TypeDef* ports[HSD_SIG_COUNT * 2];
+    uint32_t bsrr[HSD_SIG_COUNT * 2];
+    uint8_t count;
+} hsd_commit_t;
+
+// add the changed pins of a chip to a commit and update its shadow
+// blocked enables are written low whatever the state asks for
+// interrupts must be masked
+static void hsd_gather(hsd_t* hsd, hsd_commit_t* c) {
+    uint8_t want = hsd->state & ~hsd->block;
+    uint32_t diff = want ^ hsd->shadow;
+    while (diff) {
+        uint8_t s = __builtin_ctz(diff);
+        diff &= diff - 1;
+        GPIO_TypeDef* port = hsd->layout.ports[hsd->layout.sig_port[s]];
+        uint32_t pin = hsd->layout.sig_pin[s];
+
+        uint8_t p = 0;
+        while (p < c->count && c->ports[p] != port) ++p;
+        if (p == c->count) {
+            if (c->count >= HSD_SIG_COUNT * 2) return; // full, the rest is written by the next commit
+            c->ports[c->count] = port;
+            c->bsrr[c->count++] = 0;
+        }
+        c->bsrr[p] |= (want >> s) & 1 ? pin : pin << 16;
+        hsd->shadow ^= 1 << s;
+    }
+}
+
+// write a gathered commit, one store per port
+static void hsd_commit(hsd_commit_t* c) {
+    for (uint8_t p = 0; p < c->count; p++) {
+        c->ports[p]->BSRR = c->bsrr[p];
+    }
+}
+
 // init
 void hsd_init() {
     // assume MX_Init was successful and configures correctly
-    hsd_update_state(&hsd_5x);
-    hsd_update_state(&hsd_12x);
+    for (size_t i = 0; i < hsd_chip_count; i++) {
+        hsd_init_layout(&hsdtab[i]);
+        hsd_write_all(&hsdtab[i]);
+    }
 }
 
 // update state for a given hsd, given current configuration
+// only pins that differ from the shadow are written, one BSRR store per port
 void hsd_update_state(hsd_t* hsd) {
-    HAL_GPIO_WritePin(hsd->config.dia_en_port, hsd->config.dia_en_pin, hsd->dia_state.dia_en ? GPIO_PIN_SET : GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(hsd->config.latch_port, hsd->config.latch_pin, hsd->dia_state.latch ? GPIO_PIN_SET : GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(hsd->config.sel1_port, hsd->config.sel1_pin, hsd->dia_state.sel1 ? GPIO_PIN_SET : GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(hsd->config.sel2_port, hsd->config.sel2_pin, hsd->dia_state.sel2 ? GPIO_PIN_SET : GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(hsd->config.en1_port, hsd->config.en1_pin, hsd->en1 ? GPIO_PIN_SET : GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(hsd->config.en2_port, hsd->config.en2_pin, hsd->en2 ? GPIO_PIN_SET : GPIO_PIN_RESET);
+    // shadow and pins must change together, an interrupt may update the same hsd
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    hsd_commit_t c;
+    c.count = 0;
+    hsd_gather(hsd, &c);
+    hsd_commit(&c);
+    __set_PRIMASK(primask);
 }
 
-data_field_t success = {.length=1, .data={0,0,0,0,0,0,0,0}};
-// input: 1 byte (1 or 0), output: 1 byte (0)
-data_field_t* hsd_120_ioctl(data_field_t* cmd) {
-    if (cmd == NULL) return NULL;
-    if (cmd->length < 1) return NULL;
-    if (cmd->data[0]) hsd_12x.en1 = 1; else hsd_12x.en1 = 0;
-    hsd_update_state(&hsd_12x);
-    return &success;
+// set one channel (index into hsd_channels)
+void hsd_set_channel(uint8_t ch, uint8_t value) {
+    if (ch >= hsd_channel_count) return;
+    hsd_t* hsd = &hsdtab[hsd_channels[ch].chip];
+    uint8_t bit = 1 << (HSD_SIG_EN1 + hsd_channels[ch].en);
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    hsd->state = value ? hsd->state | bit : hsd->state & ~bit;
+    hsd_commit_t c;
+    c.count = 0;
+    hsd_gather(hsd, &c);
+    hsd_commit(&c);
+    __set_PRIMASK(primask);
 }
-// input: 1 byte (1 or 0), output: 1 byte (0)
-data_field_t* hsd_121_ioctl(data_field_t* cmd) {
-    if (cmd == NULL) return NULL;
-    if (cmd->length < 1) return NULL;
-    if (cmd->data[0]) hsd_12x.en2 = 1; else hsd_12x.en2 = 0;
-    hsd_update_state(&hsd_12x);
-    return &success;
+
+// owner of enable pins handed to a timer, told about every block
+hsd_block_hook hsd_block_fire_hook;
+
+// set the block hook, NULL removes it
+void hsd_set_block_hook(hsd_block_hook hook) {
+    hsd_block_fire_hook = hook;
 }
 
-data_field_t hsd_12x_dia_data_field = {.length=1};
-// input: 4 bytes (hsd_dia_options_t), output: 4 bytes (0 or 0xFF or ADC reading as a float)
-data_field_t* hsd_12x_dia_ioctl(data_field_t* cmd) {
-    if (cmd == NULL) return NULL;
-    if (cmd->length < 1) return NULL;
-hsd_dia_options_t hdo = *((hsd_dia_options_t*) &cmd->data);
-    switch ((int) hdo) {
-        case HSDD_DIA_OFF:
-            hsd_12x.dia_state.dia_en = 0;
-            hsd_12x.dia_state.latch = 0;
-            hsd_12x.dia_state.sel1 = 0;
-            hsd_12x.dia_state.sel2 = 0;
-            break;
-        case HSDD_I_CH1:
-            hsd_12x.dia_state.dia_en = 1;
-            hsd_12x.dia_state.latch = 0;
-            hsd_12x.dia_state.sel1 = 0;
-            hsd_12x.dia_state.sel2 = 0;
-            break;
-        case HSDD_I_CH2:
-            hsd_12x.dia_state.dia_en = 1;
-            hsd_12x.dia_state.latch = 0;
-            hsd_12x.dia_state.sel1 = 0;
-            hsd_12x.dia_state.sel2 = 1;
-            break;
-        case HSDD_TEMP:
-            hsd_12x.dia_state.dia_en = 0;
-            hsd_12x.dia_state.latch = 0;
-            hsd_12x.dia_state.sel1 = 1;
-            hsd_12x.dia_state.sel2 = 0;
-            break;
-        case HSDD_LATCH:
-            hsd_12x.dia_state.dia_en = 0;
-            hsd_12x.dia_state.latch = 1;
-            hsd_12x.dia_state.sel1 = 0;
-            hsd_12x.dia_state.sel2 = 0;
-            break;
-        case HSDD_READ:
-            // TODO: add read functionality
-            break;
-        default:
-            hsd_12x_dia_data_field.data[0] = 0xFF;
-            return &hsd_12x_dia_data_field;
-            break;
+// hold a channel off regardless of its state (or release it), used by the overcurrent guard
+void hsd_block_channel(uint8_t ch, uint8_t blocked) {
+    if (ch >= hsd_channel_count) return;
+    hsd_t* hsd = &hsdtab[hsd_channels[ch].chip];
+    uint8_t bit = 1 << (HSD_SIG_EN1 + hsd_channels[ch].en);
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    hsd->block = blocked ? hsd->block | bit : hsd->block & ~bit;
+    hsd_commit_t c;
+    c.count = 0;
+    hsd_gather(hsd, &c);
+    hsd_commit(&c);
+    if (hsd_block_fire_hook) hsd_block_fire_hook(hsd_channels[ch].id, blocked);
+    __set_PRIMASK(primask);
+}
+
+// set the channels selected by mask to values (bit n is hsd_channels[n])
+// all changed pins of a port are written with one BSRR store, across chips
+void hsd_set_channels(uint32_t mask, uint32_t values) {
+    uint32_t chips = 0;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t m = mask & ((hsd_channel_count < 32 ? 1u << hsd_channel_count : 0) - 1);
+    while (m) {
+        uint8_t ch = __builtin_ctz(m);
+        m &= m - 1;
+        hsd_t* hsd = &hsdtab[hsd_channels[ch].chip];
+        uint8_t bit = 1 << (HSD_SIG_EN1 + hsd_channels[ch].en);
+        hsd->state = (values >> ch) & 1 ? hsd->state | bit : hsd->state & ~bit;
+        chips |= 1 << hsd_channels[ch].chip;
+    }
+
+    hsd_commit_t c;
+    c.count = 0;
+    while (chips) {
+        uint8_t chip = __builtin_ctz(chips);
+        chips &= chips - 1;
+        hsd_gather(&hsdtab[chip], &c);
     }
-    hsd_update_state(&hsd_12x);
-    hsd_12x_dia_data_field.data[0] = 0x00;
-    return &hsd_12x_dia_data_field;
+    hsd_commit(&c);
+    __set_PRIMASK(primask);
 }
 
-// input: 1 byte (1 or 0), output: 1 byte (0)
-data_field_t* hsd_50_ioctl(data_field_t* cmd) {
-    if (cmd == NULL) return NULL;
-    if (cmd->length < 1) return NULL;
-    if (cmd->data[0]) hsd_5x.en1 = 1; else hsd_5x.en1 = 0;
-    hsd_update_state(&hsd_5x);
-    return &success;
+// switch the diagnostic mux of a chip without changing its selection, used by the sequencer
+// returns 0 on success, 0xFF for an unknown option
+uint8_t hsd_set_mux(uint8_t chip, hsd_dia_options_t option) {
+    if (chip >= hsd_chip_count) return 0xFF;
+
+    for (size_t i = 0; i < sizeof(hsd_dia_muxes) / sizeof(hsd_dia_muxes[0]); i++) {
+        if (hsd_dia_muxes[i].option != option) continue;
+        hsd_t* hsd = &hsdtab[chip];
+        if ((hsd->state & HSD_DIA_MASK) == hsd_dia_muxes[i].state) return 0; // unchanged, stays watched
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        hsd_guard_disarm(chip); // the sequencer re-arms after its own switch
+        hsd->state = (hsd->state & ~HSD_DIA_MASK) | hsd_dia_muxes[i].state;
+        __set_PRIMASK(primask);
+        hsd_update_state(hsd);
+        return 0;
+    }
+    return 0xFF;
 }
-// input: 1 byte (1 or 0), output: 1 byte (0)
-data_field_t* hsd_51_ioctl(data_field_t* cmd) {
-    if (cmd == NULL) return NULL;
-    if (cmd->length < 1) return NULL;
-    if (cmd->data[0]) hsd_5x.en2 = 1; else hsd_5x.en2 = 0;
-    hsd_update_state(&hsd_5x);
-    return &success;
+
+// select the diagnostic option of a chip, HSDD_AUTO hands the mux to the sense sequencer
+// returns 0 on success, 0xFF for an unknown option
+uint8_t hsd_set_dia(uint8_t chip, hsd_dia_options_t option) {
+    if (chip >= hsd_chip_count) return 0xFF;
+    if (option == HSDD_AUTO) {
+        hsdtab[chip].dia = HSDD_AUTO; // the sequencer switches the mux on its next step
+        return 0;
+    }
+    if (hsd_set_mux(chip, option)) return 0xFF;
+    hsdtab[chip].dia = option;
+    return 0;
 }
 
-data_field_t hsd_5x_dia_data_field = {.length=1};
-// input: 4 bytes (hsd_dia_options_t), output: 4 bytes (0 or 0xFF or ADC reading as a float)
-data_field_t* hsd_5x_dia_ioctl(data_field_t* cmd) {
-    if (cmd == NULL) return NULL;
-    if (cmd->length < 1) return NULL;
-hsd_dia_options_t hdo = *((hsd_dia_options_t*) &cmd->data);
-    switch ((int) hdo) {
-        case HSDD_DIA_OFF:
-            hsd_5x.dia_state.dia_en = 0;
-            hsd_5x.dia_state.latch = 0;
-            hsd_5x.dia_state.sel1 = 0;
-            hsd_5x.dia_state.sel2 = 0;
-            break;
-        case HSDD_I_CH1:
-            hsd_5x.dia_state.dia_en = 1;
-            hsd_5x.dia_state.latch = 0;
-            hsd_5x.dia_state.sel1 = 0;
-            hsd_5x.dia_state.sel2 = 0;
-            break;
-        case HSDD_I_CH2:
-            hsd_5x.dia_state.dia_en = 1;
-            hsd_5x.dia_state.latch = 0;
-            hsd_5x.dia_state.sel1 = 0;
-            hsd_5x.dia_state.sel2 = 1;
-            break;
-        case HSDD_TEMP:
-            hsd_5x.dia_state.dia_en = 0;
-            hsd_5x.dia_state.latch = 0;
-            hsd_5x.dia_state.sel1 = 1;
-            hsd_5x.dia_state.sel2 = 0;
-            break;
-        case HSDD_LATCH:
-            hsd_5x.dia_state.dia_en = 0;
-            hsd_5x.dia_state.latch = 1;
-            hsd_5x.dia_state.sel1 = 0;
-            hsd_5x.dia_state.sel2 = 0;
-            break;
-        case HSDD_READ:
-            // TODO: add read functionality
-            break;
-        default:
-            hsd_5x_dia_data_field.data[0] = 0xFF;
-            return &hsd_5x_dia_data_field;
-            break;
+// answer HSDD_READ from the sense cache, no conversion is started here
+static data_field_t* hsd_dia_read(uint8_t chip, data_field_t* cmd, data_field_t* res) {
+    hsd_dia_options_t option = cmd->length >= 2 && cmd->data[1] ? cmd->data[1] : hsdtab[chip].dia;
+    hsd_sense_sample_t sample = {.tick = 0};
+    if (option == HSDD_AUTO) {
+        // the sequencer owns the mux, answer with its newest sample
+        for (uint8_t o = HSDD_DIA_OFF + 1; o < HSD_SENSE_OPTIONS; o++) {
+            hsd_sense_sample_t s;
+            if (hsd_sense_get(chip, o, &s) == 0 && s.tick > sample.tick) {
+                sample = s;
+                option = o;
+            }
+        }
+    } else {
+        hsd_sense_get(chip, option, &sample);
     }
-    hsd_update_state(&hsd_5x);
-    hsd_5x_dia_data_field.data[0] = 0x00;
-    return &hsd_5x_dia_data_field;
-}
\ No newline at end of file
+    if (sample.tick == 0) {
+        res->length = 1;
+        res->data[0] = 0xFF;
+        return res;
+    }
+    *((float*) res->data) = hsd_sense_to_volts(sample.raw);
+    res->data[4] = option;
+    res->length = 5;
+    return res;
+}
+
+data_field_t success = {.length=1, .data={0,0,0,0,0,0,0,0}};
+
+// enable channel device: set fast path, ioctls and descriptor for an HSD_CHANNEL_LIST entry
+#define HSD_CHANNEL_DEVICE(dev, id_, chip_, en_) \
+    void hsd_##dev##_set(uint8_t value) { \
+        hsd_set_channel(HSD_CH_##dev, value); \
+    } \
+    data_field_t* hsd_##dev##_ioctl_r(data_field_t* cmd, data_field_t* res) { \
+        if (cmd == NULL) return NULL; \
+        if (cmd->length < 1) return NULL; \
+        hsd_set_channel(HSD_CH_##dev, cmd->data[0]); \
+        res->length = 1; \
+        res->data[0] = 0; \
+        return res; \
+    } \
+    data_field_t* hsd_##dev##_ioctl(data_field_t* cmd) { \
+        return hsd_##dev##_ioctl_r(cmd, &success); \
+    } \
+    DEV_STATIC(hsd_##dev##_dev, id_) = { \
+        .id = (id_), \
+        .name = "HSD_" #dev, \
+        .ioctl = hsd_##dev##_ioctl, \
+        .set = hsd_##dev##_set, \
+        .ioctl_r = hsd_##dev##_ioctl_r, \
+        .flags = DEV_FLAG_REENTRANT | DEV_FLAG_INLINE \
+    };
+
+// diagnostics device for chip
+#define HSD_DIA_DEVICE(dev, id_, chip) \
+    data_field_t hsd_##dev##_dia_data_field = {.length=1}; \
+    data_field_t* hsd_##dev##_dia_ioctl_r(data_field_t* cmd, data_field_t* res) { \
+        if (cmd == NULL) return NULL; \
+        if (cmd->length < 1) return NULL; \
+        if (cmd->data[0] == HSDD_READ) return hsd_dia_read((chip), cmd, res); \
+        if (cmd->data[0] == HSDD_GUARD) return hsd_guard_ioctl_r((chip), cmd, res); \
+        res->length = 1; \
+        res->data[0] = hsd_set_dia((chip), cmd->data[0]); \
+        return res; \
+    } \
+    data_field_t* hsd_##dev##_dia_ioctl(data_field_t* cmd) { \
+        return hsd_##dev##_dia_ioctl_r(cmd, &hsd_##dev##_dia_data_field); \
+    } \
+    DEV_STATIC(hsd_##dev##_dia_dev, id_) = { \
+        .id = (id_), \
+        .name = "HSD_" #dev " diagnostics", \
+        .ioctl = hsd_##dev##_dia_ioctl, \
+        .ioctl_r = hsd_##dev##_dia_ioctl_r, \
+        .flags = DEV_FLAG_REENTRANT | DEV_FLAG_INLINE /* reads come from the sense cache */ \
+    };
+
+HSD_CHANNEL_LIST(HSD_CHANNEL_DEVICE)
+HSD_DIA_DEVICE(12x, HSD_12X_DIA_ID, HSD_12X)
+HSD_DIA_DEVICE(5x, HSD_5X_DIA_ID, HSD_5X)
+
+DEV_STATIC(hsd_bulk_dev, HSD_BULK_ID) = {
+    .id = HSD_BULK_ID,
+    .name = "HSD bulk",
+    .ioctl = hsd_bulk_ioctl,
+    .ioctl_r = hsd_bulk_ioctl_r,
+    .flags = DEV_FLAG_REENTRANT | DEV_FLAG_INLINE
+};
+
+// input: 4-byte channel mask, 4-byte values (bit n is hsd_channels[n]), output: 1 byte (0)
+data_field_t* hsd_bulk_ioctl(data_field_t* cmd) {
+    return hsd_bulk_ioctl_r(cmd, &success);
+}
+data_field_t* hsd_bulk_ioctl_r(data_field_t* cmd, data_field_t* res) {
+    if (cmd == NULL) return NULL;
+    if (cmd->length < 8) return NULL;
+    hsd_set_channels(((uint32_t*) cmd->data)[0], ((uint32_t*) cmd->data)[1]);
+    res->length = 1;
+    res->data[0] = 0;
+    return res;
+}
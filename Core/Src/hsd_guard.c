@@ -0,0 +1,212 @@
+#include "hsd_guard.h"
+#include "hsd_sense.h"
+
+ADC_HandleTypeDef* hsd_guard_adc;
+
+hsd_guard_channel_t hsd_guard_channels[HSD_GUARD_MAX_CHANNELS];
+uint8_t hsd_guard_chips;
+
+// channel shown by each current option of a chip, -1 if none
+int8_t hsd_guard_map[HSD_GUARD_CHIPS][2];
+
+// watchdog of each guarded chip
+typedef struct hsd_guard_awd {
+    __IO uint32_t* cr; // monitored channels
+    __IO uint32_t* tr; // thresholds
+    uint32_t flag;
+} hsd_guard_awd_t;
+
+hsd_guard_awd_t hsd_guard_awds[HSD_GUARD_CHIPS];
+
+// channel each watchdog was armed for, -1 if none; a trip is only acted on
+// while the mux still shows that channel
+volatile int8_t hsd_guard_armed[HSD_GUARD_CHIPS];
+
+// set up the watchdog interrupt, called by hsd_sense_init once ADC1 is configured
+void hsd_guard_init(ADC_HandleTypeDef* adc) {
+    hsd_guard_adc = adc;
+    hsd_guard_chips = hsd_chip_count < HSD_GUARD_CHIPS ? hsd_chip_count : HSD_GUARD_CHIPS;
+    hsd_guard_awds[0] = (hsd_guard_awd_t) {.cr = &adc->Instance->AWD2CR, .tr = &adc->Instance->TR2, .flag = ADC_FLAG_AWD2};
+    hsd_guard_awds[1] = (hsd_guard_awd_t) {.cr = &adc->Instance->AWD3CR, .tr = &adc->Instance->TR3, .flag = ADC_FLAG_AWD3};
+
+    for (uint8_t chip = 0; chip < HSD_GUARD_CHIPS; chip++) {
+        hsd_guard_map[chip][0] = -1;
+        hsd_guard_map[chip][1] = -1;
+        hsd_guard_armed[chip] = -1;
+        *hsd_guard_awds[chip].cr = 0;
+    }
+    for (size_t ch = 0; ch < hsd_channel_count && ch < HSD_GUARD_MAX_CHANNELS; ch++) {
+        hsd_guard_channels[ch] = (hsd_guard_channel_t) {.threshold = HSD_GUARD_DEFAULT_THRESHOLD};
+        if (hsd_channels[ch].chip < hsd_guard_chips) hsd_guard_map[hsd_channels[ch].chip][hsd_channels[ch].en] = ch;
+    }
+
+    __HAL_ADC_CLEAR_FLAG(adc, ADC_FLAG_AWD2 | ADC_FLAG_AWD3);
+    __HAL_ADC_ENABLE_IT(adc, ADC_IT_AWD2 | ADC_IT_AWD3);
+    HAL_NVIC_SetPriority(ADC1_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(ADC1_IRQn);
+}
+
+// channel the mux of a chip currently shows, else -1
+static int8_t hsd_guard_shown(uint8_t chip) {
+    hsd_dia_options_t option = hsd_sense_option(chip);
+    if (option != HSDD_I_CH1 && option != HSDD_I_CH2) return -1;
+    return hsd_guard_map[chip][option - HSDD_I_CH1];
+}
+
+// point the watchdogs at the settled chips (bit n is hsdtab[n]) whose mux shows a
+// guarded current, ADC1 must be idle
+void hsd_guard_arm(uint32_t settled) {
+    if (hsd_guard_adc == NULL) return;
+    for (uint8_t chip = 0; chip < hsd_guard_chips; chip++) {
+        hsd_guard_awd_t* awd = &hsd_guard_awds[chip];
+        int8_t ch = settled >> chip & 1 ? hsd_guard_shown(chip) : -1;
+        if (ch < 0 || hsd_guard_channels[ch].state != HGS_OK || hsd_guard_channels[ch].threshold == 0) {
+            hsd_guard_armed[chip] = -1;
+            *awd->cr = 0;
+            continue;
+        }
+        // watchdogs 2 and 3 compare the 8 most significant bits of the result, high threshold only
+        *awd->tr = (uint32_t) (hsd_guard_channels[ch].threshold >> 4) << 16;
+        *awd->cr = 1u << __LL_ADC_CHANNEL_TO_DECIMAL_NB(hsdtab[chip].config.sns_channel);
+        __HAL_ADC_CLEAR_FLAG(hsd_guard_adc, awd->flag);
+        __HAL_ADC_ENABLE_IT(hsd_guard_adc, awd->flag);
+        hsd_guard_armed[chip] = ch;
+    }
+}
+
+// 1 if a watchdog is armed, the sense sequencer converts continuously between scans
+uint8_t hsd_guard_watching() {
+    for (uint8_t chip = 0; chip < hsd_guard_chips; chip++) {
+        if (hsd_guard_armed[chip] >= 0) return 1;
+    }
+    return 0;
+}
+
+// the mux of a chip is about to change outside the sequencer, from any context
+// the watchdog register can only be rewritten with ADC1 idle, so its trips are
+// ignored until the next hsd_guard_arm, and its interrupt is masked so the
+// continuous conversions do not raise it on every reading
+void hsd_guard_disarm(uint8_t chip) {
+    if (chip >= hsd_guard_chips) return;
+    hsd_guard_armed[chip] = -1;
+    __HAL_ADC_DISABLE_IT(hsd_guard_adc, hsd_guard_awds[chip].flag);
+}
+
+// backoff before retry n (1 based)
+static core_ticks_t hsd_guard_backoff(uint8_t retries) {
+    uint32_t ms = HSD_GUARD_RETRY_MS << (retries - 1);
+    return CORE_MS_TO_TICKS(ms < HSD_GUARD_RETRY_MAX_MS ? ms : HSD_GUARD_RETRY_MAX_MS);
+}
+
+// cut the channel the watchdog of a chip was armed for
+static void hsd_guard_trip(uint8_t chip) {
+    int8_t ch = hsd_guard_armed[chip];
+    if (ch < 0) return; // disarmed by a mux change, the reading is not that current
+    hsd_guard_channel_t* g = &hsd_guard_channels[ch];
+    if (g->state != HGS_OK) return; // already off, a faulted driver keeps SNS high
+
+    hsd_block_channel(ch, 1);
+    hsd_guard_disarm(chip); // SNS stays high for a while, every conversion would trip again
+
+    core_tick_t now = core_get_tick();
+    core_ticks_t latency = now - hsd_sense_scan_start();
+    if (latency > g->latency) g->latency = latency;
+    ++g->trips;
+    if (++g->retries > HSD_GUARD_MAX_RETRIES) {
+        g->state = HGS_LATCHED;
+        ++g->latches;
+    } else {
+        g->state = HGS_BACKOFF;
+        g->retry_at = now + hsd_guard_backoff(g->retries);
+    }
+}
+
+// ADC1 interrupt, cuts a tripped channel with one BSRR store
+void hsd_guard_irq_handler() {
+    for (uint8_t chip = 0; chip < hsd_guard_chips; chip++) {
+        if (!__HAL_ADC_GET_FLAG(hsd_guard_adc, hsd_guard_awds[chip].flag)) continue;
+        __HAL_ADC_CLEAR_FLAG(hsd_guard_adc, hsd_guard_awds[chip].flag);
+        hsd_guard_trip(chip);
+    }
+
+    // overrun and the other HAL events
+    if (hsd_guard_adc->Instance->ISR & hsd_guard_adc->Instance->IER & ~(ADC_FLAG_AWD2 | ADC_FLAG_AWD3)) {
+        HAL_ADC_IRQHandler(hsd_guard_adc);
+    }
+}
+
+// release channels whose backoff ran out, called on every sense step
+void hsd_guard_poll(core_tick_t now) {
+    for (size_t ch = 0; ch < hsd_channel_count && ch < HSD_GUARD_MAX_CHANNELS; ch++) {
+        hsd_guard_channel_t* g = &hsd_guard_channels[ch];
+        if (g->state == HGS_BACKOFF && (int64_t) (now - g->retry_at) >= 0) {
+            g->state = HGS_OK;
+            g->since = now;
+            hsd_block_channel(ch, 0);
+        } else if (g->state == HGS_OK && g->retries && now - g->since >= CORE_MS_TO_TICKS(HSD_GUARD_HEALTHY_MS)) {
+            g->retries = 0;
+        }
+    }
+}
+
+// guard of a channel (index into hsd_channels), else NULL
+const hsd_guard_channel_t* hsd_guard_get(uint8_t ch) {
+    if (ch >= hsd_channel_count || ch >= HSD_GUARD_MAX_CHANNELS) return NULL;
+    return &hsd_guard_channels[ch];
+}
+
+// guard ioctl of a chip, called by its diagnostics device
+// input: HSDD_GUARD, hsd_guard_ioctl_cmd_t, enable (0 or 1), (value, little endian)
+data_field_t* hsd_guard_ioctl_r(uint8_t chip, data_field_t* cmd, data_field_t* res) {
+    if (cmd->length < 3) return NULL;
+    if (chip >= hsd_guard_chips || cmd->data[2] > 1) return NULL;
+    int8_t ch = hsd_guard_map[chip][cmd->data[2]];
+    if (ch < 0) return NULL;
+    hsd_guard_channel_t* g = &hsd_guard_channels[ch];
+
+    // the watchdog interrupt and the sense task update the guard
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    switch (cmd->data[1]) {
+        case HGC_GET_STATE:
+            res->data[0] = g->state;
+            res->data[1] = g->retries;
+            res->length = 2;
+            break;
+        case HGC_GET_TRIPS:
+            *((uint32_t*) res->data) = g->trips;
+            res->length = 4;
+            break;
+        case HGC_GET_LATCHES:
+            *((uint32_t*) res->data) = g->latches;
+            res->length = 4;
+            break;
+        case HGC_GET_LATENCY:
+            *((uint32_t*) res->data) = g->latency;
+            res->length = 4;
+            break;
+        case HGC_SET_THRESHOLD:
+            if (cmd->length < 5) {
+                res = NULL;
+                break;
+            }
+            // applies when the watchdog is armed for the next scan
+            g->threshold = cmd->data[3] | (cmd->data[4] << 8);
+            res->data[0] = 0;
+            res->length = 1;
+            break;
+        case HGC_CLEAR:
+            g->state = HGS_OK;
+            g->retries = 0;
+            g->since = core_get_tick();
+            hsd_block_channel(ch, 0);
+            res->data[0] = 0;
+            res->length = 1;
+            break;
+        default:
+            res = NULL;
+            break;
+    }
+    __set_PRIMASK(primask);
+    return res;
+}
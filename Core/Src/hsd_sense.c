@@ -0,0 +1,243 @@
+#include "hsd_sense.h"
+#include "hsd_guard.h"
+
+ADC_HandleTypeDef* hsd_sense_adc;
+DMA_HandleTypeDef hsd_sense_dma;
+
+hsd_sense_sample_t hsd_sense_cache[HSD_SENSE_MAX_CHIPS][HSD_SENSE_OPTIONS];
+hsd_sense_stats_t hsd_sense_stats;
+
+uint16_t hsd_sense_buf[HSD_SENSE_MAX_CHIPS]; // DMA target, rank n is hsdtab[n]
+uint8_t hsd_sense_options[HSD_SENSE_MAX_CHIPS]; // mux option each chip settles in
+uint8_t hsd_sense_mux[HSD_SENSE_MAX_CHIPS]; // mux state bits of each chip at the last step
+uint8_t hsd_sense_held[HSD_SENSE_MAX_CHIPS]; // steps the mux has not moved for
+uint8_t hsd_sense_current[HSD_SENSE_MAX_CHIPS]; // last current option of a chip in HSDD_AUTO
+volatile uint8_t hsd_sense_busy;
+uint8_t hsd_sense_watching; // continuous conversions for the guard between scans
+core_tick_t hsd_sense_started; // start of the last scan
+uint32_t hsd_sense_step;
+uint8_t hsd_sense_chips;
+int hsd_sense_task;
+
+static const uint32_t hsd_sense_ranks[HSD_SENSE_MAX_CHIPS] = {
+    ADC_REGULAR_RANK_1, ADC_REGULAR_RANK_2, ADC_REGULAR_RANK_3, ADC_REGULAR_RANK_4
+};
+
+// option of a chip in HSDD_AUTO for the next step: temperature every HSD_SENSE_TEMP_STEPS
+// steps, else the current of its enabled channel; with both channels (or neither) on,
+// each current is held HSD_SENSE_HOLD_STEPS settled scans in turn
+static uint8_t hsd_sense_auto(uint8_t chip) {
+    if (hsd_sense_step % HSD_SENSE_TEMP_STEPS == 0) return HSDD_TEMP;
+
+    hsd_t* hsd = &hsdtab[chip];
+    uint8_t on = (hsd->state & ~hsd->block) >> HSD_SIG_EN1 & 3;
+    if (on == 1) return HSDD_I_CH1;
+    if (on == 2) return HSDD_I_CH2;
+
+    uint8_t current = hsd_sense_current[chip] == HSDD_I_CH2 ? HSDD_I_CH2 : HSDD_I_CH1;
+    if (hsd_sense_options[chip] != current || hsd_sense_held[chip] < HSD_SENSE_HOLD_STEPS) return current;
+    return current == HSDD_I_CH1 ? HSDD_I_CH2 : HSDD_I_CH1;
+}
+
+// move every chip to the option of the next conversion
+// automatic chips take their next option, the others stay on their selection;
+// the guard watches the chips whose mux did not move, their reading has settled
+static void hsd_sense_select() {
+    uint32_t settled = 0;
+    for (uint8_t chip = 0; chip < hsd_sense_chips; chip++) {
+        uint8_t dia = hsdtab[chip].dia;
+        if (dia == HSDD_AUTO) {
+            dia = hsd_sense_auto(chip);
+            if (dia != HSDD_TEMP) hsd_sense_current[chip] = dia;
+            hsd_set_mux(chip, dia);
+        }
+        // a selection from CAN moves the mux between steps too
+        uint8_t mux = hsdtab[chip].state & HSD_DIA_MASK;
+        if (mux == hsd_sense_mux[chip]) {
+            settled |= 1u << chip;
+            if (hsd_sense_held[chip] < 0xFF) ++hsd_sense_held[chip];
+        } else {
+            hsd_sense_held[chip] = 0;
+        }
+        hsd_sense_mux[chip] = mux;
+        hsd_sense_options[chip] = dia;
+    }
+    hsd_guard_arm(settled);
+}
+
+// convert the SNS pins continuously until the next scan, so an armed watchdog
+// compares every conversion instead of one per step; nothing is read, the
+// conversions only feed the watchdogs, ADC1 must be idle
+static void hsd_sense_watch_start() {
+    if (!hsd_guard_watching()) return;
+    ADC_TypeDef* adc = hsd_sense_adc->Instance;
+    __HAL_ADC_DISABLE_IT(hsd_sense_adc, ADC_IT_OVR); // DR is never read
+    LL_ADC_REG_SetDMATransfer(adc, LL_ADC_REG_DMA_TRANSFER_NONE);
+    LL_ADC_REG_SetContinuousMode(adc, LL_ADC_REG_CONV_CONTINUOUS);
+    LL_ADC_REG_StartConversion(adc);
+    hsd_sense_watching = 1;
+}
+
+// stop the continuous conversions, the next scan starts from an idle ADC1
+static void hsd_sense_watch_stop() {
+    if (!hsd_sense_watching) return;
+    ADC_TypeDef* adc = hsd_sense_adc->Instance;
+    LL_ADC_REG_StopConversion(adc);
+    while (LL_ADC_REG_IsStopConversionOngoing(adc));
+    LL_ADC_REG_SetContinuousMode(adc, LL_ADC_REG_CONV_SINGLE);
+    hsd_sense_watching = 0;
+}
+
+// scheduler task, the mux had one period to settle
+static void hsd_sense_start() {
+    core_tick_t now = core_get_tick();
+    hsd_guard_poll(now);
+    if (hsd_sense_busy) {
+        ++hsd_sense_stats.skipped;
+        return;
+    }
+    hsd_sense_watch_stop();
+    hsd_sense_busy = 1;
+    hsd_sense_started = now;
+    if (HAL_ADC_Start_DMA(hsd_sense_adc, (uint32_t*) hsd_sense_buf, hsd_sense_chips) != HAL_OK) {
+        hsd_sense_busy = 0;
+        ++hsd_sense_stats.errors;
+    }
+}
+
+// scan done, from the DMA interrupt
+static void hsd_sense_complete() {
+    core_tick_t now = core_get_tick();
+    for (uint8_t chip = 0; chip < hsd_sense_chips; chip++) {
+        uint8_t option = hsd_sense_options[chip];
+        uint8_t dia = hsdtab[chip].dia;
+        // a selection made while settling is picked up with the next step
+        if (dia != HSDD_AUTO && dia != option) {
+            ++hsd_sense_stats.discarded;
+            continue;
+        }
+        if (option == HSDD_DIA_OFF || option >= HSD_SENSE_OPTIONS) continue;
+        hsd_sense_cache[chip][option] = (hsd_sense_sample_t) {.raw = hsd_sense_buf[chip], .tick = now};
+    }
+    ++hsd_sense_stats.conversions;
+
+    ++hsd_sense_step;
+    hsd_sense_select();
+    hsd_sense_busy = 0;
+    hsd_sense_watch_start();
+}
+
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef* hadc) {
+    if (hadc != hsd_sense_adc) return;
+    hsd_sense_complete();
+}
+
+void HAL_ADC_ErrorCallback(ADC_HandleTypeDef* hadc) {
+    if (hadc != hsd_sense_adc) return;
+    ++hsd_sense_stats.errors;
+    hsd_sense_busy = 0;
+}
+
+// GPDMA1 channel 0 moves one halfword per rank, normal mode, restarted for every scan
+static void hsd_sense_dma_init(ADC_HandleTypeDef* adc) {
+    __HAL_RCC_GPDMA1_CLK_ENABLE();
+
+    hsd_sense_dma.Instance = GPDMA1_Channel0;
+    hsd_sense_dma.Init.Request = GPDMA1_REQUEST_ADC1;
+    hsd_sense_dma.Init.BlkHWRequest = DMA_BREQ_SINGLE_BURST;
+    hsd_sense_dma.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hsd_sense_dma.Init.SrcInc = DMA_SINC_FIXED;
+    hsd_sense_dma.Init.DestInc = DMA_DINC_INCREMENTED;
+    hsd_sense_dma.Init.SrcDataWidth = DMA_SRC_DATAWIDTH_HALFWORD;
+    hsd_sense_dma.Init.DestDataWidth = DMA_DEST_DATAWIDTH_HALFWORD;
+    hsd_sense_dma.Init.Priority = DMA_LOW_PRIORITY_HIGH_WEIGHT;
+    hsd_sense_dma.Init.SrcBurstLength = 1;
+    hsd_sense_dma.Init.DestBurstLength = 1;
+    hsd_sense_dma.Init.TransferAllocatedPort = DMA_SRC_ALLOCATED_PORT0 | DMA_DEST_ALLOCATED_PORT0;
+    hsd_sense_dma.Init.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
+    hsd_sense_dma.Init.Mode = DMA_NORMAL;
+    if (HAL_DMA_Init(&hsd_sense_dma) != HAL_OK) Error_Handler();
+    if (HAL_DMA_ConfigChannelAttributes(&hsd_sense_dma, DMA_CHANNEL_NPRIV) != HAL_OK) Error_Handler();
+    __HAL_LINKDMA(adc, DMA_Handle, hsd_sense_dma);
+
+    HAL_NVIC_SetPriority(GPDMA1_Channel0_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(GPDMA1_Channel0_IRQn);
+}
+
+// take over ADC1 with DMA, one scan rank per chip, and start the sequencer
+void hsd_sense_init(ADC_HandleTypeDef* adc) {
+    hsd_sense_adc = adc;
+    hsd_sense_chips = hsd_chip_count < HSD_SENSE_MAX_CHIPS ? hsd_chip_count : HSD_SENSE_MAX_CHIPS;
+    hsd_sense_busy = 0;
+    hsd_sense_watching = 0;
+    hsd_sense_step = 1; // temperature comes around after the currents
+    hsd_sense_stats = (hsd_sense_stats_t) {0};
+
+    // MX_ADC1_Init sets up one continuous channel, replace it with a single scan of the SNS pins
+    // hardware oversampling averages 16 conversions per rank, the DMA still moves one word per chip
+    adc->Init.ScanConvMode = ADC_SCAN_ENABLE;
+    adc->Init.ContinuousConvMode = DISABLE;
+    adc->Init.NbrOfConversion = hsd_sense_chips;
+    adc->Init.EOCSelection = ADC_EOC_SEQ_CONV;
+    adc->Init.DMAContinuousRequests = DISABLE;
+    adc->Init.Overrun = ADC_OVR_DATA_OVERWRITTEN;
+    adc->Init.OversamplingMode = ENABLE;
+    adc->Init.Oversampling.Ratio = ADC_OVERSAMPLING_RATIO_16;
+    adc->Init.Oversampling.RightBitShift = ADC_RIGHTBITSHIFT_4;
+    adc->Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
+    adc->Init.Oversampling.OversamplingStopReset = ADC_REGOVERSAMPLING_CONTINUED_MODE;
+    if (HAL_ADC_Init(adc) != HAL_OK) Error_Handler();
+
+    for (uint8_t chip = 0; chip < hsd_sense_chips; chip++) {
+        ADC_ChannelConfTypeDef conf = {
+            .Channel = hsdtab[chip].config.sns_channel,
+            .Rank = hsd_sense_ranks[chip],
+            .SamplingTime = ADC_SAMPLETIME_47CYCLES_5, // SNS is a high impedance source
+            .SingleDiff = ADC_SINGLE_ENDED,
+            .OffsetNumber = ADC_OFFSET_NONE,
+            .Offset = 0
+        };
+        if (HAL_ADC_ConfigChannel(adc, &conf) != HAL_OK) Error_Handler();
+    }
+    if (HAL_ADCEx_Calibration_Start(adc, ADC_SINGLE_ENDED) != HAL_OK) Error_Handler();
+
+    hsd_sense_dma_init(adc);
+    hsd_guard_init(adc);
+
+    hsd_sense_select();
+    hsd_sense_task = sched_add("hsd sense", hsd_sense_start, SCHED_US(HSD_SENSE_SETTLE_US), SCHED_US(HSD_SENSE_SETTLE_US), 3);
+    if (hsd_sense_task < 0) Error_Handler();
+}
+
+// latest sample of a chip for an option, returns 0 on success, 1 if there is none
+uint8_t hsd_sense_get(uint8_t chip, hsd_dia_options_t option, hsd_sense_sample_t* sample) {
+    if (chip >= hsd_sense_chips) return 1;
+    if (option == HSDD_DIA_OFF || option >= HSD_SENSE_OPTIONS) return 1;
+
+    // the DMA interrupt writes the cache
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *sample = hsd_sense_cache[chip][option];
+    __set_PRIMASK(primask);
+    return sample->tick == 0;
+}
+
+// mux option of a chip during the running or next scan
+hsd_dia_options_t hsd_sense_option(uint8_t chip) {
+    if (chip >= hsd_sense_chips) return HSDD_DIA_OFF;
+    return hsd_sense_options[chip];
+}
+
+// core tick of the last scan start
+core_tick_t hsd_sense_scan_start() {
+    return hsd_sense_started;
+}
+
+// SNS pin voltage of a sample
+float hsd_sense_to_volts(uint16_t raw) {
+    return raw * (HSD_SENSE_VREF_MV / 1000.0f / HSD_SENSE_FULL_SCALE);
+}
+
+const hsd_sense_stats_t* hsd_sense_get_stats() {
+    return &hsd_sense_stats;
+}
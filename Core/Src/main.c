@@ -121,7 +121,7 @@ int main(void)
   MX_ICACHE_Init();
   /* USER CODE BEGIN 2 */
 
-  core_init(&htim6, &htim2, &htim7, &hfdcan1);
+  core_init(&htim2, &htim7, &hfdcan1, &hadc1);
 
   /* USER CODE END 2 */
 
@@ -129,7 +129,7 @@ int main(void)
   /* USER CODE BEGIN WHILE */
   while (1)
   {
-    HAL_Delay(60);
+    core_background_loop();
     // simulate tdc callback
     // timing_tdc_callback();
     /* USER CODE END WHILE */
@@ -0,0 +1,129 @@
+#include "monitor.h"
+
+monitor_stats_t monitor_stats[MON_SLOTS];
+
+// CPU load from the time the main loop spends in WFI
+uint32_t monitor_idle_cycles; // idle in the current window
+uint32_t monitor_window_start;
+uint16_t monitor_load; // last window, 1/1000
+uint16_t monitor_load_peak;
+
+// clear all stats, budgets are kept
+void monitor_init() {
+    for (int i = 0; i < MON_SLOTS; i++) {
+        uint32_t budget = monitor_stats[i].budget;
+        monitor_stats[i] = (monitor_stats_t) {.budget = budget};
+    }
+    monitor_idle_cycles = 0;
+    monitor_window_start = CORE_CYCLES();
+    monitor_load = 0;
+    monitor_load_peak = 0;
+}
+
+// set the cycle budget of a slot, runs above it count as overruns
+void monitor_set_budget(monitor_slot_t slot, uint32_t cycles) {
+    if (slot >= MON_SLOTS) return;
+    monitor_stats[slot].budget = cycles;
+}
+
+// record one run
+void monitor_record(monitor_slot_t slot, uint32_t cycles) {
+    if (slot >= MON_SLOTS) return;
+    monitor_stats_t* st = &monitor_stats[slot];
+
+    if (st->count == 0) st->avg_q = cycles << MONITOR_EMA_SHIFT;
+    else st->avg_q += cycles - (st->avg_q >> MONITOR_EMA_SHIFT);
+    ++st->count;
+    if (cycles > st->wcet) st->wcet = cycles;
+    if (st->budget && cycles > st->budget) ++st->overruns;
+}
+
+// record one interrupt, also counts interrupts left pending behind it
+// (all interrupts share one priority, so a pending one waited for this one)
+void monitor_record_isr(monitor_slot_t slot, uint32_t cycles) {
+    monitor_record(slot, cycles);
+    if (slot < MON_SLOTS && (SCB->ICSR & SCB_ICSR_ISRPENDING_Msk)) ++monitor_stats[slot].stacked;
+}
+
+// record time spent sleeping in the main loop
+void monitor_record_idle(uint32_t cycles) {
+    monitor_idle_cycles += cycles;
+}
+
+// close the load window, called periodically
+void monitor_update_load() {
+    uint32_t now = CORE_CYCLES();
+    uint32_t window = now - monitor_window_start;
+    if (window == 0) return;
+
+    uint32_t idle = monitor_idle_cycles;
+    if (idle > window) idle = window;
+    monitor_load = 1000 - (uint16_t) ((uint64_t) idle * 1000 / window);
+    if (monitor_load > monitor_load_peak) monitor_load_peak = monitor_load;
+
+    monitor_idle_cycles = 0;
+    monitor_window_start = now;
+}
+
+// get stats of a slot, else NULL
+const monitor_stats_t* monitor_get(monitor_slot_t slot) {
+    if (slot >= MON_SLOTS) return NULL;
+    return &monitor_stats[slot];
+}
+
+DEV_STATIC(monitor_dev, MONITOR_DEVICE_ID) = {
+    .id = MONITOR_DEVICE_ID,
+    .name = "monitor",
+    .ioctl = monitor_ioctl,
+    .ioctl_r = monitor_ioctl_r
+};
+
+data_field_t monitor_data_field = {.length=0};
+data_field_t* monitor_ioctl(data_field_t* cmd) {
+    return monitor_ioctl_r(cmd, &monitor_data_field);
+}
+data_field_t* monitor_ioctl_r(data_field_t* cmd, data_field_t* res) {
+    if (cmd == NULL) return NULL;
+    if (cmd->length < 1) return NULL;
+
+    switch (cmd->data[0]) {
+        case MNC_GET_LOAD:
+            ((uint16_t*) res->data)[0] = monitor_load;
+            ((uint16_t*) res->data)[1] = monitor_load_peak;
+            res->length = 4;
+            return res;
+        case MNC_RESET:
+            monitor_init();
+            res->length = 1;
+            res->data[0] = 0;
+            return res;
+        default:
+            break;
+    }
+
+    if (cmd->length < 2) return NULL;
+    const monitor_stats_t* st = monitor_get(cmd->data[1]);
+    if (st == NULL) return NULL;
+
+    switch (cmd->data[0]) {
+        case MNC_GET_COUNT:
+            *((uint32_t*) res->data) = st->count;
+            break;
+        case MNC_GET_WCET:
+            *((uint32_t*) res->data) = st->wcet;
+            break;
+        case MNC_GET_AVG:
+            *((uint32_t*) res->data) = st->avg_q >> MONITOR_EMA_SHIFT;
+            break;
+        case MNC_GET_OVERRUNS:
+            *((uint32_t*) res->data) = st->overruns;
+            break;
+        case MNC_GET_STACKED:
+            *((uint32_t*) res->data) = st->stacked;
+            break;
+        default:
+            return NULL;
+    }
+    res->length = 4;
+    return res;
+}
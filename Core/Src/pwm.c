@@ -0,0 +1,171 @@
+#include "pwm.h"
+
+pwm_channel_t pwm_channels[PWM_MAX_CHANNELS];
+uint8_t pwm_channel_count;
+
+// shortest on or off time the scheduler backend accepts
+#define PWM_MIN_EDGE_TICKS SCHED_US(50)
+
+// one edge of a scheduler backed channel: toggle, then wait for the other half
+static void pwm_toggle(pwm_channel_t* ch) {
+    ch->level = !ch->level;
+    dev_set(ch->out, ch->level);
+    sched_set_period(ch->task, ch->level ? ch->on_ticks : ch->off_ticks);
+}
+
+// scheduler tasks take no argument, one per channel
+#define PWM_TASK(n) static void pwm_task_##n() { pwm_toggle(&pwm_channels[n]); }
+PWM_TASK(0)
+PWM_TASK(1)
+PWM_TASK(2)
+PWM_TASK(3)
+static const sched_fn pwm_tasks[PWM_MAX_CHANNELS] = {pwm_task_0, pwm_task_1, pwm_task_2, pwm_task_3};
+
+// initialize pwm channels
+void pwm_init() {
+    pwm_channel_count = 0;
+}
+
+// add a channel driving a device through its set fast path (scheduler backend)
+// returns channel, else -1
+int pwm_register(uint16_t id) {
+    if (pwm_channel_count >= PWM_MAX_CHANNELS) return -1;
+    dev_handle_t out = dev_bind(id);
+    if (out == NULL || out->set == NULL) return -1;
+
+    pwm_channels[pwm_channel_count] = (pwm_channel_t) {
+        .backend = PWM_BACKEND_SCHED, .out = out, .task = -1
+    };
+    return pwm_channel_count++;
+}
+
+// add a channel on a timer output-compare channel
+// returns channel, else -1
+int pwm_register_timer(TIM_HandleTypeDef* tim, uint32_t tim_channel, uint32_t tim_hz) {
+    if (pwm_channel_count >= PWM_MAX_CHANNELS) return -1;
+    if (tim == NULL || tim_hz == 0) return -1;
+
+    pwm_channels[pwm_channel_count] = (pwm_channel_t) {
+        .backend = PWM_BACKEND_TIMER, .task = -1,
+        .tim = tim, .tim_channel = tim_channel, .tim_hz = tim_hz
+    };
+    return pwm_channel_count++;
+}
+
+// stop the channel and drive its output low
+void pwm_stop(int channel) {
+    if (channel < 0 || channel >= pwm_channel_count) return;
+    pwm_channel_t* ch = &pwm_channels[channel];
+
+    if (ch->backend == PWM_BACKEND_TIMER) {
+        HAL_TIM_PWM_Stop(ch->tim, ch->tim_channel);
+    } else {
+        sched_remove(ch->task);
+        ch->task = -1;
+        ch->level = 0;
+        dev_set(ch->out, 0);
+    }
+    ch->enabled = 0;
+}
+
+// set frequency (1/1000 Hz) and duty (1/100 %), starts the channel
+// returns 0 on success, 1 on bad parameters
+uint8_t pwm_set(int channel, uint32_t freq_mhz, uint16_t duty) {
+    if (channel < 0 || channel >= pwm_channel_count) return 1;
+    if (freq_mhz == 0 || duty > PWM_DUTY_FULL) return 1;
+    pwm_channel_t* ch = &pwm_channels[channel];
+
+    if (ch->backend == PWM_BACKEND_TIMER) {
+        // compare and reload are preloaded by the timer, the new values apply from the next period
+        uint64_t counts = (uint64_t) ch->tim_hz * 1000 / freq_mhz;
+        if (counts < 2 || counts > UINT32_MAX) return 1;
+        __HAL_TIM_SET_AUTORELOAD(ch->tim, (uint32_t) counts - 1);
+        __HAL_TIM_SET_COMPARE(ch->tim, ch->tim_channel, (uint32_t) (counts * duty / PWM_DUTY_FULL));
+        if (!ch->enabled) HAL_TIM_PWM_Start(ch->tim, ch->tim_channel);
+    } else {
+        // period must fit a 32-bit duration, only done on change so the division is fine
+        uint64_t period = (uint64_t) CORE_MS_TO_TICKS(1000) * 1000 / freq_mhz;
+        if (period > UINT32_MAX) return 1;
+        core_ticks_t on = (core_ticks_t) (period * duty / PWM_DUTY_FULL);
+        core_ticks_t off = (core_ticks_t) period - on;
+        if ((on != 0 && on < PWM_MIN_EDGE_TICKS) || (off != 0 && off < PWM_MIN_EDGE_TICKS)) return 1;
+        ch->on_ticks = on;
+        ch->off_ticks = off;
+
+        if (on == 0 || off == 0) {
+            // constant level, no edges to schedule
+            sched_remove(ch->task);
+            ch->task = -1;
+            ch->level = on != 0;
+            dev_set(ch->out, ch->level);
+        } else if (ch->task < 0) {
+            // start with the on half, the new timing is picked up at the next edge otherwise
+            ch->level = 1;
+            dev_set(ch->out, 1);
+            ch->task = sched_add("pwm", pwm_tasks[channel], on, on, 0);
+            if (ch->task < 0) return 1;
+        }
+    }
+
+    ch->freq_mhz = freq_mhz;
+    ch->duty = duty;
+    ch->enabled = 1;
+    return 0;
+}
+
+// get channel, else NULL
+const pwm_channel_t* pwm_get(int channel) {
+    if (channel < 0 || channel >= pwm_channel_count) return NULL;
+    return &pwm_channels[channel];
+}
+
+DEV_STATIC(pwm_dev, PWM_DEVICE_ID) = {
+    .id = PWM_DEVICE_ID,
+    .name = "pwm",
+    .ioctl = pwm_ioctl,
+    .ioctl_r = pwm_ioctl_r
+};
+
+data_field_t pwm_data_field = {.length=0};
+data_field_t* pwm_ioctl(data_field_t* cmd) {
+    return pwm_ioctl_r(cmd, &pwm_data_field);
+}
+data_field_t* pwm_ioctl_r(data_field_t* cmd, data_field_t* res) {
+    if (cmd == NULL) return NULL;
+    if (cmd->length < 2) return NULL;
+    const pwm_channel_t* ch = pwm_get(cmd->data[1]);
+    if (ch == NULL) return NULL;
+
+    switch (cmd->data[0]) {
+        case PWC_SET_FREQ: {
+            if (cmd->length < 6) return NULL;
+            uint32_t freq = cmd->data[2] | (cmd->data[3] << 8) | (cmd->data[4] << 16) | ((uint32_t) cmd->data[5] << 24);
+            res->data[0] = pwm_set(cmd->data[1], freq, ch->duty);
+            res->length = 1;
+            break;
+        }
+        case PWC_SET_DUTY: {
+            if (cmd->length < 4) return NULL;
+            uint16_t duty = cmd->data[2] | (cmd->data[3] << 8);
+            res->data[0] = pwm_set(cmd->data[1], ch->freq_mhz, duty);
+            res->length = 1;
+            break;
+        }
+        case PWC_GET_FREQ:
+            *((uint32_t*) res->data) = ch->freq_mhz;
+            res->length = 4;
+            break;
+        case PWC_GET_DUTY:
+            *((uint16_t*) res->data) = ch->duty;
+            res->length = 2;
+            break;
+        case PWC_STOP:
+            pwm_stop(cmd->data[1]);
+            res->data[0] = 0;
+            res->length = 1;
+            break;
+        default:
+            return NULL;
+    }
+    return res;
+}
@@ -0,0 +1,253 @@
+#include "sched.h"
+#include "monitor.h"
+
+TIM_HandleTypeDef* sched_tim;
+
+sched_task_t sched_tasks[SCHED_MAX_TASKS];
+uint8_t sched_order[SCHED_MAX_TASKS]; // task ids sorted by priority
+uint8_t sched_task_count;
+
+// savings report
+uint32_t sched_wakeups;
+uint32_t sched_last_now;
+uint64_t sched_elapsed; // ticks since the counters were cleared
+uint64_t sched_isr_cycles; // whole interrupt, tasks included
+uint64_t sched_task_cycles;
+
+// a task's budget is its period
+static void sched_set_budget(int task) {
+    monitor_set_budget(MON_TASK_0 + task, sched_tasks[task].period * (SystemCoreClock / (1000000 * SCHED_TICKS_PER_US)));
+}
+
+// program the compare for the earliest due task
+// returns 1 if that task is already due, so the caller has to run it
+static uint8_t sched_arm(uint32_t now) {
+    if (sched_task_count == 0) return 0;
+
+    uint32_t next = sched_tasks[sched_order[0]].due;
+    for (uint8_t i = 1; i < sched_task_count; i++) {
+        uint32_t due = sched_tasks[sched_order[i]].due;
+        if ((int32_t) (due - next) < 0) next = due;
+    }
+    __HAL_TIM_SET_COMPARE(sched_tim, TIM_CHANNEL_1, next);
+
+    // the compare only fires on an exact match, check we did not miss it
+    return (int32_t) (__HAL_TIM_GET_COUNTER(sched_tim) - next) >= 0;
+}
+
+// re-arm from outside the interrupt, a due task is handed to the interrupt
+static void sched_rearm() {
+    if (sched_tim == NULL) return;
+    if (sched_arm(__HAL_TIM_GET_COUNTER(sched_tim))) sched_tim->Instance->EGR = TIM_EGR_CC1G;
+}
+
+// start the scheduler on the free-running timer, uses compare channel 1
+void sched_init(TIM_HandleTypeDef* tim) {
+    sched_tim = tim;
+    sched_last_now = __HAL_TIM_GET_COUNTER(tim);
+    sched_wakeups = 0;
+    sched_elapsed = 0;
+    sched_isr_cycles = 0;
+    sched_task_cycles = 0;
+
+    __HAL_TIM_CLEAR_FLAG(tim, TIM_FLAG_CC1);
+    __HAL_TIM_ENABLE_IT(tim, TIM_IT_CC1);
+    sched_rearm();
+}
+
+// add a task, first run is phase ticks from now
+// returns task id, else -1 if the table is full
+int sched_add(const char* name, sched_fn fn, uint32_t period, uint32_t phase, uint8_t priority) {
+    if (fn == NULL) return -1;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    int task = -1;
+    for (int i = 0; i < SCHED_MAX_TASKS; i++) {
+        if (sched_tasks[i].fn == NULL) {
+            task = i;
+            break;
+        }
+    }
+    if (task < 0) {
+        __set_PRIMASK(primask);
+        return -1;
+    }
+
+    uint32_t now = sched_tim != NULL ? __HAL_TIM_GET_COUNTER(sched_tim) : 0;
+    sched_tasks[task] = (sched_task_t) {
+        .name = name, .fn = fn, .period = period,
+        .due = now + phase, .priority = priority
+    };
+
+    // insert into the priority order, after tasks of equal priority
+    uint8_t pos = sched_task_count;
+    while (pos > 0 && sched_tasks[sched_order[pos-1]].priority > priority) {
+        sched_order[pos] = sched_order[pos-1];
+        --pos;
+    }
+    sched_order[pos] = task;
+    ++sched_task_count;
+    sched_set_budget(task);
+
+    sched_rearm();
+    __set_PRIMASK(primask);
+    return task;
+}
+
+// remove a task
+void sched_remove(int task) {
+    if (task < 0 || task >= SCHED_MAX_TASKS) return;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (sched_tasks[task].fn != NULL) {
+        sched_tasks[task].fn = NULL;
+        uint8_t j = 0;
+        for (uint8_t i = 0; i < sched_task_count; i++) {
+            if (sched_order[i] != task) sched_order[j++] = sched_order[i];
+        }
+        sched_task_count = j;
+    }
+    __set_PRIMASK(primask);
+}
+
+// change the period of a task, applied when its next run is computed
+void sched_set_period(int task, uint32_t period) {
+    if (task < 0 || task >= SCHED_MAX_TASKS) return;
+    sched_tasks[task].period = period;
+    sched_set_budget(task);
+}
+
+// move the next run of a task to delay ticks from now
+void sched_set_next(int task, uint32_t delay) {
+    if (task < 0 || task >= SCHED_MAX_TASKS || sched_tim == NULL) return;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    sched_tasks[task].due = __HAL_TIM_GET_COUNTER(sched_tim) + delay;
+    sched_rearm();
+    __set_PRIMASK(primask);
+}
+
+// get task, else NULL if not in use
+const sched_task_t* sched_get_task(int task) {
+    if (task < 0 || task >= SCHED_MAX_TASKS) return NULL;
+    if (sched_tasks[task].fn == NULL) return NULL;
+    return &sched_tasks[task];
+}
+
+// compare interrupt, runs every due task in priority order
+void sched_irq_handler() {
+    if (sched_tim == NULL) return;
+    if (!__HAL_TIM_GET_FLAG(sched_tim, TIM_FLAG_CC1)) return;
+    __HAL_TIM_CLEAR_FLAG(sched_tim, TIM_FLAG_CC1);
+
+    uint32_t start = CORE_CYCLES();
+    uint32_t now = __HAL_TIM_GET_COUNTER(sched_tim);
+    sched_elapsed += now - sched_last_now;
+    sched_last_now = now;
+    ++sched_wakeups;
+
+    do {
+        for (uint8_t i = 0; i < sched_task_count; i++) {
+            uint8_t task = sched_order[i];
+            sched_task_t* t = &sched_tasks[task];
+            if ((int32_t) (now - t->due) < 0) continue;
+
+            uint32_t task_start = CORE_CYCLES();
+            t->fn();
+            uint32_t task_cycles = CORE_CYCLES() - task_start;
+            sched_task_cycles += task_cycles;
+            monitor_record(MON_TASK_0 + task, task_cycles);
+            ++t->runs;
+
+            // the task may have removed itself
+            if (t->fn == NULL) {
+                --i;
+                continue;
+            }
+            if (t->period == 0) {
+                sched_remove(task);
+                --i;
+                continue;
+            }
+
+            t->due += t->period;
+            if ((int32_t) (now - t->due) >= 0) {
+                // late by at least a period, drop the missed runs but keep the phase
+                uint32_t missed = (now - t->due) / t->period + 1;
+                t->due += missed * t->period;
+                t->overruns += missed;
+            }
+        }
+        now = __HAL_TIM_GET_COUNTER(sched_tim);
+    } while (sched_arm(now));
+
+    uint32_t cycles = CORE_CYCLES() - start;
+    sched_isr_cycles += cycles;
+    monitor_record_isr(MON_SCHED_ISR, cycles);
+}
+
+DEV_STATIC(sched_dev, SCHED_DEVICE_ID) = {
+    .id = SCHED_DEVICE_ID,
+    .name = "scheduler",
+    .ioctl = sched_ioctl,
+    .ioctl_r = sched_ioctl_r
+};
+
+// mean cycles per wakeup spent in the scheduler itself
+static uint32_t sched_overhead() {
+    if (sched_wakeups == 0) return 0;
+    return (uint32_t) ((sched_isr_cycles - sched_task_cycles) / sched_wakeups);
+}
+
+// CPU saved vs the 10us timer in 1/1000
+// the old interrupt is costed at our own per-wakeup overhead, which is
+// a lower bound (it also did 64-bit tick and modulo arithmetic)
+static uint32_t sched_saved() {
+    uint64_t legacy = sched_elapsed / SCHED_LEGACY_TICK;
+    if (legacy <= sched_wakeups) return 0;
+    uint64_t cycles = (uint64_t) SystemCoreClock / (1000000 * SCHED_TICKS_PER_US) * sched_elapsed;
+    if (cycles == 0) return 0;
+    return (uint32_t) ((legacy - sched_wakeups) * sched_overhead() * 1000 / cycles);
+}
+
+data_field_t sched_data_field = {.length=0};
+data_field_t* sched_ioctl(data_field_t* cmd) {
+    return sched_ioctl_r(cmd, &sched_data_field);
+}
+data_field_t* sched_ioctl_r(data_field_t* cmd, data_field_t* res) {
+    if (cmd == NULL) return NULL;
+    if (cmd->length < 1) return NULL;
+
+    switch (cmd->data[0]) {
+        case SCC_GET_WAKEUPS:
+            *((uint32_t*) res->data) = sched_wakeups;
+            res->length = 4;
+            break;
+        case SCC_GET_LEGACY_TICKS:
+            *((uint32_t*) res->data) = (uint32_t) (sched_elapsed / SCHED_LEGACY_TICK);
+            res->length = 4;
+            break;
+        case SCC_GET_OVERHEAD:
+            *((uint32_t*) res->data) = sched_overhead();
+            res->length = 4;
+            break;
+        case SCC_GET_SAVED:
+            *((uint32_t*) res->data) = sched_saved();
+            res->length = 4;
+            break;
+        case SCC_RESET:
+            sched_wakeups = 0;
+            sched_elapsed = 0;
+            sched_isr_cycles = 0;
+            sched_task_cycles = 0;
+            res->length = 1;
+            res->data[0] = 0;
+            break;
+        default:
+            return NULL;
+    }
+    return res;
+}
@@ -24,6 +24,11 @@
 /* USER CODE BEGIN Includes */
 #include "core.h"
 #include "timing.h"
+#include "sched.h"
+#include "monitor.h"
+#include "din.h"
+#include "hsd_sense.h"
+#include "hsd_guard.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -209,11 +214,12 @@ void SysTick_Handler(void)
 void EXTI3_IRQHandler(void)
 {
   /* USER CODE BEGIN EXTI3_IRQn 0 */
+  MONITOR_BEGIN();
   timing_tdc_callback();
   /* USER CODE END EXTI3_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(HALL_SENSOR_Pin);
   /* USER CODE BEGIN EXTI3_IRQn 1 */
-
+  MONITOR_ISR_END(MON_TDC_ISR);
   /* USER CODE END EXTI3_IRQn 1 */
 }
 
@@ -223,11 +229,11 @@ void EXTI3_IRQHandler(void)
 void FDCAN1_IT0_IRQHandler(void)
 {
   /* USER CODE BEGIN FDCAN1_IT0_IRQn 0 */
-
+  MONITOR_BEGIN();
   /* USER CODE END FDCAN1_IT0_IRQn 0 */
   HAL_FDCAN_IRQHandler(&hfdcan1);
   /* USER CODE BEGIN FDCAN1_IT0_IRQn 1 */
-
+  MONITOR_ISR_END(MON_CAN0_ISR);
   /* USER CODE END FDCAN1_IT0_IRQn 1 */
 }
 
@@ -237,11 +243,11 @@ void FDCAN1_IT0_IRQHandler(void)
 void FDCAN1_IT1_IRQHandler(void)
 {
   /* USER CODE BEGIN FDCAN1_IT1_IRQn 0 */
-
+  MONITOR_BEGIN();
   /* USER CODE END FDCAN1_IT1_IRQn 0 */
   HAL_FDCAN_IRQHandler(&hfdcan1);
   /* USER CODE BEGIN FDCAN1_IT1_IRQn 1 */
-
+  MONITOR_ISR_END(MON_CAN1_ISR);
   /* USER CODE END FDCAN1_IT1_IRQn 1 */
 }
 
@@ -251,8 +257,15 @@ void FDCAN1_IT1_IRQHandler(void)
 void TIM2_IRQHandler(void)
 {
   /* USER CODE BEGIN TIM2_IRQn 0 */
-  // TIM2 is tick
-  // we shouldn't use interrupt unless we set the compare 
+  // TIM2 is tick, update extends it to 64 bits, compare channel 1 drives the scheduler,
+  // channels 2 to 4 are timing compare outputs
+  core_tick_irq_handler();
+  sched_irq_handler();
+  timing_compare_irq_handler();
+  // every enabled TIM2 flag has an owner above that clears it; the HAL handler
+  // would clear CC1-CC4 and UIF too, losing a match that lands while it runs
+  // (a lost scheduler CC1 sleeps a full 2^32 tick wrap)
+  return;
   /* USER CODE END TIM2_IRQn 0 */
   HAL_TIM_IRQHandler(&htim2);
   /* USER CODE BEGIN TIM2_IRQn 1 */
@@ -266,8 +279,7 @@ void TIM2_IRQHandler(void)
 void TIM6_IRQHandler(void)
 {
   /* USER CODE BEGIN TIM6_IRQn 0 */
-  // TIM6 is 100kHz clock (10us)
-  core_10us_callback();
+  // TIM6 is no longer started, loops run from the scheduler (sched.c)
   /* USER CODE END TIM6_IRQn 0 */
   HAL_TIM_IRQHandler(&htim6);
   /* USER CODE BEGIN TIM6_IRQn 1 */
@@ -281,7 +293,11 @@ void TIM6_IRQHandler(void)
 void TIM7_IRQHandler(void)
 {
   /* USER CODE BEGIN TIM7_IRQn 0 */
-  timing_timer_callback();
+  MONITOR_BEGIN();
+  timing_queue_irq_handler();
+  MONITOR_ISR_END(MON_TIMER_ISR);
+  // the queue owns the update flag, the HAL handler has nothing left to do
+  return;
   /* USER CODE END TIM7_IRQn 0 */
   HAL_TIM_IRQHandler(&htim7);
   /* USER CODE BEGIN TIM7_IRQn 1 */
@@ -291,4 +307,66 @@ void TIM7_IRQHandler(void)
 
 /* USER CODE BEGIN 1 */
 
+// DIN edge interrupts, lines set up by din_init
+
+/**
+  * @brief This function handles EXTI Line0 interrupt (DIN3).
+  */
+void EXTI0_IRQHandler(void)
+{
+  MONITOR_BEGIN();
+  din_exti_irq_handler(3);
+  MONITOR_ISR_END(MON_DIN_ISR);
+}
+
+/**
+  * @brief This function handles EXTI Line1 interrupt (DIN4).
+  */
+void EXTI1_IRQHandler(void)
+{
+  MONITOR_BEGIN();
+  din_exti_irq_handler(4);
+  MONITOR_ISR_END(MON_DIN_ISR);
+}
+
+/**
+  * @brief This function handles EXTI Line14 interrupt (DIN1).
+  */
+void EXTI14_IRQHandler(void)
+{
+  MONITOR_BEGIN();
+  din_exti_irq_handler(1);
+  MONITOR_ISR_END(MON_DIN_ISR);
+}
+
+/**
+  * @brief This function handles EXTI Line15 interrupt (DIN2).
+  */
+void EXTI15_IRQHandler(void)
+{
+  MONITOR_BEGIN();
+  din_exti_irq_handler(2);
+  MONITOR_ISR_END(MON_DIN_ISR);
+}
+
+/**
+  * @brief This function handles GPDMA1 Channel 0 interrupt (HSD sense scans).
+  */
+void GPDMA1_Channel0_IRQHandler(void)
+{
+  MONITOR_BEGIN();
+  HAL_DMA_IRQHandler(&hsd_sense_dma);
+  MONITOR_ISR_END(MON_SENSE_ISR);
+}
+
+/**
+  * @brief This function handles ADC1 global interrupt (HSD overcurrent watchdog).
+  */
+void ADC1_IRQHandler(void)
+{
+  MONITOR_BEGIN();
+  hsd_guard_irq_handler();
+  MONITOR_ISR_END(MON_GUARD_ISR);
+}
+
 /* USER CODE END 1 */
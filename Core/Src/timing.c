@@ -1,181 +1,311 @@
 #include "timing.h"
 #include "timing_prediction.h"
+#include "timing_map.h"
 
-TIM_HandleTypeDef* offset_timer;
-uint64_t timing_prev_tick; // 100ns ticks
-uint64_t timing_us_prev_rotation;
+core_tick_t timing_prev_tick;
+core_ticks_t timing_prev_rotation;
+uint32_t timing_us_prev_rotation;
 uint32_t timing_rpm;
-timing_state_t timing_state;
+timing_state_t timing_state; // channel 0
 uint8_t timing_set_up = 0;
 uint32_t timing_pred_us;
 
-timing_event_t* timing_current_event;
+uint16_t timing_dwell_us; // 0 runs the event table angles
+uint16_t timing_dwell_applied_us;
+uint32_t timing_dwell_clamped;
+core_ticks_t timing_dwell_period; // predicted period of this rotation
+
 timing_event_t timing_events[NUM_TIMING_EVENTS] = 
 {
     {
         .state = TS_HOLD,
-        .halt_timer = 0,
-        .time_fraction = 0
+        .angle = 0
     }, {
         .state = TS_WAIT,
-        .halt_timer = 0,
-        .time_fraction = 12.0 / 360
+        .angle = TIMING_DEG(12)
     }, {
         .state = TS_SPARK,
-        .halt_timer = 1,
-        .time_fraction = 348.0 / 360
+        .angle = TIMING_DEG(348)
     }, {
         .state = TS_INVALID,
-        .halt_timer = 1,
-        .time_fraction = 1
+        .angle = TIMING_ANGLE_ONE
     }
 };
 
+// outputs running the events, add cylinders here
+timing_channel_t timing_channels[] = {
+    {.id = HSD_120_ID, .offset = 0},
+#if TIMING_HSD50_COMPARE
+    {.id = HSD_50_ID, .offset = TIMING_DEG(180), .tim_channel = TIM_CHANNEL_2,
+     .port = HSD50_EN1_GPIO_Port, .pin = HSD50_EN1_Pin, .af = GPIO_AF1_TIM2},
+#endif
+};
+#define NUM_TIMING_CHANNELS (sizeof(timing_channels) / sizeof(timing_channels[0]))
+
+_Static_assert(NUM_TIMING_CHANNELS * NUM_TIMING_EVENTS <= TIMING_QUEUE_SIZE, "one rotation of events must fit the queue");
+_Static_assert(NUM_TIMING_EVENTS <= TIMING_COMPARE_EDGES, "one rotation of events must fit a compare output");
+_Static_assert(NUM_TIMING_CHANNELS * 2 * TIMING_DWELL_SPARKS <= TIMING_QUEUE_SIZE, "dwell mode edges must fit the queue");
+_Static_assert(2 * TIMING_DWELL_SPARKS <= TIMING_COMPARE_EDGES, "dwell mode edges must fit a compare output");
+_Static_assert(NUM_TIMING_CHANNELS <= 256, "channel is a byte in queue events");
+
+// output level of a state
+static uint8_t timing_state_level(timing_state_t state) {
+    return state == TS_HOLD || state == TS_SPARK;
+}
+
+// keeps channel 0 state and measured times for debug
+static void timing_edge_done(uint8_t ch, uint8_t index, core_tick_t at) {
+    if (ch != 0) return;
+    timing_state = timing_events[index].state;
+    timing_events[index].real_ticks = (core_ticks_t) (at - timing_prev_tick);
+}
+
+// queue hook, the output was set in software at now
+static void timing_fired(const timing_queue_event_t* ev, core_tick_t now) {
+    timing_channel_t* ch = &timing_channels[ev->channel];
+    ch->last_error = (int32_t) (now - ev->due);
+    if (ch->last_error > ch->late_error) ch->late_error = ch->last_error;
+    if (ch->last_error < ch->early_error) ch->early_error = ch->last_error;
+    timing_edge_done(ev->channel, ev->index, now);
+}
 
-data_field_t hsd_df_one = {.length=1, .data={1}};
-data_field_t hsd_df_zero = {.length=1, .data={0}};
+// compare hook, the pin changed on its due tick
+static void timing_compare_fired(uint8_t ch, uint8_t index, core_tick_t due) {
+    timing_edge_done(ch, index, due);
+}
+
+// the overcurrent guard cut an output, its BSRR store has no effect on a compare pin
+static void timing_hsd_blocked(uint16_t id, uint8_t blocked) {
+    for (size_t ch = 0; ch < NUM_TIMING_CHANNELS; ch++) {
+        if (timing_channels[ch].id == id) timing_compare_block(timing_channels[ch].compare, blocked);
+    }
+}
+
+// queue or compare an edge of a channel
+static void timing_push(uint8_t ch, core_tick_t due, uint8_t level, uint8_t index) {
+    if (timing_channels[ch].compare >= 0) {
+        timing_compare_push(timing_channels[ch].compare, due, level, index);
+    } else {
+        timing_queue_push(due, timing_channels[ch].out, level, ch, index);
+    }
+}
+
+// target dwell in ticks, clamped to TIMING_DWELL_MAX_DUTY of the period
+static core_ticks_t timing_dwell_clamp(core_ticks_t period) {
+    core_ticks_t dwell = CORE_US_TO_TICKS(timing_dwell_us);
+    core_ticks_t max = ((uint64_t) period * TIMING_DWELL_MAX_DUTY) >> 16;
+    if (dwell > max) dwell = max;
+    timing_dwell_applied_us = core_ticks_to_us(dwell);
+    return dwell;
+}
+
+// coil-on and spark edges for the sparks of a channel still ahead
+// a coil-on already past is set now, which is a no-op if the coil is on
+static void timing_dwell_push(uint8_t ch, core_tick_t now, core_ticks_t dwell) {
+    timing_channel_t* c = &timing_channels[ch];
+    for (uint8_t k = 0; k < c->sparks; k++) {
+        core_tick_t spark = c->spark[k];
+        if ((int64_t) (spark - now) <= 0) continue;
+        core_tick_t on = spark - dwell;
+        if ((int64_t) (on - now) < 0) on = now;
+        timing_push(ch, on, 1, TIMING_EVENT_COIL_ON);
+        timing_push(ch, spark, 0, TIMING_EVENT_COIL_OFF);
+    }
+}
 
 // callback for top dead center
 void timing_tdc_callback() {
     if (!timing_set_up) return;
     // start timing cycles
 
-    uint64_t now = core_get_tick();
-    timing_us_prev_rotation = (now - timing_prev_tick) / 10;
+    core_tick_t now = core_get_tick();
+    timing_prev_rotation = (core_ticks_t) (now - timing_prev_tick);
+    timing_us_prev_rotation = core_ticks_to_us(timing_prev_rotation);
     timing_prev_tick = now;
 
     // calculate RPM for debug purposes
-    timing_rpm = (uint32_t) (((float)(US_PER_S * S_PER_M)) / ((float) timing_us_prev_rotation));
+    timing_rpm = timing_us_prev_rotation ? TIMING_RPM_US / timing_us_prev_rotation : 0;
 
     // add to predictor
     predict_log_new_data(timing_us_prev_rotation);
     // get prediction
     timing_pred_us = predict_next_period();
 
-    // run timing system if we are within our range
+    // edges of the last rotation that did not come yet are stale
+    timing_queue_flush();
+    for (size_t ch = 0; ch < NUM_TIMING_CHANNELS; ch++) {
+        timing_compare_flush(timing_channels[ch].compare);
+        timing_channels[ch].sparks = 0;
+    }
+
+    // run timing system if we are within our range, prediction within 0.8 to 1.2 of the last rotation
+    uint64_t pred5 = (uint64_t) timing_pred_us * 5;
     if (timing_pred_us < TIMING_VALID_RANGE_MAX_US && TIMING_VALID_RANGE_MIN_US < timing_us_prev_rotation
-        && timing_pred_us < timing_us_prev_rotation * 1.2 && timing_pred_us > timing_us_prev_rotation * 0.8) {
-        // calculate event end timings for timers
+        && pred5 < (uint64_t) timing_us_prev_rotation * 6 && pred5 > (uint64_t) timing_us_prev_rotation * 4) {
+        // spark advance for this rotation, the map table is read once so an update cannot tear it
+        timing_events[TIMING_EVENT_SPARK].angle = TIMING_ANGLE_ONE - timing_map_lookup(timing_rpm);
+
+        // one rotation of edges per channel, each shifted by its offset and wrapped into this rotation
+        // angle * period >> 16 scales a Q16 angle to ticks, one multiply and no division
         for (int i = 0; i < NUM_TIMING_EVENTS-1; i++) {
-            timing_events[i].end_us = timing_events[i+1].time_fraction * timing_us_prev_rotation;
+            timing_events[i].ticks = ((uint64_t) timing_events[i].angle * timing_prev_rotation) >> 16;
+        }
+        if (timing_dwell_us) {
+            // spark at its angle of the predicted period, coil-on a fixed time before it
+            timing_dwell_period = CORE_US_TO_TICKS(timing_pred_us);
+            core_ticks_t dwell = timing_dwell_clamp(timing_dwell_period);
+            // counted once per rotation here, a dwell change mid rotation reuses the period
+            if (dwell < CORE_US_TO_TICKS(timing_dwell_us)) ++timing_dwell_clamped;
+            for (size_t ch = 0; ch < NUM_TIMING_CHANNELS; ch++) {
+                timing_channel_t* c = &timing_channels[ch];
+                uint32_t phase = (timing_events[TIMING_EVENT_SPARK].angle + c->offset) & (TIMING_ANGLE_ONE - 1);
+                c->spark[0] = now + (((uint64_t) phase * timing_dwell_period) >> 16);
+                c->sparks = 1;
+                // the next spark's coil-on may fall before the next TDC, its spark edge is redone there
+                core_tick_t next = c->spark[0] + timing_dwell_period;
+                if ((int64_t) (next - dwell - (now + timing_dwell_period)) < 0) c->spark[c->sparks++] = next;
+                timing_dwell_push(ch, now, dwell);
+            }
+            return;
+        }
+        for (size_t ch = 0; ch < NUM_TIMING_CHANNELS; ch++) {
+            for (int i = 0; i < NUM_TIMING_EVENTS-1; i++) {
+                uint32_t phase = (timing_events[i].angle + timing_channels[ch].offset) & (TIMING_ANGLE_ONE - 1);
+                core_tick_t due = now + (((uint64_t) phase * timing_prev_rotation) >> 16);
+                timing_push(ch, due, timing_state_level(timing_events[i].state), i);
+            }
+            // end of the channel's own rotation, not wrapped: the next TDC flushes it,
+            // a lost TDC leaves the output low after its spark instead of high
+            const timing_event_t* end = &timing_events[NUM_TIMING_EVENTS-1];
+            uint32_t phase = end->angle + timing_channels[ch].offset;
+            timing_push(ch, now + (((uint64_t) phase * timing_prev_rotation) >> 16), timing_state_level(end->state), NUM_TIMING_EVENTS-1);
         }
-        timing_events[NUM_TIMING_EVENTS-1].end_us = timing_us_prev_rotation;
-
-        // set current event to first event
-        timing_current_event = &timing_events[0];
-        timing_state = timing_current_event->state;
-        timing_set_state(timing_state);
-        timing_timer_setup(timing_current_event->end_us - (core_get_tick() - timing_prev_tick) / 10);
-        timing_timer_begin();
     } else {
-        timing_state = TS_INVALID;
         timing_set_state(TS_INVALID);
     }
 }
 
-// init timing system
-void timing_init(TIM_HandleTypeDef* tim) {
-    offset_timer = tim;
+// init timing system, tim is the one-shot of the event queue, tick_tim carries the compare outputs
+// returns 0 on success, 1 if a channel output could not be bound or registered
+uint8_t timing_init(TIM_HandleTypeDef* tim, TIM_HandleTypeDef* tick_tim) {
+    timing_compare_init(timing_compare_fired);
+    timing_map_init(TIMING_ANGLE_ONE - timing_events[TIMING_EVENT_SPARK].angle);
+    for (size_t ch = 0; ch < NUM_TIMING_CHANNELS; ch++) {
+        timing_channel_t* c = &timing_channels[ch];
+        c->compare = -1;
+        if (c->tim_channel) {
+            c->compare = timing_compare_register(tick_tim, c->tim_channel, c->port, c->pin, c->af, ch);
+            if (c->compare < 0) return 1;
+            hsd_set_block_hook(timing_hsd_blocked);
+            continue;
+        }
+        c->out = dev_bind(c->id);
+        if (c->out == NULL || c->out->set == NULL) return 1;
+    }
+    timing_queue_init(tim, timing_fired);
     timing_state = TS_INVALID;
     timing_prev_tick = 0x7fffffff; // arbitary large value
     timing_set_up = 1;
-    // assume MX_Init correctly initialized timer to run at 10us (100kHz)
-}
-
-// configure timer for n * 10us
-void timing_timer_setup(uint32_t us) {
-    offset_timer->Instance->ARR = (us / 2) - 1;
-    offset_timer->Instance->CNT = 0;
-}
-
-// start timer
-void timing_timer_begin() {
-    if (!timing_set_up) return;
-    HAL_TIM_Base_Start_IT(offset_timer);
+    return 0;
 }
 
-// timer interrupt
-void timing_timer_callback() {
-    if (!timing_set_up) return;
-    
-    // stop timer
-    HAL_TIM_Base_Stop_IT(offset_timer);
-    offset_timer->Instance->SR &= ~TIM_SR_UIF; // clear interrupt flag because the autoreset doesn't do anything after stop
-
-    // write real us for debug
-    timing_current_event->real_us = (core_get_tick() - timing_prev_tick) / 10;
-
-    // increment the current event
-    ++timing_current_event;
-
-    // set the state for new event
-    timing_set_state(timing_current_event->state);
-
-    // if event calls for halt timer, return and do not proceed
-    if (timing_current_event->halt_timer) return;
-
-    // start timer for future - now
-    timing_timer_setup(timing_current_event->end_us - (core_get_tick() - timing_prev_tick) / 10);
-    timing_timer_begin();
+// constant dwell in us, 0 runs the event table angles
+void timing_set_dwell(uint16_t dwell_us) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint16_t was = timing_dwell_us;
+    timing_dwell_us = dwell_us;
+    if (timing_set_up && was && dwell_us) {
+        // redo the pending edges of this rotation with the new dwell instead of waiting for TDC
+        timing_queue_flush();
+        for (size_t ch = 0; ch < NUM_TIMING_CHANNELS; ch++) timing_compare_flush(timing_channels[ch].compare);
+        core_ticks_t dwell = timing_dwell_clamp(timing_dwell_period);
+        core_tick_t now = core_get_tick();
+        for (size_t ch = 0; ch < NUM_TIMING_CHANNELS; ch++) timing_dwell_push(ch, now, dwell);
+    }
+    __set_PRIMASK(primask);
 }
 
-// configure state
+// set every channel to the level of a state, does not touch the queue
 void timing_set_state(timing_state_t state) {
     if (!timing_set_up) return;
     timing_state = state;
-    switch (state) {
-        case TS_WAIT:
-            dev_ioctl(HSD_120_ID, &hsd_df_zero);
-            break;
-        case TS_SPARK:
-            dev_ioctl(HSD_120_ID, &hsd_df_one);
-            break;
-        case TS_INVALID:
-            dev_ioctl(HSD_120_ID, &hsd_df_zero);
-            break;
-        case TS_HOLD:
-            dev_ioctl(HSD_120_ID, &hsd_df_one);
-            break;
+    for (size_t ch = 0; ch < NUM_TIMING_CHANNELS; ch++) {
+        if (timing_channels[ch].compare >= 0) {
+            timing_compare_force(timing_channels[ch].compare, timing_state_level(state));
+        } else {
+            dev_set(timing_channels[ch].out, timing_state_level(state));
+        }
     }
 }
 
-const device_t timing_dev = {
+DEV_STATIC(timing_dev, TIMING_DEV_ID) = {
     .id = TIMING_DEV_ID,
     .ioctl = timing_ioctl,
-    .name = "timing"
+    .name = "timing",
+    .ioctl_r = timing_ioctl_r,
+    .flags = DEV_FLAG_REENTRANT // not INLINE, TIC_SET_DWELL reschedules the pending edges
 };
 
-uint32_t timing_buf_4;
-uint64_t timing_buf_8;
-
 data_field_t timing_ioctl_data_field = {.length=0};
 data_field_t* timing_ioctl(data_field_t* cmd) {
+    return timing_ioctl_r(cmd, &timing_ioctl_data_field);
+}
+data_field_t* timing_ioctl_r(data_field_t* cmd, data_field_t* res) {
     if (!timing_set_up) return NULL;
     if (cmd == NULL) return NULL;
     if (cmd->length < 1) return NULL;
     switch (cmd->data[0]) {
         case TIC_GET_PERIOD:
-            timing_buf_4 = timing_us_prev_rotation;
-            *((uint32_t*) timing_ioctl_data_field.data) = timing_buf_4;
-            timing_ioctl_data_field.length = 4;
+            *((uint32_t*) res->data) = timing_us_prev_rotation;
+            res->length = 4;
             break;
         case TIC_GET_RPM:
-            timing_buf_4 = timing_rpm;
-            *((uint32_t*) timing_ioctl_data_field.data) = timing_buf_4;
-            timing_ioctl_data_field.length = 4;
+            *((uint32_t*) res->data) = timing_rpm;
+            res->length = 4;
             break;
         case TIC_GET_STATE:
-            timing_buf_4 = timing_state;
-            *((uint32_t*) timing_ioctl_data_field.data) = timing_buf_4;
-            timing_ioctl_data_field.length = 4;
+            *((uint32_t*) res->data) = timing_state;
+            res->length = 4;
             break;
         case TIC_GET_TICK:
-            timing_buf_8 = timing_prev_tick;
-            *((uint64_t*) timing_ioctl_data_field.data) = timing_buf_8;
-            timing_ioctl_data_field.length = 8;
+            *((uint64_t*) res->data) = timing_prev_tick;
+            res->length = 8;
+            break;
+        case TIC_GET_LATE:
+            *((uint32_t*) res->data) = timing_queue_get_stats()->late;
+            res->length = 4;
+            break;
+        case TIC_GET_DROPPED:
+            *((uint32_t*) res->data) = timing_queue_get_stats()->dropped;
+            res->length = 4;
+            break;
+        case TIC_GET_EDGE_ERROR: {
+            if (cmd->length < 2 || cmd->data[1] >= NUM_TIMING_CHANNELS) return NULL;
+            const timing_channel_t* ch = &timing_channels[cmd->data[1]];
+            const timing_compare_t* oc = timing_compare_get(ch->compare);
+            // compare edges are never early
+            ((int32_t*) res->data)[0] = oc ? (int32_t) oc->worst_error : ch->late_error;
+            ((int32_t*) res->data)[1] = oc ? 0 : ch->early_error;
+            res->length = 8;
+            break;
+        }
+        case TIC_SET_DWELL:
+            if (cmd->length < 3) return NULL;
+            timing_set_dwell(cmd->data[1] | (cmd->data[2] << 8));
+            res->data[0] = 0;
+            res->length = 1;
+            break;
+        case TIC_GET_DWELL:
+            ((uint16_t*) res->data)[0] = timing_dwell_us;
+            ((uint16_t*) res->data)[1] = timing_dwell_applied_us;
+            ((uint32_t*) res->data)[1] = timing_dwell_clamped;
+            res->length = 8;
             break;
+        default:
+            return NULL;
     }
-    return &timing_ioctl_data_field;
+    return res;
 }
 
 
@@ -0,0 +1,169 @@
+#include "timing_compare.h"
+
+timing_compare_t timing_compares[TIMING_COMPARE_MAX_OUTPUTS];
+uint8_t timing_compare_count;
+timing_compare_hook timing_compare_fire_hook;
+
+// output compare mode of a channel, modes are given for channel 1
+static void timing_compare_set_mode(timing_compare_t* oc, uint32_t mode) {
+    TIM_TypeDef* tim = oc->tim->Instance;
+    __IO uint32_t* ccmr = oc->channel <= TIM_CHANNEL_2 ? &tim->CCMR1 : &tim->CCMR2;
+    uint32_t shift = oc->channel == TIM_CHANNEL_2 || oc->channel == TIM_CHANNEL_4 ? 8 : 0;
+    *ccmr = (*ccmr & ~((TIM_CCMR1_OC1M | TIM_CCMR1_CC1S) << shift)) | (mode << shift);
+}
+
+static uint32_t timing_compare_flag(timing_compare_t* oc) {
+    return TIM_FLAG_CC1 << (oc->channel / 4);
+}
+
+// account one output edge and drop it from the list
+static void timing_compare_done(timing_compare_t* oc, core_ticks_t error) {
+    timing_compare_edge_t edge = oc->edges[0];
+    for (uint8_t i = 1; i < oc->count; i++) oc->edges[i - 1] = oc->edges[i];
+    --oc->count;
+
+    ++oc->edges_done;
+    oc->last_error = error;
+    if (error > oc->worst_error) oc->worst_error = error;
+    if (timing_compare_fire_hook) timing_compare_fire_hook(oc->tag, edge.index, edge.due);
+}
+
+// load the earliest edge into the compare, edges already past are forced
+// interrupts must be masked
+static void timing_compare_arm(timing_compare_t* oc) {
+    uint32_t flag = timing_compare_flag(oc);
+    while (oc->count) {
+        timing_compare_edge_t* edge = &oc->edges[0];
+        uint32_t ccr = core_tick_to_counter(edge->due);
+        __HAL_TIM_CLEAR_FLAG(oc->tim, flag);
+        // a blocked pin stays forced low, the match still raises the flag
+        uint8_t level = edge->level && !oc->blocked;
+        uint32_t mode = level ? TIM_OCMODE_ACTIVE : TIM_OCMODE_INACTIVE;
+        timing_compare_set_mode(oc, oc->blocked ? TIM_OCMODE_FORCED_INACTIVE : mode);
+        __HAL_TIM_SET_COMPARE(oc->tim, oc->channel, ccr);
+        __HAL_TIM_ENABLE_IT(oc->tim, flag);
+
+        // the compare only fires on an exact match, check we did not miss it
+        if (__HAL_TIM_GET_FLAG(oc->tim, flag)) return; // matched already, the interrupt takes it
+        int32_t late = (int32_t) (__HAL_TIM_GET_COUNTER(oc->tim) - ccr);
+        if (late < 0) return;
+
+        timing_compare_set_mode(oc, level ? TIM_OCMODE_FORCED_ACTIVE : TIM_OCMODE_FORCED_INACTIVE);
+        ++oc->forced;
+        timing_compare_done(oc, (core_ticks_t) (core_get_tick() - edge->due));
+    }
+    __HAL_TIM_DISABLE_IT(oc->tim, flag);
+}
+
+// set the hook for all outputs
+void timing_compare_init(timing_compare_hook hook) {
+    timing_compare_fire_hook = hook;
+    timing_compare_count = 0;
+}
+
+// hand a pin to a compare channel of the tick timer, output starts low
+// returns output, else -1
+int timing_compare_register(TIM_HandleTypeDef* tim, uint32_t channel, GPIO_TypeDef* port, uint16_t pin, uint32_t af, uint8_t tag) {
+    if (timing_compare_count >= TIMING_COMPARE_MAX_OUTPUTS) return -1;
+    if (tim == NULL || channel == TIM_CHANNEL_1 || channel > TIM_CHANNEL_4) return -1;
+
+    timing_compare_t* oc = &timing_compares[timing_compare_count];
+    *oc = (timing_compare_t) {.tim = tim, .channel = channel, .tag = tag};
+
+    // compare writes take effect at once, no preload
+    timing_compare_set_mode(oc, TIM_OCMODE_FORCED_INACTIVE);
+    TIM_CCxChannelCmd(tim->Instance, channel, TIM_CCx_ENABLE);
+
+    GPIO_InitTypeDef init = {
+        .Pin = pin,
+        .Mode = GPIO_MODE_AF_PP,
+        .Pull = GPIO_NOPULL,
+        .Speed = GPIO_SPEED_FREQ_LOW,
+        .Alternate = af
+    };
+    HAL_GPIO_Init(port, &init);
+    return timing_compare_count++;
+}
+
+// add an edge, returns 0 on success, 1 if the output has no room
+uint8_t timing_compare_push(int oc_i, core_tick_t due, uint8_t level, uint8_t index) {
+    if (oc_i < 0 || oc_i >= timing_compare_count) return 1;
+    timing_compare_t* oc = &timing_compares[oc_i];
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (oc->count >= TIMING_COMPARE_EDGES) {
+        __set_PRIMASK(primask);
+        return 1;
+    }
+    uint8_t i = oc->count++;
+    while (i > 0 && (int64_t) (oc->edges[i - 1].due - due) > 0) {
+        oc->edges[i] = oc->edges[i - 1];
+        --i;
+    }
+    oc->edges[i] = (timing_compare_edge_t) {.due = due, .level = level, .index = index};
+    if (i == 0) timing_compare_arm(oc);
+    __set_PRIMASK(primask);
+    return 0;
+}
+
+// drop pending edges, the pin keeps its level
+void timing_compare_flush(int oc_i) {
+    if (oc_i < 0 || oc_i >= timing_compare_count) return;
+    timing_compare_t* oc = &timing_compares[oc_i];
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    oc->count = 0;
+    __HAL_TIM_DISABLE_IT(oc->tim, timing_compare_flag(oc));
+    __set_PRIMASK(primask);
+}
+
+// set the pin now, pending edges are dropped
+void timing_compare_force(int oc_i, uint8_t level) {
+    if (oc_i < 0 || oc_i >= timing_compare_count) return;
+    timing_compare_t* oc = &timing_compares[oc_i];
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    oc->count = 0;
+    __HAL_TIM_DISABLE_IT(oc->tim, timing_compare_flag(oc));
+    timing_compare_set_mode(oc, level && !oc->blocked ? TIM_OCMODE_FORCED_ACTIVE : TIM_OCMODE_FORCED_INACTIVE);
+    __set_PRIMASK(primask);
+}
+
+// hold the pin low now and on every edge until released
+void timing_compare_block(int oc_i, uint8_t blocked) {
+    if (oc_i < 0 || oc_i >= timing_compare_count) return;
+    timing_compare_t* oc = &timing_compares[oc_i];
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    oc->blocked = blocked;
+    // the armed edge keeps its compare value, only its mode changes
+    if (blocked) timing_compare_set_mode(oc, TIM_OCMODE_FORCED_INACTIVE);
+    else if (oc->count) timing_compare_set_mode(oc, oc->edges[0].level ? TIM_OCMODE_ACTIVE : TIM_OCMODE_INACTIVE);
+    __set_PRIMASK(primask);
+}
+
+// get output, else NULL
+const timing_compare_t* timing_compare_get(int oc_i) {
+    if (oc_i < 0 || oc_i >= timing_compare_count) return NULL;
+    return &timing_compares[oc_i];
+}
+
+// tick timer interrupt, loads the next edge of every output that matched
+void timing_compare_irq_handler() {
+    for (uint8_t i = 0; i < timing_compare_count; i++) {
+        timing_compare_t* oc = &timing_compares[i];
+        uint32_t flag = timing_compare_flag(oc);
+        if (!__HAL_TIM_GET_FLAG(oc->tim, flag)) continue;
+        if (!(oc->tim->Instance->DIER & flag)) continue;
+        __HAL_TIM_CLEAR_FLAG(oc->tim, flag);
+        if (oc->count == 0) continue;
+
+        // the hardware set the pin on the match of the due tick, not measured
+        timing_compare_done(oc, 0);
+        timing_compare_arm(oc);
+    }
+}
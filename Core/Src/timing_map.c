@@ -0,0 +1,210 @@
+#include "timing_map.h"
+#include <string.h>
+
+// double buffer, lookups read the active pointer, edits go to the other table
+timing_map_table_t timing_map_tables[2];
+timing_map_table_t* volatile timing_map_active;
+timing_map_table_t* timing_map_shadow;
+
+uint16_t timing_map_load;
+uint16_t timing_map_last;
+
+// axis brackets of the last lookup, valid for any table of the same size
+uint8_t timing_map_rpm_i;
+uint8_t timing_map_load_i;
+
+uint32_t timing_map_lookups;
+uint32_t timing_map_misses;
+
+static const uint16_t timing_map_default_rpm[TIMING_MAP_RPM_POINTS] = {500, 1000, 2000, 3000, 4500, 6000, 9000, 12000};
+
+// fill the reciprocals of an axis, returns 1 if it is not strictly ascending
+static uint8_t timing_map_prepare_axis(const uint16_t* axis, uint32_t* recip, uint8_t n) {
+    for (uint8_t i = 0; i + 1 < n; i++) {
+        if (axis[i + 1] <= axis[i]) return 1;
+        recip[i] = UINT32_MAX / (axis[i + 1] - axis[i]);
+    }
+    return 0;
+}
+
+// bracket of x on an axis and its Q16 position inside, clamped at the ends
+static uint8_t timing_map_bracket(const uint16_t* axis, const uint32_t* recip, uint8_t n, uint8_t* cache, uint32_t x, uint32_t* frac) {
+    uint8_t i = *cache;
+    if (x >= axis[i] && x < axis[i + 1]) {
+        *frac = ((uint64_t) (x - axis[i]) * recip[i]) >> 16;
+        return i;
+    }
+
+    ++timing_map_misses;
+    if (x <= axis[0]) {
+        *cache = 0;
+        *frac = 0;
+        return 0;
+    }
+    if (x >= axis[n - 1]) {
+        *cache = n - 2;
+        *frac = 1u << 16;
+        return n - 2;
+    }
+    uint8_t lo = 0;
+    uint8_t hi = n - 1;
+    while (hi - lo > 1) {
+        uint8_t mid = (lo + hi) / 2;
+        if (axis[mid] <= x) lo = mid;
+        else hi = mid;
+    }
+    *cache = lo;
+    *frac = ((uint64_t) (x - axis[lo]) * recip[lo]) >> 16;
+    return lo;
+}
+
+// a + (b - a) * frac rounded, frac in Q16, |b - a| <= TIMING_MAP_MAX_ADVANCE keeps this in 32 bits
+// the result stays between a and b, so cells of at least TIMING_MAP_MIN_ADVANCE keep lookups there
+static inline int32_t timing_map_lerp(int32_t a, int32_t b, uint32_t frac) {
+    return a + (((b - a) * (int32_t) frac + 0x8000) >> 16);
+}
+
+// init both tables with the flat default advance
+void timing_map_init(uint16_t advance) {
+    timing_map_table_t* t = &timing_map_tables[0];
+    memcpy(t->rpm, timing_map_default_rpm, sizeof(t->rpm));
+    for (uint8_t l = 0; l < TIMING_MAP_LOAD_POINTS; l++) {
+        t->load[l] = l * TIMING_MAP_LOAD_FULL / (TIMING_MAP_LOAD_POINTS - 1);
+    }
+    for (uint8_t r = 0; r < TIMING_MAP_RPM_POINTS; r++) {
+        for (uint8_t l = 0; l < TIMING_MAP_LOAD_POINTS; l++) t->advance[r][l] = advance;
+    }
+    timing_map_prepare_axis(t->rpm, t->rpm_recip, TIMING_MAP_RPM_POINTS);
+    timing_map_prepare_axis(t->load, t->load_recip, TIMING_MAP_LOAD_POINTS);
+    timing_map_tables[1] = *t;
+
+    timing_map_active = &timing_map_tables[0];
+    timing_map_shadow = &timing_map_tables[1];
+    timing_map_load = 0;
+    timing_map_last = advance;
+    timing_map_rpm_i = 0;
+    timing_map_load_i = 0;
+    timing_map_lookups = 0;
+    timing_map_misses = 0;
+}
+
+// advance at rpm and the current load, bilinear, clamped at the table edges
+uint16_t timing_map_lookup(uint32_t rpm) {
+    const timing_map_table_t* t = timing_map_active; // one read, a commit cannot tear this lookup
+    ++timing_map_lookups;
+
+    uint32_t fr, fl;
+    uint8_t r = timing_map_bracket(t->rpm, t->rpm_recip, TIMING_MAP_RPM_POINTS, &timing_map_rpm_i, rpm, &fr);
+    uint8_t l = timing_map_bracket(t->load, t->load_recip, TIMING_MAP_LOAD_POINTS, &timing_map_load_i, timing_map_load, &fl);
+
+    int32_t lo = timing_map_lerp(t->advance[r][l], t->advance[r][l + 1], fl);
+    int32_t hi = timing_map_lerp(t->advance[r + 1][l], t->advance[r + 1][l + 1], fl);
+    timing_map_last = (uint16_t) timing_map_lerp(lo, hi, fr);
+    return timing_map_last;
+}
+
+// set the load used by lookups, 0..TIMING_MAP_LOAD_FULL
+void timing_map_set_load(uint16_t load) {
+    timing_map_load = load;
+}
+
+// validate the edited table and swap it in with one pointer store
+uint8_t timing_map_commit() {
+    timing_map_table_t* t = timing_map_shadow;
+    if (timing_map_prepare_axis(t->rpm, t->rpm_recip, TIMING_MAP_RPM_POINTS)) return 1;
+    if (timing_map_prepare_axis(t->load, t->load_recip, TIMING_MAP_LOAD_POINTS)) return 1;
+    for (uint8_t r = 0; r < TIMING_MAP_RPM_POINTS; r++) {
+        for (uint8_t l = 0; l < TIMING_MAP_LOAD_POINTS; l++) {
+            uint16_t advance = t->advance[r][l];
+            if (advance < TIMING_MAP_MIN_ADVANCE || advance > TIMING_MAP_MAX_ADVANCE) return 1;
+        }
+    }
+
+    // lookups run in interrupts and finish before this code resumes, so the old
+    // table is free as soon as the pointer moved
+    timing_map_table_t* old = timing_map_active;
+    timing_map_active = t;
+    *old = *t;
+    timing_map_shadow = old;
+    return 0;
+}
+
+// active table, read once per rotation
+const timing_map_table_t* timing_map_get() {
+    return timing_map_active;
+}
+
+DEV_STATIC(timing_map_dev, TIMING_MAP_ID) = {
+    .id = TIMING_MAP_ID,
+    .name = "timing map",
+    .ioctl = timing_map_ioctl,
+    .ioctl_r = timing_map_ioctl_r
+};
+
+data_field_t timing_map_data_field = {.length=0};
+data_field_t* timing_map_ioctl(data_field_t* cmd) {
+    return timing_map_ioctl_r(cmd, &timing_map_data_field);
+}
+data_field_t* timing_map_ioctl_r(data_field_t* cmd, data_field_t* res) {
+    if (cmd == NULL) return NULL;
+    if (cmd->length < 1) return NULL;
+    timing_map_table_t* shadow = timing_map_shadow;
+    if (shadow == NULL) return NULL; // timing_map_init has not run
+
+    switch (cmd->data[0]) {
+        case TMC_SET_RPM:
+        case TMC_SET_LOAD_AXIS: {
+            if (cmd->length < 4) return NULL;
+            uint8_t i = cmd->data[1];
+            uint16_t value = cmd->data[2] | (cmd->data[3] << 8);
+            uint8_t ok = cmd->data[0] == TMC_SET_RPM ? i < TIMING_MAP_RPM_POINTS : i < TIMING_MAP_LOAD_POINTS;
+            if (ok) {
+                if (cmd->data[0] == TMC_SET_RPM) shadow->rpm[i] = value;
+                else shadow->load[i] = value;
+            }
+            res->data[0] = !ok;
+            res->length = 1;
+            break;
+        }
+        case TMC_SET_CELL: {
+            if (cmd->length < 5) return NULL;
+            uint8_t r = cmd->data[1];
+            uint8_t l = cmd->data[2];
+            uint16_t value = cmd->data[3] | (cmd->data[4] << 8);
+            uint8_t ok = r < TIMING_MAP_RPM_POINTS && l < TIMING_MAP_LOAD_POINTS
+                && value >= TIMING_MAP_MIN_ADVANCE && value <= TIMING_MAP_MAX_ADVANCE;
+            if (ok) shadow->advance[r][l] = value;
+            res->data[0] = !ok;
+            res->length = 1;
+            break;
+        }
+        case TMC_COMMIT:
+            res->data[0] = timing_map_commit();
+            res->length = 1;
+            break;
+        case TMC_SET_LOAD:
+            if (cmd->length < 3) return NULL;
+            timing_map_set_load(cmd->data[1] | (cmd->data[2] << 8));
+            res->data[0] = 0;
+            res->length = 1;
+            break;
+        case TMC_GET_ADVANCE:
+            *((uint16_t*) res->data) = timing_map_last;
+            res->length = 2;
+            break;
+        case TMC_GET_CELL:
+            if (cmd->length < 3) return NULL;
+            if (cmd->data[1] >= TIMING_MAP_RPM_POINTS || cmd->data[2] >= TIMING_MAP_LOAD_POINTS) return NULL;
+            *((uint16_t*) res->data) = timing_map_get()->advance[cmd->data[1]][cmd->data[2]];
+            res->length = 2;
+            break;
+        case TMC_GET_MISSES:
+            ((uint32_t*) res->data)[0] = timing_map_lookups;
+            ((uint32_t*) res->data)[1] = timing_map_misses;
+            res->length = 8;
+            break;
+        default:
+            return NULL;
+    }
+    return res;
+}
@@ -54,7 +54,7 @@ void predict_init() {
 // called in core 100ms task
 void predict_periodic_reset() {
     // if too much time has elapsed, clear the queue
-    uint64_t now = core_get_tick();
+    core_tick_t now = core_get_tick();
     if (now - predict_get_data(1).timestamp > TP_ELAPSED_TICKS) {
         tp_data_count = 0;
         tp_invalid_data_count = 0;
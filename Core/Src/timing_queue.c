@@ -0,0 +1,145 @@
+#include "timing_queue.h"
+
+TIM_HandleTypeDef* timing_queue_tim;
+timing_queue_hook timing_queue_fire_hook;
+
+// binary min-heap on due, heap[0] is the next event
+timing_queue_event_t timing_queue_heap[TIMING_QUEUE_SIZE];
+uint8_t timing_queue_count;
+
+timing_queue_stats_t timing_queue_stats;
+
+// events closer than half a timer count are fired in the same pass
+#define TIMING_QUEUE_LEAD_TICKS (TIMING_QUEUE_TICKS_PER_COUNT / 2)
+
+static void timing_queue_swap(uint8_t a, uint8_t b) {
+    timing_queue_event_t t = timing_queue_heap[a];
+    timing_queue_heap[a] = timing_queue_heap[b];
+    timing_queue_heap[b] = t;
+}
+
+static uint8_t timing_queue_before(uint8_t a, uint8_t b) {
+    return (int64_t) (timing_queue_heap[a].due - timing_queue_heap[b].due) < 0;
+}
+
+static void timing_queue_sift_up(uint8_t i) {
+    while (i > 0) {
+        uint8_t parent = (i - 1) / 2;
+        if (!timing_queue_before(i, parent)) return;
+        timing_queue_swap(i, parent);
+        i = parent;
+    }
+}
+
+static void timing_queue_sift_down(uint8_t i) {
+    for (;;) {
+        uint8_t first = i;
+        uint8_t l = 2 * i + 1;
+        uint8_t r = l + 1;
+        if (l < timing_queue_count && timing_queue_before(l, first)) first = l;
+        if (r < timing_queue_count && timing_queue_before(r, first)) first = r;
+        if (first == i) return;
+        timing_queue_swap(i, first);
+        i = first;
+    }
+}
+
+// fire every event due within TIMING_QUEUE_LEAD_TICKS, earliest first
+// interrupts must be masked
+static void timing_queue_dispatch() {
+    core_tick_t now = core_get_tick();
+    while (timing_queue_count && (int64_t) (timing_queue_heap[0].due - now) <= TIMING_QUEUE_LEAD_TICKS) {
+        timing_queue_event_t ev = timing_queue_heap[0];
+        timing_queue_heap[0] = timing_queue_heap[--timing_queue_count];
+        timing_queue_sift_down(0);
+
+        ev.out->set(ev.value);
+        ++timing_queue_stats.fired;
+        if ((int64_t) (now - ev.due) > (int64_t) timing_queue_stats.late) timing_queue_stats.late = now - ev.due;
+        if (timing_queue_fire_hook) timing_queue_fire_hook(&ev, now);
+        now = core_get_tick();
+    }
+}
+
+// (re)start the one-shot for the earliest event, timer may be running
+// an earliest event that is already due (pushed late, or passed while the
+// previous ones fired) is fired here instead of waiting for the timer
+// interrupts must be masked
+static void timing_queue_arm() {
+    __HAL_TIM_DISABLE(timing_queue_tim);
+    __HAL_TIM_CLEAR_FLAG(timing_queue_tim, TIM_FLAG_UPDATE);
+    timing_queue_dispatch();
+    if (timing_queue_count == 0) return;
+
+    // more than the lead ahead after dispatch, so ticks is positive
+    int64_t ticks = (int64_t) (timing_queue_heap[0].due - core_get_tick());
+    int64_t counts = ticks / TIMING_QUEUE_TICKS_PER_COUNT;
+    // ARR 0 stops the counter, so the shortest wait is 2 counts (an edge less
+    // than that ahead fires late, by under 2 counts)
+    if (counts < 2) counts = 2;
+    if (counts > TIMING_QUEUE_MAX_COUNTS) counts = TIMING_QUEUE_MAX_COUNTS;
+    timing_queue_tim->Instance->ARR = (uint32_t) counts - 1;
+    timing_queue_tim->Instance->CNT = 0;
+    __HAL_TIM_ENABLE(timing_queue_tim);
+}
+
+// init queue on a one-shot timer counting at TIMING_QUEUE_TICKS_PER_COUNT
+void timing_queue_init(TIM_HandleTypeDef* tim, timing_queue_hook hook) {
+    timing_queue_tim = tim;
+    timing_queue_fire_hook = hook;
+    timing_queue_count = 0;
+    timing_queue_stats = (timing_queue_stats_t) {0};
+    // assume MX_Init configured the timer for 2us counts, it is started per event
+    __HAL_TIM_DISABLE(tim);
+    __HAL_TIM_CLEAR_FLAG(tim, TIM_FLAG_UPDATE);
+    __HAL_TIM_ENABLE_IT(tim, TIM_IT_UPDATE);
+}
+
+// add an event, O(log n), returns 0 on success, 1 if the queue is full or out is NULL
+uint8_t timing_queue_push(core_tick_t due, dev_handle_t out, uint8_t value, uint8_t channel, uint8_t index) {
+    if (out == NULL || out->set == NULL) return 1;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (timing_queue_count >= TIMING_QUEUE_SIZE) {
+        ++timing_queue_stats.dropped;
+        __set_PRIMASK(primask);
+        return 1;
+    }
+    uint8_t i = timing_queue_count++;
+    timing_queue_heap[i] = (timing_queue_event_t) {
+        .due = due, .out = out, .value = value, .channel = channel, .index = index
+    };
+    timing_queue_sift_up(i);
+    // only a new earliest event moves the timer (or fires now if it is due)
+    if (timing_queue_heap[0].due == due) timing_queue_arm();
+    __set_PRIMASK(primask);
+    return 0;
+}
+
+// drop all pending events and stop the timer
+void timing_queue_flush() {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    timing_queue_count = 0;
+    timing_queue_arm();
+    __set_PRIMASK(primask);
+}
+
+// number of pending events
+uint8_t timing_queue_pending() {
+    return timing_queue_count;
+}
+
+const timing_queue_stats_t* timing_queue_get_stats() {
+    return &timing_queue_stats;
+}
+
+// timer interrupt, fires every due event then re-arms for the next one
+void timing_queue_irq_handler() {
+    if (timing_queue_tim == NULL) return;
+    if (!__HAL_TIM_GET_FLAG(timing_queue_tim, TIM_FLAG_UPDATE)) return;
+    __HAL_TIM_CLEAR_FLAG(timing_queue_tim, TIM_FLAG_UPDATE);
+    ++timing_queue_stats.wakeups;
+    timing_queue_arm();
+}
@@ -0,0 +1,23 @@
+#ifndef __INCLUDE_HOST_CAN_H
+#define __INCLUDE_HOST_CAN_H
+
+#include "canlib2.h"
+
+#define HOST_CAN_FRAMES 64
+
+// one frame sent through canlib2_send_data_p
+typedef struct host_can_frame {
+    uint8_t priority;
+    uint8_t address;
+    uint8_t length;
+    uint8_t data[8];
+} host_can_frame_t;
+
+extern canlib2_fdcan_t host_can;
+extern host_can_frame_t host_can_frames[HOST_CAN_FRAMES];
+extern size_t host_can_frame_count;
+
+// deliver a frame to the FIFO callback as the FDCAN interrupt would
+void host_can_receive(canlib2_fifo fifo, uint8_t priority, uint8_t address, uint8_t length, uint8_t* data);
+
+#endif // __INCLUDE_HOST_CAN_H
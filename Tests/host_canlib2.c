@@ -0,0 +1,64 @@
+// in-process canlib2 stand-in: no bus, sent frames are logged for the test
+// and received frames are injected with host_can_receive
+#include "host_can.h"
+#include <string.h>
+
+canlib2_fdcan_t host_can;
+host_can_frame_t host_can_frames[HOST_CAN_FRAMES];
+size_t host_can_frame_count;
+
+canlib2_fdcan_t* canlib2_configure(FDCAN_HandleTypeDef* fdcan) {
+    memset(&host_can, 0, sizeof(host_can));
+    host_can.fdcan = fdcan;
+    host_can.status = CANLIB2_STATUS_DISABLED;
+    host_can_frame_count = 0;
+    return &host_can;
+}
+
+int canlib2_start(canlib2_fdcan_t* can) {
+    can->status = CANLIB2_STATUS_ENABLED;
+    return CANLIB2_OK;
+}
+
+int canlib2_enable_rx_interrupt(canlib2_fdcan_t* can, canlib2_rx_event event) {
+    return CANLIB2_OK;
+}
+
+int canlib2_change_global_filter_config(canlib2_fdcan_t* can, canlib2_non_matching_action accept_non_matching, canlib2_remote_action accept_remote) {
+    return CANLIB2_OK;
+}
+
+int canlib2_set_rx_callback(canlib2_fdcan_t* can, canlib2_fifo fifo, canlib2_rx_callback callback) {
+    if (fifo == CANLIB2_FIFO0) can->rx_fifo0_callback = callback;
+    else can->rx_fifo1_callback = callback;
+    return CANLIB2_OK;
+}
+
+int canlib2_add_rx_filter(canlib2_fdcan_t* can, canlib2_filter_action action, uint8_t priority_mask, uint8_t priority_match, uint8_t addr_mask, uint8_t addr_match) {
+    ++can->__filter_index;
+    return CANLIB2_OK;
+}
+
+int canlib2_send_data_p(canlib2_fdcan_t* can, uint8_t priority, uint8_t addr, uint8_t length, uint8_t* data) {
+    if (host_can_frame_count >= HOST_CAN_FRAMES) return CANLIB2_ERROR;
+    host_can_frame_t* f = &host_can_frames[host_can_frame_count++];
+    f->priority = priority;
+    f->address = addr;
+    f->length = length;
+    memcpy(f->data, data, length > 8 ? 8 : length);
+    return CANLIB2_OK;
+}
+
+// deliver a frame to the FIFO callback as the FDCAN interrupt would
+void host_can_receive(canlib2_fifo fifo, uint8_t priority, uint8_t address, uint8_t length, uint8_t* data) {
+    canlib2_rx_return_t ret = {
+        .fdcan = host_can.fdcan,
+        .event = fifo == CANLIB2_FIFO0 ? CANLIB2_RX_FIFO0_NEW_MESSAGE : CANLIB2_RX_FIFO1_NEW_MESSAGE,
+        .identifier = {.priority = priority, .address = address},
+        .frame_type = CANLIB2_DATA_FRAME,
+        .length = length,
+        .data = data
+    };
+    canlib2_rx_callback cb = fifo == CANLIB2_FIFO0 ? host_can.rx_fifo0_callback : host_can.rx_fifo1_callback;
+    if (cb) cb(host_can.fdcan, ret);
+}
@@ -0,0 +1,83 @@
+#include "host_test.h"
+#include <stdlib.h>
+#include <time.h>
+
+// peripherals as plain memory
+GPIO_TypeDef host_gpio[8];
+TIM_TypeDef host_tim[4];
+ADC_TypeDef host_adc1;
+ADC_TypeDef* ADC1 = &host_adc1;
+DWT_Type host_dwt;
+DWT_Type* DWT = &host_dwt;
+CoreDebug_Type host_core_debug;
+CoreDebug_Type* CoreDebug = &host_core_debug;
+SCB_Type host_scb;
+SCB_Type* SCB = &host_scb;
+EXTI_TypeDef host_exti;
+EXTI_TypeDef* EXTI = &host_exti;
+uint32_t SystemCoreClock = 250000000;
+
+int host_test_failures;
+
+// ns since the first call, wraps like the DWT counter
+uint32_t host_cycles(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+
+// single core, no interrupts: masking is bookkeeping only
+uint32_t host_primask;
+uint32_t __get_PRIMASK(void) { return host_primask; }
+void __set_PRIMASK(uint32_t primask) { host_primask = primask; }
+void __disable_irq(void) { host_primask = 1; }
+void __enable_irq(void) { host_primask = 0; }
+void __DMB(void) { __sync_synchronize(); }
+void __DSB(void) { __sync_synchronize(); }
+void __ISB(void) {}
+void __NOP(void) {}
+void __WFI(void) {}
+
+// ms tick under test control, timeouts expire when the test moves it
+uint32_t host_ms;
+uint32_t HAL_GetTick(void) { return host_ms; }
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state) {
+    if (state == GPIO_PIN_SET) port->ODR |= pin;
+    else port->ODR &= ~(uint32_t) pin;
+}
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* port, uint16_t pin) {
+    return (port->IDR & pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+void HAL_GPIO_TogglePin(GPIO_TypeDef* port, uint16_t pin) {
+    port->ODR ^= pin;
+}
+void HAL_GPIO_Init(GPIO_TypeDef* port, GPIO_InitTypeDef* init) {
+    (void) port;
+    (void) init;
+}
+
+// peripherals started by the firmware modules, nothing to do on the host
+void* GPDMA1_Channel0;
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef* htim) { return HAL_OK; }
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef* htim, uint32_t channel) { return HAL_OK; }
+HAL_StatusTypeDef HAL_TIM_PWM_Stop(TIM_HandleTypeDef* htim, uint32_t channel) { return HAL_OK; }
+void TIM_CCxChannelCmd(TIM_TypeDef* tim, uint32_t channel, uint32_t state) {
+    uint32_t mask = 1u << (channel & 0x1F); // CCxE
+    tim->CCER = (tim->CCER & ~mask) | (state << (channel & 0x1F));
+}
+void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t pre, uint32_t sub) {}
+void HAL_NVIC_EnableIRQ(IRQn_Type irq) {}
+void HAL_NVIC_DisableIRQ(IRQn_Type irq) {}
+HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef* hdma) { return HAL_OK; }
+HAL_StatusTypeDef HAL_DMA_ConfigChannelAttributes(DMA_HandleTypeDef* hdma, uint32_t attr) { return HAL_OK; }
+HAL_StatusTypeDef HAL_ADC_Init(ADC_HandleTypeDef* hadc) { return HAL_OK; }
+HAL_StatusTypeDef HAL_ADCEx_Calibration_Start(ADC_HandleTypeDef* hadc, uint32_t mode) { return HAL_OK; }
+HAL_StatusTypeDef HAL_ADC_ConfigChannel(ADC_HandleTypeDef* hadc, ADC_ChannelConfTypeDef* conf) { return HAL_OK; }
+HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef* hadc, uint32_t* data, uint32_t length) { return HAL_OK; }
+void HAL_ADC_IRQHandler(ADC_HandleTypeDef* hadc) {}
+
+void Error_Handler(void) {
+    printf("Error_Handler called\n");
+    abort();
+}
@@ -0,0 +1,23 @@
+#ifndef __INCLUDE_HOST_TEST_H
+#define __INCLUDE_HOST_TEST_H
+
+#include <stdio.h>
+#include "stm32h5xx_hal.h"
+
+// host tests: plain asserts that count failures, main returns host_test_result()
+extern int host_test_failures;
+extern uint32_t host_ms; // HAL_GetTick()
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        ++host_test_failures; \
+    } \
+} while (0)
+
+static inline int host_test_result(const char* name) {
+    printf("%s: %s\n", name, host_test_failures ? "FAILED" : "ok");
+    return host_test_failures != 0;
+}
+
+#endif // __INCLUDE_HOST_TEST_H
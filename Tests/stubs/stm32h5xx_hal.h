@@ -0,0 +1,260 @@
+// host stand-in for the STM32H5 HAL, just enough for the modules under test
+// peripherals are plain structs in RAM (host_hal.c) that tests poke directly
+#ifndef STUB_HAL_H
+#define STUB_HAL_H
+#include <stdint.h>
+#include <stddef.h>
+#define __IO volatile
+#define __unused __attribute__((unused))
+#define UNUSED(x) ((void)(x))
+typedef struct { __IO uint32_t MODER, OTYPER, OSPEEDR, PUPDR, IDR, ODR, BSRR, LCKR, AFR[2], BRR; } GPIO_TypeDef;
+typedef struct { __IO uint32_t CR1, CR2, SMCR, DIER, SR, EGR, CCMR1, CCMR2, CCER, CNT, PSC, ARR, RCR, CCR1, CCR2, CCR3, CCR4; } TIM_TypeDef;
+typedef struct { __IO uint32_t ISR, IER, CR, CFGR, CFGR2, SMPR1, SMPR2, RES, TR1, TR2, TR3; __IO uint32_t DR; __IO uint32_t AWD2CR, AWD3CR; } ADC_TypeDef;
+typedef struct { __IO uint32_t CTRL, CYCCNT; } DWT_Type;
+typedef struct { __IO uint32_t DEMCR; } CoreDebug_Type;
+typedef struct { __IO uint32_t IMR1, EMR1, RTSR1, FTSR1, SWIER1, RPR1, FPR1; } EXTI_TypeDef;
+extern DWT_Type* DWT; extern CoreDebug_Type* CoreDebug; extern EXTI_TypeDef* EXTI;
+#define DWT_CTRL_CYCCNTENA_Msk 1u
+#define CoreDebug_DEMCR_TRCENA_Msk (1u<<24)
+typedef struct { __IO uint32_t CPUID, ICSR; } SCB_Type;
+extern SCB_Type* SCB;
+#define SCB_ICSR_ISRPENDING_Msk (1u<<22)
+extern GPIO_TypeDef host_gpio[8];
+extern TIM_TypeDef host_tim[4];
+#define GPIOA (&host_gpio[0])
+#define GPIOB (&host_gpio[1])
+#define GPIOC (&host_gpio[2])
+#define GPIOD (&host_gpio[3])
+#define GPIOH (&host_gpio[7])
+#define TIM2 (&host_tim[0])
+#define TIM3 (&host_tim[1])
+#define TIM6 (&host_tim[2])
+#define TIM7 (&host_tim[3])
+extern ADC_TypeDef *ADC1;
+typedef struct { TIM_TypeDef* Instance; } TIM_HandleTypeDef;
+typedef struct { uint32_t FrameFormat, Mode; } FDCAN_InitTypeDef;
+typedef struct { void* Instance; FDCAN_InitTypeDef Init; } FDCAN_HandleTypeDef;
+typedef struct { uint32_t Request, BlkHWRequest, Direction, SrcInc, DestInc, SrcDataWidth, DestDataWidth, Priority, SrcBurstLength, DestBurstLength, TransferAllocatedPort, TransferEventMode, Mode; } DMA_InitTypeDef;
+typedef struct { void* Instance; DMA_InitTypeDef Init; } DMA_HandleTypeDef;
+typedef struct { uint32_t Ratio, RightBitShift, TriggeredMode, OversamplingStopReset; } ADC_OversamplingTypeDef;
+typedef struct { uint32_t ClockPrescaler, Resolution, DataAlign, ScanConvMode, EOCSelection, LowPowerAutoWait, ContinuousConvMode, NbrOfConversion, DiscontinuousConvMode, ExternalTrigConv, ExternalTrigConvEdge, DMAContinuousRequests, SamplingMode, Overrun, OversamplingMode; ADC_OversamplingTypeDef Oversampling; } ADC_InitTypeDef;
+typedef struct { ADC_TypeDef* Instance; ADC_InitTypeDef Init; DMA_HandleTypeDef* DMA_Handle; } ADC_HandleTypeDef;
+#define __HAL_LINKDMA(h, f, d) do { (h)->f = &(d); } while (0)
+#define __HAL_RCC_GPDMA1_CLK_ENABLE() do {} while (0)
+extern void* GPDMA1_Channel0;
+#define GPDMA1_REQUEST_ADC1 0u
+#define DMA_BREQ_SINGLE_BURST 0u
+#define DMA_PERIPH_TO_MEMORY 0u
+#define DMA_SINC_FIXED 0u
+#define DMA_DINC_INCREMENTED 1u
+#define DMA_SRC_DATAWIDTH_HALFWORD 1u
+#define DMA_DEST_DATAWIDTH_HALFWORD 1u
+#define DMA_LOW_PRIORITY_HIGH_WEIGHT 2u
+#define DMA_SRC_ALLOCATED_PORT0 0u
+#define DMA_DEST_ALLOCATED_PORT0 0u
+#define DMA_TCEM_BLOCK_TRANSFER 0u
+#define DMA_NORMAL 0u
+#define DMA_CHANNEL_NPRIV 0u
+#define ADC_SCAN_ENABLE 1u
+#define ADC_EOC_SEQ_CONV 2u
+#define ADC_OVR_DATA_OVERWRITTEN 1u
+#define ADC_OVERSAMPLING_RATIO_16 3u
+#define ADC_RIGHTBITSHIFT_4 4u
+#define ADC_TRIGGEREDMODE_SINGLE_TRIGGER 0u
+#define ADC_REGOVERSAMPLING_CONTINUED_MODE 0u
+#define ADC_REGULAR_RANK_2 2u
+#define ADC_REGULAR_RANK_3 3u
+#define ADC_REGULAR_RANK_4 4u
+#define ADC_CHANNEL_19 19u
+typedef struct { uint32_t Identifier, IdType, TxFrameType, DataLength, ErrorStateIndicator, BitRateSwitch, FDFormat, TxEventFifoControl, MessageMarker; } FDCAN_TxHeaderTypeDef;
+typedef struct { uint32_t Identifier, IdType, RxFrameType, DataLength; } FDCAN_RxHeaderTypeDef;
+typedef struct { uint32_t IdType, FilterIndex, FilterType, FilterConfig, FilterID1, FilterID2; } FDCAN_FilterTypeDef;
+typedef enum { GPIO_PIN_RESET = 0, GPIO_PIN_SET } GPIO_PinState;
+typedef enum { HAL_OK = 0, HAL_ERROR, HAL_BUSY, HAL_TIMEOUT } HAL_StatusTypeDef;
+typedef enum { IRQn_dummy = 0, EXTI3_IRQn = 3, EXTI14_IRQn = 14, EXTI15_IRQn = 15, EXTI0_IRQn=0, EXTI1_IRQn=1, ADC1_IRQn = 40, GPDMA1_Channel0_IRQn = 27 } IRQn_Type;
+#define GPIO_PIN_0 0x0001u
+#define GPIO_PIN_1 0x0002u
+#define GPIO_PIN_2 0x0004u
+#define GPIO_PIN_3 0x0008u
+#define GPIO_PIN_4 0x0010u
+#define GPIO_PIN_5 0x0020u
+#define GPIO_PIN_6 0x0040u
+#define GPIO_PIN_7 0x0080u
+#define GPIO_PIN_8 0x0100u
+#define GPIO_PIN_9 0x0200u
+#define GPIO_PIN_10 0x0400u
+#define GPIO_PIN_11 0x0800u
+#define GPIO_PIN_12 0x1000u
+#define GPIO_PIN_13 0x2000u
+#define GPIO_PIN_14 0x4000u
+#define GPIO_PIN_15 0x8000u
+#define TIM_SR_UIF 1u
+#define TIM_SR_CC1IF 2u
+#define TIM_SR_CC2IF 4u
+#define TIM_DIER_UIE 1u
+#define TIM_DIER_CC1IE 2u
+#define TIM_DIER_CC2IE 4u
+#define TIM_CR1_CEN 1u
+#define TIM_CHANNEL_1 0u
+#define TIM_CHANNEL_2 4u
+#define TIM_CHANNEL_3 8u
+#define TIM_CHANNEL_4 12u
+#define TIM_IT_CC1 2u
+#define TIM_IT_UPDATE 1u
+#define TIM_FLAG_CC1 2u
+#define TIM_FLAG_CC2 4u
+#define TIM_EGR_CC1G 2u
+#define TIM_FLAG_UPDATE 1u
+#define FDCAN_DATA_FRAME 0
+#define FDCAN_STANDARD_ID 0
+#define FDCAN_ESI_ACTIVE 0
+#define FDCAN_BRS_OFF 0
+#define FDCAN_CLASSIC_CAN 0
+#define FDCAN_NO_TX_EVENTS 0
+#define FDCAN_FILTER_MASK 2
+#define FDCAN_DLC_BYTES_8 8
+#define FDCAN_REMOTE_FRAME 0x20000000U
+#define FDCAN_ACCEPT_IN_RX_FIFO0 0
+#define FDCAN_ACCEPT_IN_RX_FIFO1 1
+#define FDCAN_REJECT 2
+#define FDCAN_REJECT_REMOTE 1
+#define FDCAN_FILTER_REMOTE 0
+#define FDCAN_FILTER_DISABLE 0
+#define FDCAN_FILTER_TO_RXFIFO0 1
+#define FDCAN_FILTER_TO_RXFIFO1 2
+#define FDCAN_FILTER_REJECT 3
+#define FDCAN_FILTER_HP 4
+#define FDCAN_FILTER_TO_RXFIFO0_HP 5
+#define FDCAN_FILTER_TO_RXFIFO1_HP 6
+#define FDCAN_IT_RX_FIFO0_FULL 1
+#define FDCAN_IT_RX_FIFO0_MESSAGE_LOST 2
+#define FDCAN_IT_RX_FIFO0_NEW_MESSAGE 4
+#define FDCAN_IT_RX_FIFO1_FULL 8
+#define FDCAN_IT_RX_FIFO1_MESSAGE_LOST 16
+#define FDCAN_IT_RX_FIFO1_NEW_MESSAGE 32
+#define FDCAN_IT_TX_ABORT_COMPLETE 64
+#define FDCAN_IT_TX_COMPLETE 128
+#define FDCAN_IT_TX_FIFO_EMPTY 256
+#define FDCAN_MODE_BUS_MONITORING 1
+#define FDCAN_MODE_NORMAL 0
+#define FDCAN_MODE_RESTRICTED_OPERATION 2
+#define FDCAN_RX_FIFO0 0x40
+#define FDCAN_RX_FIFO1 0x41
+#define ADC_CHANNEL_3 3u
+#define ADC_CHANNEL_2 2u
+#define ADC_CHANNEL_1 1u
+#define ADC_CHANNEL_0 0u
+#define ADC_REGULAR_RANK_1 1u
+#define ADC_SAMPLETIME_47CYCLES_5 5u
+#define ADC_SINGLE_ENDED 0u
+#define ADC_OFFSET_NONE 0u
+typedef struct { uint32_t Channel, Rank, SamplingTime, SingleDiff, OffsetNumber, Offset; } ADC_ChannelConfTypeDef;
+typedef struct { uint32_t WatchdogNumber, WatchdogMode, Channel, ITMode, HighThreshold, LowThreshold, FilteringConfig; } ADC_AnalogWDGConfTypeDef;
+#define ADC_ANALOGWATCHDOG_2 2u
+#define ADC_ANALOGWATCHDOG_3 3u
+#define ADC_ANALOGWATCHDOG_SINGLE_REG 1u
+#define ADC_AWD_FILTERING_NONE 0u
+#define ENABLE 1
+#define DISABLE 0
+#define ADC_FLAG_AWD2 (1u<<8)
+#define ADC_FLAG_AWD3 (1u<<9)
+#define ADC_IT_AWD2 ADC_FLAG_AWD2
+#define ADC_IT_AWD3 ADC_FLAG_AWD3
+#define __HAL_ADC_CLEAR_FLAG(h, f) ((h)->Instance->ISR &= ~(f)) // write 1 to clear
+#define __HAL_ADC_ENABLE_IT(h, f) ((h)->Instance->IER |= (f))
+#define __HAL_ADC_DISABLE_IT(h, f) ((h)->Instance->IER &= ~(f))
+#define __HAL_TIM_SET_COMPARE(h, c, v) ((&(h)->Instance->CCR1)[(c) / 4] = (v))
+#define __HAL_TIM_GET_COUNTER(h) ((h)->Instance->CNT)
+#define __HAL_TIM_ENABLE_IT(h, i) ((h)->Instance->DIER |= (i))
+#define __HAL_TIM_DISABLE_IT(h, i) ((h)->Instance->DIER &= ~(i))
+#define __HAL_TIM_CLEAR_FLAG(h, f) ((h)->Instance->SR &= ~(f)) // rc_w0, other flags untouched
+#define __HAL_TIM_CLEAR_IT(h, f) ((h)->Instance->SR = ~(f))
+#define __HAL_TIM_GET_FLAG(h, f) (((h)->Instance->SR & (f)) == (f))
+#define __HAL_TIM_ENABLE(h) ((h)->Instance->CR1 |= 1u)
+#define __HAL_TIM_DISABLE(h) ((h)->Instance->CR1 &= ~1u)
+#define __HAL_GPIO_EXTI_CLEAR_IT(p) ((void)(p))
+// host clock for CORE_CYCLES(), ns since start, build with -D'CORE_CYCLES()=host_cycles()'
+uint32_t host_cycles(void);
+// scripted TIM2 reads for test_core_tick (CORE_TICK_CNT, CORE_TICK_SR)
+uint32_t host_tick_cnt(void);
+uint32_t host_tick_sr(void);
+
+uint32_t __get_PRIMASK(void); void __disable_irq(void); void __enable_irq(void); void __set_PRIMASK(uint32_t);
+void __DMB(void); void __DSB(void); void __WFI(void); void __NOP(void); void __ISB(void);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+uint32_t HAL_RCC_GetHCLKFreq(void);
+extern uint32_t SystemCoreClock;
+void HAL_GPIO_WritePin(GPIO_TypeDef*, uint16_t, GPIO_PinState);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef*, uint16_t);
+void HAL_GPIO_TogglePin(GPIO_TypeDef*, uint16_t);
+void HAL_GPIO_EXTI_IRQHandler(uint16_t);
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef*);
+HAL_StatusTypeDef HAL_TIM_Base_Stop_IT(TIM_HandleTypeDef*);
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef*);
+HAL_StatusTypeDef HAL_TIM_OC_Start_IT(TIM_HandleTypeDef*, uint32_t);
+HAL_StatusTypeDef HAL_TIM_OC_Stop_IT(TIM_HandleTypeDef*, uint32_t);
+HAL_StatusTypeDef HAL_TIM_OC_Start(TIM_HandleTypeDef*, uint32_t);
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef*, uint32_t);
+HAL_StatusTypeDef HAL_TIM_PWM_Stop(TIM_HandleTypeDef*, uint32_t);
+#define __HAL_TIM_SET_AUTORELOAD(h, v) ((h)->Instance->ARR = (v))
+HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef*, uint32_t*, uint32_t);
+HAL_StatusTypeDef HAL_ADC_Stop_DMA(ADC_HandleTypeDef*);
+HAL_StatusTypeDef HAL_ADC_Start_IT(ADC_HandleTypeDef*);
+HAL_StatusTypeDef HAL_ADC_Start(ADC_HandleTypeDef*);
+HAL_StatusTypeDef HAL_ADC_Stop(ADC_HandleTypeDef*);
+HAL_StatusTypeDef HAL_ADC_ConfigChannel(ADC_HandleTypeDef*, ADC_ChannelConfTypeDef*);
+HAL_StatusTypeDef HAL_ADC_AnalogWDGConfig(ADC_HandleTypeDef*, ADC_AnalogWDGConfTypeDef*);
+uint32_t HAL_ADC_GetValue(ADC_HandleTypeDef*);
+void HAL_NVIC_SetPriority(IRQn_Type, uint32_t, uint32_t);
+void HAL_NVIC_EnableIRQ(IRQn_Type);
+void HAL_NVIC_DisableIRQ(IRQn_Type);
+HAL_StatusTypeDef HAL_FDCAN_GetRxMessage(FDCAN_HandleTypeDef*, uint32_t, FDCAN_RxHeaderTypeDef*, uint8_t*);
+void Error_Handler(void);
+#define TIM_CCMR1_OC1M 0x10070u
+#define TIM_CCMR1_CC1S 3u
+#define TIM_OCMODE_ACTIVE 0x10u
+#define TIM_OCMODE_INACTIVE 0x20u
+#define TIM_OCMODE_FORCED_ACTIVE 0x50u
+#define TIM_OCMODE_FORCED_INACTIVE 0x40u
+#define TIM_CCx_ENABLE 1u
+void TIM_CCxChannelCmd(TIM_TypeDef*, uint32_t, uint32_t);
+#define GPIO_MODE_AF_PP 2u
+#define GPIO_SPEED_FREQ_LOW 0u
+#define GPIO_AF1_TIM2 1u
+HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef*);
+HAL_StatusTypeDef HAL_DMA_ConfigChannelAttributes(DMA_HandleTypeDef*, uint32_t);
+void HAL_DMA_IRQHandler(DMA_HandleTypeDef*);
+HAL_StatusTypeDef HAL_ADC_Init(ADC_HandleTypeDef*);
+HAL_StatusTypeDef HAL_ADCEx_Calibration_Start(ADC_HandleTypeDef*, uint32_t);
+void HAL_ADC_IRQHandler(ADC_HandleTypeDef*);
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef*);
+#define __LL_ADC_CHANNEL_TO_DECIMAL_NB(c) (c)
+#define ADC_IT_OVR (1u<<4)
+#define ADC_CR_ADSTART (1u<<2)
+#define LL_ADC_REG_CONV_SINGLE 0u
+#define LL_ADC_REG_CONV_CONTINUOUS (1u<<13)
+#define LL_ADC_REG_DMA_TRANSFER_NONE 0u
+#define LL_ADC_REG_SetContinuousMode(a, m) ((a)->CFGR = ((a)->CFGR & ~LL_ADC_REG_CONV_CONTINUOUS) | (m))
+#define LL_ADC_REG_SetDMATransfer(a, m) ((a)->CFGR = ((a)->CFGR & ~3u) | (m))
+#define LL_ADC_REG_StartConversion(a) ((a)->CR |= ADC_CR_ADSTART)
+#define LL_ADC_REG_StopConversion(a) ((a)->CR &= ~ADC_CR_ADSTART) // the model stops at once
+#define LL_ADC_REG_IsStopConversionOngoing(a) 0u
+#define __HAL_ADC_GET_FLAG(h, f) (((h)->Instance->ISR & (f)) == (f))
+
+#ifndef STUB_GPIO_INIT
+#define STUB_GPIO_INIT
+typedef struct { uint32_t Pin, Mode, Pull, Speed, Alternate; } GPIO_InitTypeDef;
+#define GPIO_MODE_INPUT 0u
+#define GPIO_MODE_IT_RISING 0x10110000u
+#define GPIO_MODE_IT_FALLING 0x10210000u
+#define GPIO_MODE_IT_RISING_FALLING 0x10310000u
+#define GPIO_NOPULL 0u
+void HAL_GPIO_Init(GPIO_TypeDef*, GPIO_InitTypeDef*);
+#define __HAL_GPIO_EXTI_GET_RISING_IT(p) (EXTI->RPR1 & (p))
+#define __HAL_GPIO_EXTI_GET_FALLING_IT(p) (EXTI->FPR1 & (p))
+#define __HAL_GPIO_EXTI_CLEAR_RISING_IT(p) (EXTI->RPR1 = (p))
+#define __HAL_GPIO_EXTI_CLEAR_FALLING_IT(p) (EXTI->FPR1 = (p))
+#endif
+#endif
@@ -0,0 +1,171 @@
+// remote ioctls in loopback: the command frames are answered by a local echo
+// device at the same 8-bit address; one request per device is in flight, so
+// every response is matched to the request that caused it, also when a remote
+// ioctl sends no reply
+#include "host_test.h"
+#include "host_can.h"
+#include "device.h"
+#include "can_device.h"
+
+#define ECHO_ID 0x0040 // local device answering the loopback
+#define REMOTE_ID 0x0140 // can device at the same address, misses the local table
+#define STREAM_ID 0x0041 // can device with a receive callback (sends on its own)
+#define POOL_ID 0x0150 // can devices 0x0150.. fill the pending pool, one request each
+#define NO_REPLY 0xEE // echo command whose ioctl returns NULL
+
+extern can_dev_pending_t can_dev_pending[CAN_DEV_PENDING_SIZE];
+extern uint32_t can_dev_sync_dropped;
+
+// answers with the command, so a response tells which command it belongs to
+size_t echo_calls;
+data_field_t* echo_ioctl_r(data_field_t* cmd, data_field_t* res) {
+    ++echo_calls;
+    if (cmd->data[0] == NO_REPLY) return NULL;
+    *res = *cmd;
+    return res;
+}
+
+uint16_t done_tag;
+can_dev_async_status_t done_status;
+data_field_t done_res;
+size_t done_calls;
+void done_fn(uint16_t tag, can_dev_async_status_t status, data_field_t* res) {
+    done_tag = tag;
+    done_status = status;
+    done_res = *res;
+    ++done_calls;
+}
+
+size_t stream_calls;
+uint8_t* stream_fn(uint8_t* data) {
+    ++stream_calls;
+    return NULL;
+}
+
+static data_field_t cmd1(uint8_t value) {
+    return (data_field_t) {.length = 1, .data = {value}};
+}
+
+static size_t pending_slots() {
+    size_t n = 0;
+    for (int i = 0; i < CAN_DEV_PENDING_SIZE; i++) n += can_dev_pending[i].status != CDA_FREE;
+    return n;
+}
+
+int main() {
+    FDCAN_HandleTypeDef fdcan = {0};
+    dev_init_devtab();
+    can_dev_init_devtab(&fdcan);
+    CHECK(dev_register((device_t) {.id = ECHO_ID, .name = "echo", .ioctl_r = echo_ioctl_r}) != NULL);
+    CHECK(can_dev_register(REMOTE_ID, 0x20, 1) != NULL);
+    CHECK(can_dev_register(STREAM_ID, 0x21, 1) != NULL);
+    can_dev_set_callback(STREAM_ID, stream_fn);
+    can_dev_set_loopback(can_dev_loopback_tx);
+
+    for (int i = 0; i < CAN_DEV_PENDING_SIZE; i++) CHECK(can_dev_register(POOL_ID + i, 0x22, 1) != NULL);
+
+    // one request per device in flight, a second waits for the answer of the first
+    data_field_t c = cmd1(0x10);
+    uint16_t a = can_dev_ioctl_async(REMOTE_ID, &c, 10, NULL);
+    CHECK(a != 0);
+    c = cmd1(0x11);
+    CHECK(can_dev_ioctl_async(REMOTE_ID, &c, 10, NULL) == 0);
+    CHECK(can_dev_async_poll(a, NULL) == CDA_PENDING);
+    CHECK(can_dev_process() == 1 && echo_calls == 1);
+    uint16_t b = can_dev_ioctl_async(REMOTE_ID, &c, 10, NULL);
+    CHECK(b != 0);
+    can_dev_process();
+    data_field_t res = {.length = 0};
+    CHECK(can_dev_async_poll(b, &res) == CDA_DONE && res.length == 1 && res.data[0] == 0x11);
+    CHECK(can_dev_async_poll(a, &res) == CDA_DONE && res.length == 1 && res.data[0] == 0x10);
+    CHECK(can_dev_async_poll(a, NULL) == CDA_FREE);
+    CHECK(pending_slots() == 0);
+
+    // a sync command holds the device like an async one, and is dropped while one is in flight
+    c = cmd1(0x20);
+    dev_ioctl(REMOTE_ID, &c);
+    CHECK(can_dev_ioctl_async(REMOTE_ID, &c, 10, NULL) == 0);
+    can_dev_process();
+    CHECK(pending_slots() == 0); // answered sync commands are freed without a callback
+    c = cmd1(0x21);
+    a = can_dev_ioctl_async(REMOTE_ID, &c, 10, done_fn);
+    c = cmd1(0x22);
+    dev_ioctl(REMOTE_ID, &c);
+    c = cmd1(0x23);
+    dev_ioctl_r(REMOTE_ID, &c, &res);
+    CHECK(res.length == 0); // the sync path returns nothing
+    CHECK(can_dev_sync_dropped == 2 && pending_slots() == 1);
+    can_dev_process();
+    CHECK(echo_calls == 4);
+    CHECK(done_calls == 1 && done_tag == a && done_status == CDA_DONE && done_res.data[0] == 0x21);
+    CHECK(pending_slots() == 0);
+
+    // a remote ioctl without reply times out, the next request still gets its own answer
+    c = cmd1(NO_REPLY);
+    a = can_dev_ioctl_async(REMOTE_ID, &c, 10, NULL);
+    can_dev_process();
+    CHECK(can_dev_async_poll(a, NULL) == CDA_PENDING);
+    host_ms += 10;
+    can_dev_process();
+    CHECK(can_dev_async_poll(a, &res) == CDA_TIMEOUT && res.length == 0);
+    c = cmd1(0x24);
+    b = can_dev_ioctl_async(REMOTE_ID, &c, 10, NULL);
+    can_dev_process();
+    CHECK(can_dev_async_poll(b, &res) == CDA_DONE && res.data[0] == 0x24);
+
+    // no answer: the sync slot and the async request time out
+    can_dev_set_loopback(NULL);
+    host_can_frame_count = 0;
+    c = cmd1(0x30);
+    dev_ioctl(REMOTE_ID, &c);
+    can_dev_process();
+    host_ms += CAN_DEV_SYNC_TIMEOUT_MS;
+    can_dev_process();
+    CHECK(pending_slots() == 0 && done_calls == 1);
+    c = cmd1(0x31);
+    b = can_dev_ioctl_async(REMOTE_ID, &c, 50, done_fn);
+    can_dev_process();
+    CHECK(host_can_frame_count == 2 && host_can_frames[1].address == (REMOTE_ID & 0xFF));
+    CHECK(host_can_frames[1].priority == 0x40 && host_can_frames[1].data[0] == 0x31);
+    host_ms += 50;
+    can_dev_process();
+    CHECK(pending_slots() == 0);
+    CHECK(done_calls == 2 && done_tag == b && done_status == CDA_TIMEOUT && done_res.length == 0);
+
+    // a late answer to a timed out command completes nothing
+    uint8_t late = 0x30;
+    host_can_receive(CANLIB2_FIFO1, 0x41, REMOTE_ID & 0xFF, 1, &late);
+    CHECK(pending_slots() == 0);
+
+    // a full pool drops sync commands instead of sending them untracked
+    for (int i = 0; i < CAN_DEV_PENDING_SIZE; i++) {
+        c = cmd1(i);
+        CHECK(can_dev_ioctl_async(POOL_ID + i, &c, 10, NULL) != 0);
+    }
+    host_can_frame_count = 0;
+    c = cmd1(0x40);
+    dev_ioctl(REMOTE_ID, &c);
+    CHECK(can_dev_ioctl_async(REMOTE_ID, &c, 10, NULL) == 0);
+    CHECK(can_dev_sync_dropped == 3);
+    can_dev_process();
+    CHECK(host_can_frame_count == CAN_DEV_PENDING_SIZE);
+    host_ms += 10;
+    can_dev_process();
+    for (int i = 0; i < CAN_DEV_PENDING_SIZE; i++) can_dev_pending[i].status = CDA_FREE; // polled, never collected
+
+    // frames of a streaming device go to its callback, it takes no async requests
+    c = cmd1(0x50);
+    CHECK(can_dev_ioctl_async(STREAM_ID, &c, 10, NULL) == 0);
+    host_can_frame_count = 0;
+    dev_ioctl(STREAM_ID, &c); // still sent, untracked
+    can_dev_process();
+    CHECK(host_can_frame_count == 1 && pending_slots() == 0);
+    c = cmd1(0x51);
+    a = can_dev_ioctl_async(REMOTE_ID, &c, 10, NULL);
+    uint8_t frame = 0x52;
+    host_can_receive(CANLIB2_FIFO1, 0x43, STREAM_ID & 0xFF, 1, &frame);
+    CHECK(stream_calls == 1);
+    CHECK(can_dev_async_poll(a, NULL) == CDA_PENDING);
+
+    return host_test_result("test_can_async");
+}
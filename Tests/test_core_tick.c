@@ -0,0 +1,128 @@
+// 64-bit tick over TIM2 wraps: CNT and SR are scripted through the
+// CORE_TICK_CNT/CORE_TICK_SR hooks, the counter wraps between any two reads
+// and the update interrupt runs late, early, or in the middle of a read
+#include "host_test.h"
+#include "core.h"
+#include <stdlib.h>
+
+#define READS 2000000
+// 4096 register reads per wrap: a pending update interrupt runs long before the
+// counter is half a wrap further (on the target that margin is 214 s)
+#define WRAP_STEP 0x00100000u
+
+TIM_HandleTypeDef host_tick = {.Instance = TIM2};
+extern TIM_HandleTypeDef* htim_100ns_tick;
+extern volatile uint32_t core_100ns_hi;
+
+uint32_t host_cnt;
+uint32_t host_true_hi; // wraps done by the "hardware"
+uint32_t host_step;
+int host_preempt; // 1 in host_preempt register reads lets a pending update interrupt in
+
+int host_in_irq;
+
+// pending update interrupt fires now if allowed
+static void host_tick_maybe_irq() {
+    if (host_in_irq || !host_preempt || !(TIM2->SR & TIM_SR_UIF) || rand() % host_preempt) return;
+    host_in_irq = 1;
+    core_tick_irq_handler();
+    host_in_irq = 0;
+}
+
+// the counter moves by host_step on every register read
+static void host_tick_advance() {
+    uint32_t prev = host_cnt;
+    host_cnt += host_step;
+    if (host_cnt < prev) {
+        ++host_true_hi;
+        TIM2->SR |= TIM_SR_UIF;
+    }
+}
+
+uint32_t host_tick_cnt() {
+    host_tick_maybe_irq();
+    host_tick_advance();
+    return host_cnt;
+}
+
+uint32_t host_tick_sr() {
+    host_tick_maybe_irq();
+    host_tick_advance();
+    return TIM2->SR;
+}
+
+static uint64_t host_true_tick() {
+    return ((uint64_t) host_true_hi << 32) | host_cnt;
+}
+
+static void reset(uint32_t cnt) {
+    host_cnt = cnt;
+    host_true_hi = 0;
+    core_100ns_hi = 0;
+    TIM2->SR = 0;
+}
+
+int main() {
+    htim_100ns_tick = &host_tick;
+
+    // a wrap seen by the reader before its interrupt ran
+    host_step = 0;
+    reset(5);
+    TIM2->SR = TIM_SR_UIF;
+    host_true_hi = 1;
+    CHECK(core_get_raw_tick() == (1ull << 32) + 5);
+    core_tick_irq_handler();
+    CHECK(core_100ns_hi == 1 && !(TIM2->SR & TIM_SR_UIF));
+    CHECK(core_get_raw_tick() == (1ull << 32) + 5);
+
+    // the counter wraps on the CNT read: new low word, flag set
+    host_step = 0x20;
+    reset(0xFFFFFFF0u);
+    uint64_t t = core_get_raw_tick();
+    CHECK(t == 0x100000010ull);
+
+    // CNT read just before the wrap, flag already set by the time SR is read
+    reset(0xFFFFFFD0u);
+    t = core_get_raw_tick();
+    CHECK(t == 0xFFFFFFF0ull);
+    CHECK(TIM2->SR & TIM_SR_UIF);
+    CHECK(core_get_raw_tick() == 0x100000030ull);
+
+    // sweep: many wraps, the interrupt delayed by the reader's priority or preempting it
+    const int preempt[] = {0, 1, 2, 7, 64};
+    for (size_t p = 0; p < sizeof(preempt) / sizeof(preempt[0]); p++) {
+        srand(p + 1);
+        host_preempt = preempt[p];
+        host_step = WRAP_STEP + p * 3;
+        reset(0xF0000000u);
+        uint64_t last = 0;
+        int backwards = 0, outside = 0;
+        for (int i = 0; i < READS; i++) {
+            uint64_t before = host_true_tick();
+            t = core_get_raw_tick();
+            uint64_t after = host_true_tick();
+            if (t < last) ++backwards;
+            if (t < before || t > after) ++outside;
+            last = t;
+            // a reader at the interrupt's priority: it runs between reads
+            if (host_preempt == 0 && rand() % 16 == 0 && (TIM2->SR & TIM_SR_UIF)) core_tick_irq_handler();
+        }
+        CHECK(backwards == 0);
+        CHECK(outside == 0);
+        CHECK(host_true_hi > 500);
+        CHECK(core_100ns_hi == host_true_hi || core_100ns_hi + 1 == host_true_hi);
+    }
+
+    // the flag is the only record of a wrap the interrupt has not counted yet, so
+    // nothing but core_tick_irq_handler may clear it (HAL_TIM_IRQHandler did)
+    host_preempt = 0;
+    host_step = 0;
+    reset(0x10);
+    TIM2->SR = TIM_SR_UIF;
+    host_true_hi = 1;
+    t = core_get_raw_tick();
+    TIM2->SR = 0;
+    CHECK(core_get_raw_tick() == t - (1ull << 32));
+
+    return host_test_result("test_core_tick");
+}
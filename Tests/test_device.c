@@ -0,0 +1,97 @@
+// dev_get_device: correctness of the flash table and the dynamic index, and per-call
+// cost against the old linear scan at 8, 32 and 255 registered devices
+// (255 is the most the 8-bit address index holds, see LOCAL_DEVTAB_SIZE)
+#include "host_test.h"
+#include "device.h"
+
+#define BENCH_ROUNDS 2000000
+
+// remote ioctls are not under test
+void can_dev_ioctl(uint16_t id, data_field_t* cmd) {
+    (void) id;
+    (void) cmd;
+}
+
+data_field_t* bench_ioctl(data_field_t* cmd) {
+    return cmd;
+}
+
+// 3-byte result, command byte repeated
+data_field_t* wide_ioctl_r(data_field_t* cmd, data_field_t* res) {
+    res->length = 3;
+    for (int i = 0; i < 3; i++) res->data[i] = cmd->data[0];
+    return res;
+}
+
+// lookup before the index: scan every slot of a full-size table
+device_t linear_tab[LOCAL_DEVTAB_SIZE];
+size_t linear_size;
+static const device_t* linear_get_device(uint16_t id) {
+    for (size_t i = 0; i < linear_size; i++) {
+        if (linear_tab[i].id == id) return &linear_tab[i];
+    }
+    return NULL;
+}
+
+volatile uintptr_t sink;
+
+static double bench(const device_t* (*get)(uint16_t), uint16_t first, size_t n) {
+    uint32_t start = host_cycles();
+    for (size_t r = 0; r < BENCH_ROUNDS; r++) {
+        sink += (uintptr_t) get(first + (r % n));
+    }
+    return (double) (uint32_t) (host_cycles() - start) / BENCH_ROUNDS;
+}
+
+static void run(size_t n) {
+    dev_init_devtab();
+    linear_size = n;
+    for (size_t k = 0; k < n; k++) {
+        device_t dev = {.id = 0x0100 + k, .name = "bench", .ioctl = bench_ioctl};
+        CHECK(dev_register(dev) != NULL);
+        linear_tab[k] = dev;
+    }
+
+    // every registered id resolves to its own slot, aliased and unknown ids miss
+    for (size_t k = 0; k < n; k++) {
+        const device_t* dev = dev_get_device(0x0100 + k);
+        CHECK(dev != NULL && dev->id == 0x0100 + k);
+        CHECK(dev_get_device(0x0200 + k) == NULL);
+    }
+    CHECK(dev_get_device(DEV_TEST_DEVICE_ID) != NULL);
+    CHECK(dev_get_device(DEV_VECTOR_DEVICE_ID) != NULL);
+
+    double hit = bench(dev_get_device, 0x0100, n);
+    double miss = bench(dev_get_device, 0x0200, n);
+    double old_hit = bench(linear_get_device, 0x0100, n);
+    double old_miss = bench(linear_get_device, 0x0200, n);
+    printf("  %3zu devices: index hit %5.1f ns, miss %5.1f ns | linear hit %6.1f ns, miss %6.1f ns\n",
+           n, hit, miss, old_hit, old_miss);
+}
+
+int main() {
+    // the flash table is sorted by id at link time
+    for (const device_t* dev = __devtab_start; dev + 1 < __devtab_end; dev++) CHECK(dev->id < (dev + 1)->id);
+
+    // a full table rejects more devices and a second device on a taken address
+    dev_init_devtab();
+    CHECK(dev_register((device_t) {.id = 0x0105, .ioctl = bench_ioctl}) != NULL);
+    CHECK(dev_register((device_t) {.id = 0x0205, .ioctl = bench_ioctl}) == NULL);
+    CHECK(dev_register((device_t) {.id = 0x0105, .ioctl = bench_ioctl}) == NULL);
+
+    // vector device: results past the frame are reported failed, never cut short
+    dev_init_devtab();
+    CHECK(dev_register((device_t) {.id = 0x0040, .ioctl_r = wide_ioctl_r}) != NULL);
+    CHECK(dev_register((device_t) {.id = 0x0041, .ioctl = bench_ioctl}) != NULL);
+    data_field_t vcmd = {.length = 8, .data = {0x40, 1, 0x40, 2, 0x40, 3, 0x41, 4}};
+    data_field_t vres;
+    CHECK(dev_ioctl_r(DEV_VECTOR_DEVICE_ID, &vcmd, &vres) != NULL);
+    CHECK(vres.data[0] == 0xB && vres.length == 8); // third entry would need bytes 7-9
+    CHECK(vres.data[1] == 1 && vres.data[4] == 2 && vres.data[7] == 4);
+
+    printf("dev_get_device per call (host):\n");
+    run(8);
+    run(32);
+    run(LOCAL_DEVTAB_SIZE);
+    return host_test_result("test_device");
+}
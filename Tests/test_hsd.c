@@ -0,0 +1,150 @@
+// HSD enables through the device fast paths: pins follow the requested state
+// (one BSRR word per port), and the per-call cost of dev_set against the
+// dev_ioctl path on the host clock, cross-checked with dev_stats
+#include "host_test.h"
+#include "device.h"
+#include "dev_stats.h"
+#include "hsd.h"
+#include "din.h"
+#include "hsd_sense.h"
+#include "sched.h"
+
+#define CALLS 1000000
+
+TIM_HandleTypeDef host_tick = {.Instance = TIM2};
+ADC_HandleTypeDef host_adc;
+extern TIM_HandleTypeDef* htim_100ns_tick;
+extern uint16_t hsd_sense_buf[HSD_SENSE_MAX_CHIPS];
+
+// one sense scan completing, the DMA interrupt as the ADC would raise it
+static void scan(uint16_t raw) {
+    TIM2->CNT += CORE_US_TO_TICKS(HSD_SENSE_SETTLE_US);
+    for (int i = 0; i < HSD_SENSE_MAX_CHIPS; i++) hsd_sense_buf[i] = raw;
+    HAL_ADC_ConvCpltCallback(&host_adc);
+}
+
+static uint8_t pin_is(GPIO_TypeDef* port, uint16_t pin, uint8_t level) {
+    return (port->BSRR & (level ? pin : (uint32_t) pin << 16)) != 0;
+}
+
+static double ns_per_call(uint32_t start) {
+    return (double) (uint32_t) (host_cycles() - start) / CALLS;
+}
+
+int main() {
+    dev_init_devtab();
+    dev_stats_init();
+    hsd_init();
+
+    // enable pins: set and reset through BSRR, the shadow tracks them
+    dev_handle_t hsd50 = dev_bind(HSD_50_ID);
+    CHECK(hsd50 != NULL && hsd50->set != NULL);
+    hsd_t* chip = &hsdtab[hsd_channels[2].chip];
+    dev_set(hsd50, 1);
+    CHECK(pin_is(HSD50_EN1_GPIO_Port, HSD50_EN1_Pin, 1));
+    CHECK(chip->shadow == chip->state);
+    dev_set(hsd50, 0);
+    CHECK(pin_is(HSD50_EN1_GPIO_Port, HSD50_EN1_Pin, 0));
+    CHECK(chip->shadow == chip->state);
+
+    // every channel device drives the enable of its hsd_channels entry
+    for (size_t ch = 0; ch < hsd_channel_count; ch++) {
+        hsd_t* c = &hsdtab[hsd_channels[ch].chip];
+        uint8_t bit = 1 << (HSD_SIG_EN1 + hsd_channels[ch].en);
+        dev_set(dev_bind(hsd_channels[ch].id), 1);
+        CHECK(c->state & bit);
+        dev_set(dev_bind(hsd_channels[ch].id), 0);
+        CHECK(!(c->state & bit));
+    }
+
+    // an unchanged state writes nothing
+    HSD50_EN1_GPIO_Port->BSRR = 0;
+    dev_set(hsd50, 0);
+    CHECK(HSD50_EN1_GPIO_Port->BSRR == 0);
+
+    // the ioctl path ends in the same state
+    data_field_t cmd = {.length = 1, .data = {1}};
+    CHECK(dev_ioctl(HSD_50_ID, &cmd) != NULL);
+    CHECK(pin_is(HSD50_EN1_GPIO_Port, HSD50_EN1_Pin, 1));
+    cmd.data[0] = 0;
+    dev_ioctl(HSD_50_ID, &cmd);
+
+    // per-call cost, host ns: bound handle against lookup + data_field_t packing
+    uint32_t start = host_cycles();
+    for (uint32_t i = 0; i < CALLS; i++) dev_set(hsd50, i & 1);
+    double set_ns = ns_per_call(start);
+
+    start = host_cycles();
+    for (uint32_t i = 0; i < CALLS; i++) {
+        cmd.data[0] = i & 1;
+        dev_ioctl(HSD_50_ID, &cmd);
+    }
+    double ioctl_ns = ns_per_call(start);
+
+    dev_handle_t din = dev_bind(DIN_DEVICE_ID);
+    CHECK(din != NULL && din->get != NULL);
+    volatile uint32_t sink = 0;
+    start = host_cycles();
+    for (uint32_t i = 0; i < CALLS; i++) sink += dev_get(din);
+    double get_ns = ns_per_call(start);
+
+    start = host_cycles();
+    for (uint32_t i = 0; i < CALLS / 100; i++) dev_bind(HSD_50_ID);
+    double bind_ns = ns_per_call(start) * 100;
+    (void) sink;
+
+    // dev_stats times the ioctl path (DEV_STATS_BEGIN/END around the driver call)
+    const dev_stats_t* st = dev_stats_get(HSD_50_ID);
+    CHECK(st != NULL && st->count >= CALLS);
+    printf("  hsd 50 per call (host): dev_set %.1f ns, dev_ioctl %.1f ns (driver mean %u ns), "
+           "dev_get(din) %.1f ns, dev_bind %.1f ns\n",
+           set_ns, ioctl_ns, (unsigned) (st->total / st->count), get_ns, bind_ns);
+
+    // HSDD_READ in HSDD_AUTO answers with the newest sample of the sequencer
+    htim_100ns_tick = &host_tick;
+    host_adc.Instance = ADC1;
+    TIM2->CNT = 1000;
+    sched_init(&host_tick);
+    dev_set(hsd50, 0);
+    hsd_sense_init(&host_adc);
+    data_field_t read = {.length = 1, .data = {HSDD_READ}};
+    data_field_t res;
+    CHECK(hsdtab[1].dia == HSDD_AUTO);
+    CHECK(dev_ioctl_r(HSD_5X_DIA_ID, &read, &res) != NULL);
+    CHECK(res.length == 1 && res.data[0] == 0xFF); // nothing converted yet
+    // both channels off: each current is held for a settled scan in turn
+    const uint8_t steps[] = {HSDD_I_CH1, HSDD_I_CH1, HSDD_I_CH2, HSDD_I_CH2, HSDD_I_CH1};
+    for (uint8_t i = 0; i < sizeof(steps); i++) {
+        CHECK(hsd_sense_option(1) == steps[i]);
+        scan(100 * (i + 1));
+        CHECK(dev_ioctl_r(HSD_5X_DIA_ID, &read, &res) != NULL);
+        CHECK(res.length == 5 && res.data[4] == steps[i]);
+        CHECK(*((float*) res.data) == hsd_sense_to_volts(100 * (i + 1)));
+    }
+
+    // one channel on: the mux stays on its current
+    dev_set(hsd50, 1);
+    scan(100);
+    for (int i = 0; i < 10; i++) {
+        CHECK(hsd_sense_option(1) == HSDD_I_CH1);
+        scan(100);
+    }
+
+    // the temperature once in HSD_SENSE_TEMP_STEPS steps
+    int n = 0;
+    while (hsd_sense_option(1) != HSDD_TEMP && n <= HSD_SENSE_TEMP_STEPS) {
+        scan(100);
+        ++n;
+    }
+    CHECK(n < HSD_SENSE_TEMP_STEPS);
+    scan(300);
+    CHECK(hsd_sense_option(1) == HSDD_I_CH1);
+    dev_set(hsd50, 0);
+
+    // an explicit option still reads its own slot
+    read = (data_field_t) {.length = 2, .data = {HSDD_READ, HSDD_TEMP}};
+    CHECK(dev_ioctl_r(HSD_5X_DIA_ID, &read, &res) != NULL);
+    CHECK(res.length == 5 && res.data[4] == HSDD_TEMP && *((float*) res.data) == hsd_sense_to_volts(300));
+
+    return host_test_result("test_hsd");
+}
@@ -0,0 +1,212 @@
+// overcurrent guard against a model of the ADC1 analog watchdogs: every sense
+// step converts the SNS pin of each chip in the option its mux shows, and while
+// the guard watches ADC1 converts on its own between the steps; a watchdog armed
+// on that channel flags readings above its threshold and the ADC1 interrupt runs
+// at once, as on the target
+#include "host_test.h"
+#include "device.h"
+#include "hsd.h"
+#include "hsd_sense.h"
+#include "hsd_guard.h"
+#include "sched.h"
+
+#define CHIP 1 // HSD_5X
+#define CH 2 // HSD_50, enable 1 of the chip
+#define NORMAL 1000
+#define FAULT 4000 // above HSD_GUARD_DEFAULT_THRESHOLD
+#define SCAN_US 20 // continuous conversion of every rank, oversampled
+
+TIM_HandleTypeDef host_tick = {.Instance = TIM2};
+ADC_HandleTypeDef host_adc;
+extern TIM_HandleTypeDef* htim_100ns_tick;
+extern uint16_t hsd_sense_buf[HSD_SENSE_MAX_CHIPS];
+
+uint8_t fault; // HSD_50 draws overcurrent while enabled
+uint16_t temp_raw = NORMAL;
+uint32_t watch_scans; // continuous scans between the steps
+core_tick_t cut_at; // last cut of a channel by the guard
+
+static void blocked(uint16_t id, uint8_t blocked) {
+    if (blocked) cut_at = core_get_tick();
+}
+
+// mux option shown by the pins of a chip
+static uint8_t pins_option(uint8_t chip) {
+    uint8_t dia = hsdtab[chip].shadow & HSD_DIA_MASK;
+    if (dia == 1 << HSD_SIG_DIA_EN) return HSDD_I_CH1;
+    if (dia == ((1 << HSD_SIG_DIA_EN) | (1 << HSD_SIG_SEL2))) return HSDD_I_CH2;
+    if (dia == 1 << HSD_SIG_SEL1) return HSDD_TEMP;
+    return HSDD_DIA_OFF;
+}
+
+static uint8_t enabled() {
+    return hsdtab[CHIP].shadow >> HSD_SIG_EN1 & 1;
+}
+
+// SNS reading of a chip
+static uint16_t sns(uint8_t chip) {
+    uint8_t option = pins_option(chip);
+    if (option == HSDD_TEMP) return temp_raw;
+    if (chip == CHIP && option == HSDD_I_CH1 && fault && enabled()) return FAULT;
+    return NORMAL;
+}
+
+// one conversion through the watchdogs: AWD2 and AWD3 compare the 8 MSBs with their high threshold
+static void convert(uint8_t chip, uint16_t raw) {
+    uint32_t bit = 1u << __LL_ADC_CHANNEL_TO_DECIMAL_NB(hsdtab[chip].config.sns_channel);
+    if ((ADC1->AWD2CR & bit) && (raw >> 4) > (ADC1->TR2 >> 16 & 0xFF)) ADC1->ISR |= ADC_FLAG_AWD2;
+    if ((ADC1->AWD3CR & bit) && (raw >> 4) > (ADC1->TR3 >> 16 & 0xFF)) ADC1->ISR |= ADC_FLAG_AWD3;
+    if (ADC1->ISR & ADC1->IER) hsd_guard_irq_handler();
+}
+
+// one sense step: ADC1 converts on its own while started, then the scheduler
+// starts the scan, the chips convert, the DMA completes
+static void step() {
+    for (int t = 0; t < HSD_SENSE_SETTLE_US; t += SCAN_US) {
+        TIM2->CNT += CORE_US_TO_TICKS(SCAN_US);
+        if (!(ADC1->CR & ADC_CR_ADSTART)) continue;
+        for (uint8_t chip = 0; chip < hsd_chip_count; chip++) convert(chip, sns(chip));
+        ++watch_scans;
+    }
+    TIM2->SR |= TIM_FLAG_CC1;
+    sched_irq_handler();
+    CHECK(!(ADC1->CR & ADC_CR_ADSTART)); // the scan starts from an idle ADC1
+    for (uint8_t chip = 0; chip < hsd_chip_count; chip++) {
+        convert(chip, sns(chip));
+        hsd_sense_buf[chip] = sns(chip);
+    }
+    HAL_ADC_ConvCpltCallback(&host_adc);
+}
+
+// steps until the guard cuts HSD_50, 0 if it did not within max
+static int steps_to_cut(int max) {
+    for (int i = 1; i <= max; i++) {
+        step();
+        if (!enabled()) return i;
+    }
+    return 0;
+}
+
+// time from a fault at the start of a step to the cut, 0 if not cut within max steps
+static core_ticks_t time_to_cut(int max) {
+    core_tick_t start = core_get_tick();
+    fault = 1;
+    int n = steps_to_cut(max);
+    fault = 0;
+    return n ? cut_at - start : 0;
+}
+
+static uint8_t guard_cmd(uint8_t command) {
+    data_field_t cmd = {.length = 3, .data = {HSDD_GUARD, command, 0}};
+    data_field_t res;
+    CHECK(dev_ioctl_r(HSD_5X_DIA_ID, &cmd, &res) != NULL);
+    return res.data[0];
+}
+
+int main() {
+    htim_100ns_tick = &host_tick;
+    host_adc.Instance = ADC1;
+    TIM2->CNT = 1000;
+    dev_init_devtab();
+    hsd_init();
+    sched_init(&host_tick);
+    hsd_sense_init(&host_adc);
+    hsd_set_block_hook(blocked);
+    const hsd_guard_channel_t* g = hsd_guard_get(CH);
+    dev_handle_t hsd50 = dev_bind(HSD_50_ID);
+    dev_handle_t hsd51 = dev_bind(HSD_51_ID);
+    dev_set(hsd50, 1);
+
+    // healthy load, nothing trips, ADC1 converts between the steps
+    for (int i = 0; i < 9; i++) step();
+    CHECK(enabled() && g->trips == 0);
+    CHECK(watch_scans > 0);
+
+    // in HSDD_AUTO the mux stays on the current of the one enabled channel: cut on
+    // the next conversion, except around the temperature step (two steps off the current)
+    int cuts = 0, fast = 0;
+    core_ticks_t worst = 0;
+    for (int i = 0; i < HSD_SENSE_TEMP_STEPS; i++) {
+        for (int j = 0; j < 3; j++) step(); // back on the current after the clear
+        core_ticks_t t = time_to_cut(4);
+        CHECK(t > 0 && g->state == HGS_BACKOFF);
+        CHECK(g->latency <= CORE_US_TO_TICKS(HSD_SENSE_SETTLE_US)); // from its step start
+        if (t > worst) worst = t;
+        fast += t <= CORE_US_TO_TICKS(SCAN_US);
+        ++cuts;
+        CHECK(guard_cmd(HGC_CLEAR) == 0);
+    }
+    CHECK(fast >= cuts - cuts / 10);
+    CHECK(worst <= CORE_US_TO_TICKS(2 * HSD_SENSE_SETTLE_US + SCAN_US));
+    CHECK(g->trips == (uint32_t) cuts);
+    core_ticks_t worst_one = worst;
+
+    // both channels of the chip on, the SNS pin shows each current in turn
+    dev_set(hsd51, 1);
+    worst = 0;
+    for (int phase = 0; phase < 8; phase++) {
+        for (int i = 0; i < 3 + phase; i++) step();
+        core_ticks_t t = time_to_cut(8);
+        CHECK(t > 0);
+        if (t > worst) worst = t;
+        CHECK(guard_cmd(HGC_CLEAR) == 0);
+    }
+    CHECK(worst <= CORE_US_TO_TICKS((HSD_SENSE_HOLD_STEPS + 2) * HSD_SENSE_SETTLE_US + SCAN_US));
+    dev_set(hsd51, 0);
+    printf("  fault to cut: one channel on %d of %d within %d us, worst %u us; both on worst %u us\n",
+           fast, cuts, SCAN_US, (unsigned) (worst_one / CORE_US_TO_TICKS(1)), (unsigned) (worst / CORE_US_TO_TICKS(1)));
+
+    // backoff doubles per trip in a row, then the channel latches off
+    CHECK(guard_cmd(HGC_CLEAR) == 0);
+    fault = 1;
+    CHECK(steps_to_cut(3) > 0);
+    core_ticks_t backoff = CORE_MS_TO_TICKS(HSD_GUARD_RETRY_MS);
+    for (int retry = 1; retry <= HSD_GUARD_MAX_RETRIES; retry++) {
+        int held = 0;
+        while (!enabled() && held < 10000) {
+            step();
+            ++held;
+        }
+        CHECK(held * CORE_US_TO_TICKS(HSD_SENSE_SETTLE_US) >= backoff);
+        CHECK(steps_to_cut(3) > 0);
+        backoff = backoff * 2 < CORE_MS_TO_TICKS(HSD_GUARD_RETRY_MAX_MS) ? backoff * 2 : CORE_MS_TO_TICKS(HSD_GUARD_RETRY_MAX_MS);
+    }
+    CHECK(g->state == HGS_LATCHED && g->latches == 1);
+    for (int i = 0; i < 4000; i++) step(); // 2 s
+    CHECK(!enabled() && hsdtab[CHIP].state >> HSD_SIG_EN1 & 1); // held off, the request is kept
+
+    // cleared with the fault gone, stays on
+    fault = 0;
+    CHECK(guard_cmd(HGC_CLEAR) == 0);
+    for (int i = 0; i < 9; i++) step();
+    CHECK(enabled() && g->state == HGS_OK);
+    uint32_t trips = g->trips;
+
+    // the current option selected: watched on every conversion
+    data_field_t dia = {.length = 1, .data = {HSDD_I_CH1}};
+    data_field_t res;
+    CHECK(dev_ioctl_r(HSD_5X_DIA_ID, &dia, &res) != NULL && res.data[0] == 0);
+    step();
+    step();
+    core_ticks_t t = time_to_cut(1);
+    CHECK(t > 0 && t <= CORE_US_TO_TICKS(SCAN_US));
+    CHECK(guard_cmd(HGC_CLEAR) == 0);
+    dia.data[0] = HSDD_AUTO;
+    dev_ioctl_r(HSD_5X_DIA_ID, &dia, &res);
+    trips = g->trips;
+
+    // a mux change from CAN while the watchdog is armed on the current: the
+    // temperature reading crosses the old threshold but must not cut the channel
+    do step(); while (pins_option(CHIP) != HSDD_I_CH1);
+    CHECK(ADC1->AWD3CR != 0);
+    dia.data[0] = HSDD_TEMP;
+    CHECK(dev_ioctl_r(HSD_5X_DIA_ID, &dia, &res) != NULL && res.data[0] == 0);
+    temp_raw = FAULT;
+    step();
+    CHECK(enabled() && g->trips == trips);
+    CHECK(ADC1->AWD3CR == 0); // rewritten with the ADC idle
+    for (int i = 0; i < 6; i++) step();
+    CHECK(enabled() && g->trips == trips);
+
+    return host_test_result("test_hsd_guard");
+}
@@ -0,0 +1,116 @@
+// HSD_50 as a second timing channel on TIM2_CH2 (TIMING_HSD50_COMPARE) against a
+// model of the compare: on a match of CNT and CCR2 the pin follows the active or
+// inactive mode and CC2IF is raised, the forced modes set the pin at once
+#include "host_test.h"
+#include "device.h"
+#include "hsd.h"
+#include "timing.h"
+#include "timing_queue.h"
+#include "timing_prediction.h"
+
+TIM_HandleTypeDef host_tick = {.Instance = TIM2};
+TIM_HandleTypeDef host_queue = {.Instance = TIM7};
+extern TIM_HandleTypeDef* htim_100ns_tick;
+extern timing_event_t timing_events[NUM_TIMING_EVENTS];
+
+#define CH 2 // HSD_50
+
+uint8_t pin; // PB3 in alternate function mode
+uint32_t rises;
+core_tick_t pin_at; // tick of the last pin transition
+
+// hardware edges: pin transitions on a match against the due tick of the armed edge
+uint32_t pin_edges;
+int64_t pin_worst_error;
+
+// output compare mode of TIM2_CH2
+static uint32_t mode() {
+    return TIM2->CCMR1 >> 8 & TIM_CCMR1_OC1M;
+}
+
+static void set_pin(uint8_t level) {
+    rises += level && !pin;
+    if (level != pin) pin_at = core_get_tick();
+    pin = level;
+}
+
+// advance the core tick, counting TIM7 along and matching TIM2_CH2
+static void advance(core_ticks_t ticks) {
+    for (core_ticks_t t = 0; t < ticks; t++) {
+        TIM2->CNT++;
+        if (mode() == TIM_OCMODE_FORCED_ACTIVE) set_pin(1);
+        if (mode() == TIM_OCMODE_FORCED_INACTIVE) set_pin(0);
+        if (TIM2->CNT == TIM2->CCR2) {
+            const timing_compare_t* oc = timing_compare_get(0);
+            uint8_t was = pin;
+            if (mode() == TIM_OCMODE_ACTIVE) set_pin(1);
+            if (mode() == TIM_OCMODE_INACTIVE) set_pin(0);
+            if (pin != was && oc->count) {
+                int64_t error = (int64_t) (pin_at - oc->edges[0].due);
+                if (error < 0) error = -error;
+                if (error > pin_worst_error) pin_worst_error = error;
+                ++pin_edges;
+            }
+            TIM2->SR |= TIM_FLAG_CC2;
+            if (TIM2->DIER & TIM_FLAG_CC2) timing_compare_irq_handler();
+        }
+
+        if (TIM2->CNT % TIMING_QUEUE_TICKS_PER_COUNT) continue;
+        if (!(TIM7->CR1 & TIM_CR1_CEN) || TIM7->ARR == 0) continue;
+        if (TIM7->CNT++ < TIM7->ARR) continue;
+        TIM7->CNT = 0;
+        TIM7->SR |= TIM_FLAG_UPDATE;
+        timing_queue_irq_handler();
+    }
+}
+
+// one rotation at a steady period, TDC at its start
+static void rotation(core_ticks_t period) {
+    timing_tdc_callback();
+    advance(period);
+}
+
+int main() {
+    htim_100ns_tick = &host_tick;
+    TIM2->CNT = 1000;
+    dev_init_devtab();
+    hsd_init();
+    predict_init();
+    CHECK(timing_init(&host_queue, &host_tick) == 0);
+    const timing_compare_t* oc = timing_compare_get(0);
+    CHECK(oc != NULL);
+
+    // the pin changes on the due tick of each hardware edge, nothing is forced late
+    core_ticks_t period = CORE_US_TO_TICKS(20000); // 3000 rpm
+    for (int i = 0; i < 8; i++) rotation(period);
+    CHECK(oc->edges_done > 0 && oc->forced == 0);
+    CHECK(pin_edges >= 8 && pin_worst_error == 0);
+    CHECK(oc->worst_error == 0);
+    uint32_t r = rises;
+    rotation(period);
+    CHECK(rises == r + 1); // at SPARK, high through HOLD
+
+    // a guard cut (hsd_block_channel) takes the pin low at once and keeps it low,
+    // the edges keep running
+    timing_tdc_callback();
+    core_ticks_t hold = ((uint64_t) (timing_events[0].angle + TIMING_DEG(180)) * period) >> 16;
+    advance(hold + 2);
+    CHECK(pin == 1);
+    hsd_block_channel(CH, 1);
+    advance(1);
+    CHECK(pin == 0);
+    uint32_t done = oc->edges_done;
+    advance(period - hold - 2);
+    r = rises;
+    for (int i = 0; i < 4; i++) rotation(period);
+    CHECK(rises == r && pin == 0);
+    CHECK(oc->edges_done > done);
+
+    // released, the next edges drive the pin again
+    hsd_block_channel(CH, 0);
+    CHECK(pin == 0);
+    rotation(period);
+    CHECK(rises == r + 1);
+
+    return host_test_result("test_timing_compare");
+}
@@ -0,0 +1,121 @@
+// advance map lookups against a double bilinear reference on a gradient table,
+// the bracket cache over a sweep, and the commit checks of the CAN edits
+#include <math.h>
+#include "host_test.h"
+#include "device.h"
+#include "timing.h"
+#include "timing_map.h"
+
+extern timing_map_table_t* timing_map_shadow;
+extern uint32_t timing_map_lookups;
+extern uint32_t timing_map_misses;
+
+// advance of a cell in the gradient table
+static uint16_t gradient(uint8_t r, uint8_t l) {
+    return TIMING_DEG(5) + r * TIMING_DEG(3) + l * TIMING_DEG(1) + (r * l & 1) * 7;
+}
+
+static uint8_t map_cmd(uint8_t command, uint8_t a, uint8_t b, uint16_t value) {
+    data_field_t cmd = {.length = 5, .data = {command, a, b, value & 0xFF, value >> 8}};
+    data_field_t res;
+    CHECK(dev_ioctl_r(TIMING_MAP_ID, &cmd, &res) != NULL);
+    return res.data[0];
+}
+
+static uint8_t axis_cmd(uint8_t command, uint8_t i, uint16_t value) {
+    data_field_t cmd = {.length = 4, .data = {command, i, value & 0xFF, value >> 8}};
+    data_field_t res;
+    CHECK(dev_ioctl_r(TIMING_MAP_ID, &cmd, &res) != NULL);
+    return res.data[0];
+}
+
+// position of x on an axis, clamped at the ends
+static double position(const uint16_t* axis, uint8_t n, uint32_t x, uint8_t* i) {
+    if (x <= axis[0]) {
+        *i = 0;
+        return 0;
+    }
+    if (x >= axis[n - 1]) {
+        *i = n - 2;
+        return 1;
+    }
+    for (*i = 0; x >= axis[*i + 1]; ++*i);
+    return (double) (x - axis[*i]) / (axis[*i + 1] - axis[*i]);
+}
+
+static double reference(uint32_t rpm, uint16_t load) {
+    const timing_map_table_t* t = timing_map_get();
+    uint8_t r, l;
+    double fr = position(t->rpm, TIMING_MAP_RPM_POINTS, rpm, &r);
+    double fl = position(t->load, TIMING_MAP_LOAD_POINTS, load, &l);
+    double lo = t->advance[r][l] + (t->advance[r][l + 1] - t->advance[r][l]) * fl;
+    double hi = t->advance[r + 1][l] + (t->advance[r + 1][l + 1] - t->advance[r + 1][l]) * fl;
+    return lo + (hi - lo) * fr;
+}
+
+int main() {
+    dev_init_devtab();
+    data_field_t early = {.length = 3, .data = {TMC_GET_CELL, 0, 0}};
+    data_field_t early_res;
+    CHECK(dev_ioctl_r(TIMING_MAP_ID, &early, &early_res) == NULL); // no map before init
+    timing_map_init(TIMING_DEG(12));
+
+    // gradient table through the CAN commands
+    for (uint8_t r = 0; r < TIMING_MAP_RPM_POINTS; r++) {
+        for (uint8_t l = 0; l < TIMING_MAP_LOAD_POINTS; l++) CHECK(map_cmd(TMC_SET_CELL, r, l, gradient(r, l)) == 0);
+    }
+    CHECK(map_cmd(TMC_COMMIT, 0, 0, 0) == 0);
+
+    // rpm sweep at a fixed load, then a load sweep at a fixed rpm
+    // each lerp rounds, so the error of the three stays under 1 LSB
+    double worst_rpm = 0, worst_load = 0;
+    timing_map_lookups = 0;
+    timing_map_misses = 0;
+    timing_map_set_load(500);
+    for (uint32_t rpm = 400; rpm <= 12500; rpm += 7) {
+        double error = fabs(timing_map_lookup(rpm) - reference(rpm, 500));
+        if (error > worst_rpm) worst_rpm = error;
+    }
+    uint32_t lookups = timing_map_lookups, misses = timing_map_misses;
+    for (uint16_t load = 0; load <= TIMING_MAP_LOAD_FULL; load++) {
+        timing_map_set_load(load);
+        double error = fabs(timing_map_lookup(5000) - reference(5000, load));
+        if (error > worst_load) worst_load = error;
+    }
+    CHECK(worst_rpm < 1 && worst_load < 1);
+    CHECK(misses < lookups / 10); // the cached bracket takes most lookups
+    printf("  rpm sweep: %u lookups, %u bracket searches, worst error %.2f LSB; load sweep: worst error %.2f LSB\n",
+        lookups, misses, worst_rpm, worst_load);
+
+    // rejected edits: out of range cells are refused, a bad table is not swapped in
+    CHECK(map_cmd(TMC_SET_CELL, 0, 0, 0) == 1); // a spark at TDC
+    CHECK(map_cmd(TMC_SET_CELL, 0, 0, TIMING_MAP_MAX_ADVANCE + 1) == 1);
+    CHECK(map_cmd(TMC_SET_CELL, TIMING_MAP_RPM_POINTS, 0, 100) == 1);
+    timing_map_shadow->advance[3][3] = 0;
+    CHECK(map_cmd(TMC_COMMIT, 0, 0, 0) == 1);
+    timing_map_shadow->advance[3][3] = gradient(3, 3);
+    CHECK(axis_cmd(TMC_SET_RPM, 2, 900) == 0); // below rpm[1]
+    CHECK(map_cmd(TMC_COMMIT, 0, 0, 0) == 1);
+    CHECK(timing_map_get()->rpm[2] == 2000);
+    CHECK(axis_cmd(TMC_SET_RPM, 2, 2000) == 0);
+    CHECK(map_cmd(TMC_COMMIT, 0, 0, 0) == 0);
+
+    // every lookup of a committed table keeps the spark off TDC
+    for (uint8_t r = 0; r < TIMING_MAP_RPM_POINTS; r++) {
+        for (uint8_t l = 0; l < TIMING_MAP_LOAD_POINTS; l++) {
+            CHECK(map_cmd(TMC_SET_CELL, r, l, (r + l) % 2 ? TIMING_MAP_MAX_ADVANCE : TIMING_MAP_MIN_ADVANCE) == 0);
+        }
+    }
+    CHECK(map_cmd(TMC_COMMIT, 0, 0, 0) == 0);
+    uint16_t lowest = UINT16_MAX;
+    for (uint16_t load = 0; load <= TIMING_MAP_LOAD_FULL; load += 10) {
+        timing_map_set_load(load);
+        for (uint32_t rpm = 0; rpm <= 13000; rpm += 13) {
+            uint16_t advance = timing_map_lookup(rpm);
+            if (advance < lowest) lowest = advance;
+        }
+    }
+    CHECK(lowest >= TIMING_MAP_MIN_ADVANCE);
+
+    return host_test_result("test_timing_map");
+}
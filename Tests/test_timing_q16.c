@@ -0,0 +1,132 @@
+// Q16 angle math of timing_tdc_callback against the float math it replaced:
+// a TDC sweep from 500 to 12000 rpm in 1 rpm steps with a jittered period
+// compares the edge times, the RPM and the range check, then the old and new
+// expressions are timed on the host clock
+#include "host_test.h"
+#include "device.h"
+#include "hsd.h"
+#include "timing.h"
+#include "timing_queue.h"
+#include "timing_prediction.h"
+
+#define CALLS 1000000
+#define PERIODS 3 // TDCs per rpm step
+
+TIM_HandleTypeDef host_tick = {.Instance = TIM2};
+TIM_HandleTypeDef host_queue = {.Instance = TIM7};
+extern TIM_HandleTypeDef* htim_100ns_tick;
+extern timing_event_t timing_events[NUM_TIMING_EVENTS];
+extern core_ticks_t timing_prev_rotation;
+extern uint32_t timing_us_prev_rotation;
+extern uint32_t timing_rpm;
+extern uint32_t timing_pred_us;
+
+// event angles as the float fractions the table held before
+const float fractions[NUM_TIMING_EVENTS - 1] = {0, 12.0 / 360, 348.0 / 360};
+
+// the old code, kept here as the reference
+static core_ticks_t float_ticks(float fraction, core_ticks_t period) {
+    return fraction * period;
+}
+static uint32_t float_rpm(uint32_t us) {
+    return (uint32_t) (((float) (US_PER_S * S_PER_M)) / ((float) us));
+}
+static int float_in_range(uint32_t pred, uint32_t prev) {
+    return pred < TIMING_VALID_RANGE_MAX_US && TIMING_VALID_RANGE_MIN_US < prev
+        && pred < prev * 1.2 && pred > prev * 0.8;
+}
+
+// the new code, as in timing_tdc_callback
+static core_ticks_t q16_ticks(uint32_t angle, core_ticks_t period) {
+    return ((uint64_t) angle * period) >> 16;
+}
+static uint32_t q16_rpm(uint32_t us) {
+    return us ? TIMING_RPM_US / us : 0;
+}
+static int q16_in_range(uint32_t pred, uint32_t prev) {
+    uint64_t pred5 = (uint64_t) pred * 5;
+    return pred < TIMING_VALID_RANGE_MAX_US && TIMING_VALID_RANGE_MIN_US < prev
+        && pred5 < (uint64_t) prev * 6 && pred5 > (uint64_t) prev * 4;
+}
+
+// advance the core tick by a rotation, TIM2 wraps every 7 minutes
+static void advance(core_ticks_t ticks) {
+    uint32_t before = TIM2->CNT;
+    TIM2->CNT += ticks;
+    if (TIM2->CNT < before) {
+        TIM2->SR |= TIM_SR_UIF;
+        core_tick_irq_handler();
+    }
+}
+
+static double ns_per_call(uint32_t start) {
+    return (double) (uint32_t) (host_cycles() - start) / CALLS;
+}
+
+volatile uint32_t sink;
+
+int main() {
+    htim_100ns_tick = &host_tick;
+    TIM2->CNT = 1000;
+    dev_init_devtab();
+    hsd_init();
+    predict_init();
+    CHECK(timing_init(&host_queue, &host_tick) == 0);
+
+    // sweep: every TDC compares the edge times of the firmware against the float math
+    core_ticks_t worst = 0;
+    uint32_t worst_rpm = 0, rpm_diff = 0, range_diff = 0, in_range = 0, tdcs = 0;
+    uint32_t seed = 1;
+    for (uint32_t rpm = 500; rpm <= 12000; rpm++) {
+        for (int i = 0; i < PERIODS; i++) {
+            // +-25% jitter, so the range check sees predictions on both sides
+            seed = seed * 1103515245 + 12345;
+            double jitter = 0.75 + (seed >> 16 & 0x7FFF) / 65536.0;
+            advance((core_ticks_t) (CORE_US_TO_TICKS(TIMING_RPM_US / rpm) * jitter));
+            timing_tdc_callback();
+            ++tdcs;
+
+            rpm_diff += timing_rpm != float_rpm(timing_us_prev_rotation);
+            int ok = float_in_range(timing_pred_us, timing_us_prev_rotation);
+            range_diff += ok != q16_in_range(timing_pred_us, timing_us_prev_rotation);
+            range_diff += ok != (timing_queue_pending() > 0); // edges pushed by the firmware
+            if (!ok) continue;
+            ++in_range;
+            for (int e = 0; e < NUM_TIMING_EVENTS - 1; e++) {
+                core_ticks_t ref = float_ticks(fractions[e], timing_prev_rotation);
+                core_ticks_t q = timing_events[e].ticks;
+                core_ticks_t error = q > ref ? q - ref : ref - q;
+                if (error > worst) {
+                    worst = error;
+                    worst_rpm = rpm;
+                }
+            }
+        }
+    }
+    CHECK(worst <= CORE_US_TO_TICKS(1));
+    CHECK(rpm_diff == 0 && range_diff == 0);
+    CHECK(in_range > tdcs / 4 && in_range < tdcs); // both sides of the range check were seen
+    printf("  sweep 500-12000 rpm: %u TDCs, %u in range, worst edge error %.1f us at %u rpm\n",
+        tdcs, in_range, worst / 10.0, worst_rpm);
+
+    // the per-TDC math, old and new (host FPU, the target has single precision only)
+    volatile uint32_t period = CORE_US_TO_TICKS(20000);
+    volatile uint32_t us = 20000, pred = 20100;
+    uint32_t start = host_cycles();
+    for (uint32_t i = 0; i < CALLS; i++) {
+        uint32_t s = float_rpm(us) + float_in_range(pred, us);
+        for (int e = 0; e < NUM_TIMING_EVENTS - 1; e++) s += float_ticks(fractions[e], period);
+        sink = s;
+    }
+    double old_ns = ns_per_call(start);
+    start = host_cycles();
+    for (uint32_t i = 0; i < CALLS; i++) {
+        uint32_t s = q16_rpm(us) + q16_in_range(pred, us);
+        for (int e = 0; e < NUM_TIMING_EVENTS - 1; e++) s += q16_ticks(timing_events[e].angle, period);
+        sink = s;
+    }
+    double new_ns = ns_per_call(start);
+    printf("  tdc math per call (host): float %.1f ns, q16 %.1f ns\n", old_ns, new_ns);
+
+    return host_test_result("test_timing_q16");
+}
@@ -0,0 +1,161 @@
+// event queue against a model of TIM7: a basic up-counter at one count per
+// TIMING_QUEUE_TICKS_PER_COUNT that raises its update flag when CNT reaches ARR,
+// and never counts with ARR 0; the queue interrupt runs when the flag is raised,
+// or later to model interrupt latency
+#include "host_test.h"
+#include "device.h"
+#include "hsd.h"
+#include "timing.h"
+#include "timing_queue.h"
+#include "timing_prediction.h"
+
+TIM_HandleTypeDef host_tick = {.Instance = TIM2};
+TIM_HandleTypeDef host_queue = {.Instance = TIM7};
+extern TIM_HandleTypeDef* htim_100ns_tick;
+extern timing_event_t timing_events[NUM_TIMING_EVENTS];
+extern uint32_t timing_dwell_clamped;
+
+#define CHIP 0 // HSD_12X
+
+// test output, keeps the last value and when it was set
+uint8_t out_value = 0xFF;
+core_tick_t out_at;
+uint32_t out_sets;
+static void out_set(uint8_t value) {
+    out_value = value;
+    out_at = core_get_tick();
+    ++out_sets;
+}
+dev_handle_t out;
+
+uint8_t irq_masked; // the timer flag is left pending, as with a higher priority interrupt running
+
+// advance the core tick, counting TIM7 along
+static void advance(core_ticks_t ticks) {
+    for (core_ticks_t t = 0; t < ticks; t++) {
+        TIM2->CNT++;
+        if (TIM2->CNT % TIMING_QUEUE_TICKS_PER_COUNT) continue;
+        if (!(TIM7->CR1 & TIM_CR1_CEN) || TIM7->ARR == 0) continue;
+        if (TIM7->CNT++ < TIM7->ARR) continue;
+        TIM7->CNT = 0;
+        TIM7->SR |= TIM_FLAG_UPDATE;
+        if (!irq_masked) timing_queue_irq_handler();
+    }
+}
+
+// an edge set at most half a count early (the lead of the queue), and less
+// than the shortest timer wait of 2 counts late
+static int on_time(core_tick_t at, core_tick_t due) {
+    int64_t error = (int64_t) (at - due);
+    return error >= -TIMING_QUEUE_TICKS_PER_COUNT / 2 && error < 2 * TIMING_QUEUE_TICKS_PER_COUNT;
+}
+
+// one rotation at a steady period, TDC at its start
+static void rotation(core_ticks_t period) {
+    timing_tdc_callback();
+    advance(period);
+}
+
+// level of HSD_120, the channel the timing events drive
+static uint8_t hsd120() {
+    return hsdtab[CHIP].shadow >> HSD_SIG_EN1 & 1;
+}
+
+int main() {
+    htim_100ns_tick = &host_tick;
+    TIM2->CNT = 1000;
+    dev_init_devtab();
+    out = dev_register((device_t) {.id = 0x0101, .name = "out", .set = out_set});
+    timing_queue_init(&host_queue, NULL);
+    const timing_queue_stats_t* stats = timing_queue_get_stats();
+
+    // an event already due fires before the push returns, the timer stays off
+    core_tick_t now = core_get_tick();
+    CHECK(timing_queue_push(now - 5, out, 1, 0, 0) == 0);
+    CHECK(out_value == 1 && timing_queue_pending() == 0);
+    CHECK(!(TIM7->CR1 & TIM_CR1_CEN));
+
+    // an event a single count ahead runs the timer
+    now = core_get_tick();
+    CHECK(timing_queue_push(now + TIMING_QUEUE_TICKS_PER_COUNT, out, 0, 0, 0) == 0);
+    CHECK(timing_queue_pending() == 1);
+    CHECK((TIM7->CR1 & TIM_CR1_CEN) && TIM7->ARR >= 1);
+    advance(3 * TIMING_QUEUE_TICKS_PER_COUNT);
+    CHECK(out_value == 0 && timing_queue_pending() == 0);
+    CHECK(on_time(out_at, now + TIMING_QUEUE_TICKS_PER_COUNT));
+
+    // edges due in under a count after the one that wakes the timer
+    for (int gap = 0; gap < 3 * TIMING_QUEUE_TICKS_PER_COUNT; gap++) {
+        now = core_get_tick();
+        uint32_t sets = out_sets;
+        CHECK(timing_queue_push(now + 200, out, 1, 0, 0) == 0);
+        CHECK(timing_queue_push(now + 200 + gap, out, 0, 0, 0) == 0);
+        advance(200 + gap + 3 * TIMING_QUEUE_TICKS_PER_COUNT);
+        CHECK(out_sets == sets + 2 && out_value == 0 && timing_queue_pending() == 0);
+        CHECK(on_time(out_at, now + 200 + gap));
+    }
+
+    // the interrupt runs late: the next edge is already due when it re-arms
+    now = core_get_tick();
+    CHECK(timing_queue_push(now + 200, out, 1, 0, 0) == 0);
+    CHECK(timing_queue_push(now + 260, out, 0, 0, 0) == 0);
+    CHECK(timing_queue_push(now + 1000, out, 1, 0, 0) == 0);
+    irq_masked = 1;
+    advance(400);
+    irq_masked = 0;
+    uint32_t fired = stats->fired;
+    timing_queue_irq_handler();
+    CHECK(stats->fired == fired + 2 && out_value == 0 && timing_queue_pending() == 1);
+    CHECK((TIM7->CR1 & TIM_CR1_CEN) && TIM7->ARR >= 1);
+    advance(800);
+    CHECK(out_value == 1 && timing_queue_pending() == 0);
+    CHECK(on_time(out_at, now + 1000));
+
+    // the event table on HSD_120 with TDC lost after a few rotations: the output
+    // goes high at the spark and back low at the end of the rotation
+    hsd_init();
+    predict_init();
+    CHECK(timing_init(&host_queue, &host_tick) == 0);
+    core_ticks_t period = CORE_US_TO_TICKS(20000); // 3000 rpm
+    for (int i = 0; i < 8; i++) {
+        timing_tdc_callback();
+        advance(period);
+    }
+    timing_tdc_callback();
+    core_ticks_t spark = ((uint64_t) timing_events[TIMING_EVENT_SPARK].angle * period) >> 16;
+    advance(spark + 2 * TIMING_QUEUE_TICKS_PER_COUNT);
+    CHECK(hsd120() == 1);
+    advance(period - spark);
+    CHECK(hsd120() == 0);
+    advance(3 * period);
+    CHECK(hsd120() == 0 && timing_queue_pending() == 0);
+
+    // the edge error of HSD_120 keeps the early edges of the lead apart from the late ones
+    data_field_t cmd = {.length = 2, .data = {TIC_GET_EDGE_ERROR, 0}};
+    data_field_t res;
+    CHECK(dev_ioctl_r(TIMING_DEV_ID, &cmd, &res) != NULL && res.length == 8);
+    int32_t late = ((int32_t*) res.data)[0], early = ((int32_t*) res.data)[1];
+    CHECK(late >= 0 && late < 2 * TIMING_QUEUE_TICKS_PER_COUNT);
+    CHECK(early <= 0 && early >= -TIMING_QUEUE_TICKS_PER_COUNT / 2);
+    CHECK(late > 0 || early < 0);
+
+    // constant dwell above 3/4 of the period: clamped once per rotation, a dwell
+    // change mid rotation reschedules the edges without counting again
+    CHECK(!(timing_dev.flags & DEV_FLAG_INLINE)); // the CAN ISR must not reschedule edges
+    cmd = (data_field_t) {.length = 3, .data = {TIC_SET_DWELL, 30000 & 0xFF, 30000 >> 8}};
+    CHECK(dev_ioctl_r(TIMING_DEV_ID, &cmd, &res) != NULL);
+    for (int i = 0; i < 8; i++) rotation(period);
+    uint32_t clamped = timing_dwell_clamped;
+    CHECK(clamped > 0);
+    timing_tdc_callback();
+    CHECK(timing_dwell_clamped == clamped + 1);
+    for (int i = 0; i < 10; i++) {
+        cmd.data[1] = (30000 + i) & 0xFF;
+        CHECK(dev_ioctl_r(TIMING_DEV_ID, &cmd, &res) != NULL);
+    }
+    CHECK(timing_dwell_clamped == clamped + 1);
+    CHECK(timing_queue_pending() > 0);
+    advance(period);
+
+    return host_test_result("test_timing_queue");
+}